@@ -0,0 +1,394 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+
+#include "deque.h"
+
+// Channel for coroutines with a Deque as its buffer. co_await Pop() suspends while the channel
+// is empty and co_await Push(value) while it holds capacity elements. A push hands its element
+// straight to the oldest suspended Pop, a pop takes the element of the oldest suspended Push.
+// Suspended coroutines are never resumed under the lock: an operation collects the ones it
+// completes and passes them to the scheduler once it has released the lock, so a batch
+// operation wakes all the waiters it served with one lock round trip. The lock itself is a
+// spin lock held only while a few pointers and elements move, never while a coroutine runs.
+
+// Where resumed coroutines run, e.g. the run queue of an event loop. Schedule may be called
+// from any thread that uses the channel
+template<class S>
+concept Scheduler = requires(S &scheduler, std::coroutine_handle<> handle) {
+    scheduler.Schedule(handle);
+};
+
+// Resumes a coroutine right away on the thread completing its operation
+struct InlineScheduler {
+    void Schedule(std::coroutine_handle<> handle) const {
+        handle.resume();
+    }
+};
+
+template<class T, Scheduler S = InlineScheduler, size_t BlockBytes = deque_settings::kBlockBytes>
+class AsyncDeque {
+private:
+    // Suspended operations are linked through their awaiters, which live in the coroutine
+    // frames until they are resumed
+    struct Waiter {
+        Waiter *next = nullptr;
+        std::coroutine_handle<> handle;
+    };
+
+    struct WaiterList {
+        Waiter *head = nullptr;
+        Waiter *tail = nullptr;
+
+        bool IsEmpty() const {
+            return head == nullptr;
+        }
+
+        void PushBack(Waiter *waiter) {
+            waiter->next = nullptr;
+            (tail == nullptr ? head : tail->next) = waiter;
+            tail = waiter;
+        }
+
+        Waiter *PopFront() {
+            Waiter *waiter = head;
+            head = waiter->next;
+            if (head == nullptr) {
+                tail = nullptr;
+            }
+            return waiter;
+        }
+    };
+
+public:
+    static constexpr size_t kUnbounded = SIZE_MAX;
+
+    // co_await gives the element, or nothing once the channel is closed and drained
+    class PopAwaiter : private Waiter {
+    public:
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle);
+
+        std::optional<T> await_resume() {
+            return std::move(value_);
+        }
+
+    private:
+        friend class AsyncDeque;
+
+        explicit PopAwaiter(AsyncDeque *channel) : channel_(channel) {
+        }
+
+        AsyncDeque *channel_;
+        std::optional<T> value_;
+    };
+
+    // co_await gives false when the channel was closed before the element got in
+    class PushAwaiter : private Waiter {
+    public:
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle);
+
+        bool await_resume() const noexcept {
+            return is_pushed_;
+        }
+
+    private:
+        friend class AsyncDeque;
+
+        PushAwaiter(AsyncDeque *channel, T &&value) : channel_(channel), value_(std::move(value)) {
+        }
+
+        AsyncDeque *channel_;
+        T value_;
+        bool is_pushed_ = false;
+    };
+
+    // With capacity 0 every push waits for a pop to take its element
+    explicit AsyncDeque(size_t capacity = kUnbounded, S scheduler = S(),
+                        std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    AsyncDeque(const AsyncDeque &) = delete;
+
+    AsyncDeque &operator=(const AsyncDeque &) = delete;
+
+    // No coroutine may be suspended on the channel any more
+    ~AsyncDeque() = default;
+
+    PushAwaiter Push(T value);
+
+    PopAwaiter Pop();
+
+    // Never suspend, false or nothing when the operation would
+    bool TryPush(T value);
+
+    std::optional<T> TryPop();
+
+    // Copies the longest prefix of values that fits, returns its length
+    size_t TryPushBatch(std::span<const T> values);
+
+    // Moves up to out.size() elements into out, returns how many there were
+    size_t TryPopBatch(std::span<T> out);
+
+    // Pushes fail from now on and pops drain what is left. Resumes every suspended coroutine
+    void Close();
+
+    bool IsClosed() const;
+
+    // May be stale by the time it returns when other threads use the channel
+    size_t Size() const;
+
+private:
+    Deque<T, BlockBytes> elements_;
+    size_t capacity_;
+    [[no_unique_address]] S scheduler_;
+    bool is_closed_ = false;
+    WaiterList pushers_;
+    WaiterList poppers_;
+    mutable std::atomic<bool> is_locked_ = false;
+
+    void Lock() const {
+        while (is_locked_.exchange(true, std::memory_order_acquire)) {
+            while (is_locked_.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void Unlock() const {
+        is_locked_.store(false, std::memory_order_release);
+    }
+
+    // Holds the lock for its scope, also when an element operation throws under it
+    class SpinGuard {
+    public:
+        explicit SpinGuard(const AsyncDeque *channel) : channel_(channel) {
+            channel_->Lock();
+        }
+
+        SpinGuard(const SpinGuard &) = delete;
+
+        SpinGuard &operator=(const SpinGuard &) = delete;
+
+        ~SpinGuard() {
+            channel_->Unlock();
+        }
+
+    private:
+        const AsyncDeque *channel_;
+    };
+
+    // Holds the lock for its scope and then schedules the coroutines of the operations
+    // completed meanwhile. A throwing element operation leaves every waiter in ready completed,
+    // so they are resumed on the way out as well
+    class ResumeGuard {
+    public:
+        explicit ResumeGuard(AsyncDeque *channel) : channel_(channel) {
+            channel_->Lock();
+        }
+
+        ResumeGuard(const ResumeGuard &) = delete;
+
+        ResumeGuard &operator=(const ResumeGuard &) = delete;
+
+        ~ResumeGuard() {
+            channel_->Unlock();
+            channel_->Resume(ready);
+        }
+
+        WaiterList ready;
+
+    private:
+        AsyncDeque *channel_;
+    };
+
+    // Schedules the coroutines of the completed operations in ready, without the lock
+    void Resume(WaiterList &ready);
+
+    // The operations with the lock held. They complete suspended operations of the other
+    // side where they can, which are added to ready. An operation that throws loses neither an
+    // element nor a waiter
+
+    bool CanPushLocked() const;
+
+    void PushLocked(T &&value, WaiterList &ready);
+
+    bool TryPopLocked(std::optional<T> &value, WaiterList &ready);
+};
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::PopAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    ResumeGuard guard(channel_);
+    // Only reached in an empty channel when no push is suspended either
+    if (channel_->elements_.Size() == 0 and channel_->pushers_.IsEmpty() and
+        !channel_->is_closed_) {
+        this->handle = handle;
+        channel_->poppers_.PushBack(this);
+        return true;
+    }
+    channel_->TryPopLocked(value_, guard.ready);
+    return false;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::PushAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    ResumeGuard guard(channel_);
+    if (channel_->is_closed_) {
+        return false;
+    }
+    if (!channel_->CanPushLocked()) {
+        this->handle = handle;
+        channel_->pushers_.PushBack(this);
+        return true;
+    }
+    channel_->PushLocked(std::move(value_), guard.ready);
+    is_pushed_ = true;
+    return false;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+AsyncDeque<T, S, BlockBytes>::AsyncDeque(size_t capacity, S scheduler,
+                                         std::pmr::memory_resource *resource)
+    : elements_(resource), capacity_(capacity), scheduler_(std::move(scheduler)) {
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+typename AsyncDeque<T, S, BlockBytes>::PushAwaiter AsyncDeque<T, S, BlockBytes>::Push(T value) {
+    return PushAwaiter(this, std::move(value));
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+typename AsyncDeque<T, S, BlockBytes>::PopAwaiter AsyncDeque<T, S, BlockBytes>::Pop() {
+    return PopAwaiter(this);
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::TryPush(T value) {
+    ResumeGuard guard(this);
+    if (is_closed_ or !CanPushLocked()) {
+        return false;
+    }
+    PushLocked(std::move(value), guard.ready);
+    return true;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+std::optional<T> AsyncDeque<T, S, BlockBytes>::TryPop() {
+    std::optional<T> result;
+    {
+        ResumeGuard guard(this);
+        TryPopLocked(result, guard.ready);
+    }
+    return result;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+size_t AsyncDeque<T, S, BlockBytes>::TryPushBatch(std::span<const T> values) {
+    ResumeGuard guard(this);
+    size_t count = 0;
+    while (count < values.size() and !is_closed_ and CanPushLocked()) {
+        PushLocked(T(values[count]), guard.ready);
+        ++count;
+    }
+    return count;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+size_t AsyncDeque<T, S, BlockBytes>::TryPopBatch(std::span<T> out) {
+    ResumeGuard guard(this);
+    size_t count = 0;
+    std::optional<T> value;
+    while (count < out.size() and TryPopLocked(value, guard.ready)) {
+        out[count++] = std::move(*value);
+    }
+    return count;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+void AsyncDeque<T, S, BlockBytes>::Close() {
+    ResumeGuard guard(this);
+    is_closed_ = true;
+    // Poppers only wait in an empty channel, so all of them come back with nothing
+    while (!poppers_.IsEmpty()) {
+        guard.ready.PushBack(poppers_.PopFront());
+    }
+    while (!pushers_.IsEmpty()) {
+        guard.ready.PushBack(pushers_.PopFront());
+    }
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::IsClosed() const {
+    SpinGuard guard(this);
+    return is_closed_;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+size_t AsyncDeque<T, S, BlockBytes>::Size() const {
+    SpinGuard guard(this);
+    return elements_.Size();
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+void AsyncDeque<T, S, BlockBytes>::Resume(WaiterList &ready) {
+    while (!ready.IsEmpty()) {
+        // The awaiter is gone once its coroutine runs
+        std::coroutine_handle<> handle = ready.PopFront()->handle;
+        scheduler_.Schedule(handle);
+    }
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::CanPushLocked() const {
+    return !poppers_.IsEmpty() or elements_.Size() < capacity_;
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+void AsyncDeque<T, S, BlockBytes>::PushLocked(T &&value, WaiterList &ready) {
+    if (poppers_.IsEmpty()) {
+        elements_.PushBack(std::move(value));
+        return;
+    }
+    // The popper stays suspended when the element does not get to it
+    static_cast<PopAwaiter *>(poppers_.head)->value_.emplace(std::move(value));
+    ready.PushBack(poppers_.PopFront());
+}
+
+template<class T, Scheduler S, size_t BlockBytes>
+bool AsyncDeque<T, S, BlockBytes>::TryPopLocked(std::optional<T> &value, WaiterList &ready) {
+    if (elements_.Size() == 0 and pushers_.IsEmpty()) {
+        return false;
+    }
+    auto *pusher = static_cast<PushAwaiter *>(pushers_.head);
+    if (elements_.Size() == 0) {
+        // A channel of capacity 0
+        value.emplace(std::move(pusher->value_));
+        pusher->is_pushed_ = true;
+        ready.PushBack(pushers_.PopFront());
+        return true;
+    }
+    // Pushes only wait in a full channel, the oldest one takes the room about to be left
+    if (pusher != nullptr) {
+        elements_.PushBack(std::move(pusher->value_));
+        pusher->is_pushed_ = true;
+        ready.PushBack(pushers_.PopFront());
+    }
+    value.emplace(std::move(elements_[0]));
+    elements_.PopFront();
+    return true;
+}
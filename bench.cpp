@@ -0,0 +1,377 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <deque>
+#include <execution>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <span>
+#include <vector>
+
+#include <deque.h>
+#include <deque_parallel.h>
+#include <mpmc_ring.h>
+
+// The single-threaded benchmarks run for Deque and std::deque over the same sizes, MpmcRing is
+// compared with a Deque behind a mutex. The run_bench_deque target writes the results to
+// bench_deque.json
+
+namespace {
+
+constexpr int64_t kMinSize = 1 << 10;
+constexpr int64_t kMaxSize = 1 << 20;
+
+void PushBack(Deque<int> &deque, int value) {
+    deque.PushBack(value);
+}
+
+void PushBack(std::deque<int> &deque, int value) {
+    deque.push_back(value);
+}
+
+void PushFront(Deque<int> &deque, int value) {
+    deque.PushFront(value);
+}
+
+void PushFront(std::deque<int> &deque, int value) {
+    deque.push_front(value);
+}
+
+void PopBack(Deque<int> &deque) {
+    deque.PopBack();
+}
+
+void PopBack(std::deque<int> &deque) {
+    deque.pop_back();
+}
+
+void PopFront(Deque<int> &deque) {
+    deque.PopFront();
+}
+
+void PopFront(std::deque<int> &deque) {
+    deque.pop_front();
+}
+
+void EraseInsert(Deque<int> &deque, size_t index) {
+    deque.Erase(index);
+    deque.Insert(index, 0);
+}
+
+void EraseInsert(std::deque<int> &deque, size_t index) {
+    deque.erase(deque.begin() + static_cast<std::ptrdiff_t>(index));
+    deque.insert(deque.begin() + static_cast<std::ptrdiff_t>(index), 0);
+}
+
+size_t Size(const Deque<int> &deque) {
+    return deque.Size();
+}
+
+size_t Size(const std::deque<int> &deque) {
+    return deque.size();
+}
+
+template<class Container>
+Container MakeFilled(int64_t size) {
+    Container container;
+    std::mt19937 gen(size);
+    for (int64_t i = 0; i < size; ++i) {
+        PushBack(container, static_cast<int>(gen()));
+    }
+    return container;
+}
+
+template<class Container>
+void BM_PushBack(benchmark::State &state) {
+    int64_t size = state.range(0);
+    for (auto _ : state) {
+        Container container;
+        for (int64_t i = 0; i < size; ++i) {
+            PushBack(container, static_cast<int>(i));
+        }
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<class Container>
+void BM_PushFront(benchmark::State &state) {
+    int64_t size = state.range(0);
+    for (auto _ : state) {
+        Container container;
+        for (int64_t i = 0; i < size; ++i) {
+            PushFront(container, static_cast<int>(i));
+        }
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<class Container>
+void BM_PopBack(benchmark::State &state) {
+    int64_t size = state.range(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Container container = MakeFilled<Container>(size);
+        state.ResumeTiming();
+        while (Size(container) > 0) {
+            PopBack(container);
+        }
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<class Container>
+void BM_PopFront(benchmark::State &state) {
+    int64_t size = state.range(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Container container = MakeFilled<Container>(size);
+        state.ResumeTiming();
+        while (Size(container) > 0) {
+            PopFront(container);
+        }
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+// Every index depends on the element read before it, so this measures the latency of
+// operator[] rather than how many independent lookups the core can overlap
+template<class Container>
+void BM_RandomAccess(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Container container = MakeFilled<Container>(size);
+    size_t mask = static_cast<size_t>(size) - 1;
+    size_t index = 0;
+    for (auto _ : state) {
+        index = (index * 31 + static_cast<unsigned>(container[index])) & mask;
+        benchmark::DoNotOptimize(index);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<class Container>
+void BM_SequentialScan(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Container container = MakeFilled<Container>(size);
+    for (auto _ : state) {
+        int64_t sum = 0;
+        for (int value : container) {
+            sum += value;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * size * static_cast<int64_t>(sizeof(int)));
+}
+
+void BM_SequentialScanSegments(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Deque<int> container = MakeFilled<Deque<int>>(size);
+    for (auto _ : state) {
+        int64_t sum = 0;
+        container.ForEachSegment([&sum](std::span<const int> segment) {
+            for (int value : segment) {
+                sum += value;
+            }
+        });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * size * static_cast<int64_t>(sizeof(int)));
+}
+
+void BM_SequentialScanIndex(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Deque<int> container = MakeFilled<Deque<int>>(size);
+    for (auto _ : state) {
+        int64_t sum = 0;
+        for (size_t i = 0; i < container.Size(); ++i) {
+            sum += container[i];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * size * static_cast<int64_t>(sizeof(int)));
+}
+
+template<class Container>
+void BM_Copy(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Container container = MakeFilled<Container>(size);
+    for (auto _ : state) {
+        Container copy(container);
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetBytesProcessed(state.iterations() * size * static_cast<int64_t>(sizeof(int)));
+}
+
+// Removes and puts back an element in the middle, each moves half of the elements
+template<class Container>
+void BM_MiddleEraseInsert(benchmark::State &state) {
+    int64_t size = state.range(0);
+    Container container = MakeFilled<Container>(size);
+    for (auto _ : state) {
+        EraseInsert(container, static_cast<size_t>(size / 2));
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+// Times the single push that finds a block map of range(0) slots full and doubles it
+void BM_ExpandBuffer(benchmark::State &state) {
+    int64_t blocks = state.range(0);
+    int64_t size = blocks * static_cast<int64_t>(deque_settings::kBlockSize<int>);
+    for (auto _ : state) {
+        Deque<int> container = MakeFilled<Deque<int>>(size);
+        auto start = std::chrono::steady_clock::now();
+        container.PushBack(0);
+        auto finish = std::chrono::steady_clock::now();
+        benchmark::DoNotOptimize(container);
+        state.SetIterationTime(std::chrono::duration<double>(finish - start).count());
+    }
+}
+
+// range(1) is 0 for std::execution::seq and 1 for par
+void BM_ParallelReduce(benchmark::State &state) {
+    Deque<int> container = MakeFilled<Deque<int>>(state.range(0));
+    for (auto _ : state) {
+        int64_t sum = state.range(1) == 0
+                              ? deque_parallel::Reduce(std::execution::seq, container, int64_t{0})
+                              : deque_parallel::Reduce(std::execution::par, container, int64_t{0});
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) *
+                            static_cast<int64_t>(sizeof(int)));
+}
+
+void BM_ParallelSort(benchmark::State &state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        Deque<int> container = MakeFilled<Deque<int>>(state.range(0));
+        state.ResumeTiming();
+        if (state.range(1) == 0) {
+            deque_parallel::Sort(std::execution::seq, container);
+        } else {
+            deque_parallel::Sort(std::execution::par, container);
+        }
+        benchmark::DoNotOptimize(container);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Counts what a deque takes from its memory resource
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t bytes = 0;
+
+private:
+    void *do_allocate(size_t size, size_t alignment) override {
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void *p, size_t size, size_t alignment) override {
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Small blocks pay for a bigger map and more block crossings, large ones leave most of a block
+// unused in short deques. bytes_per_element reports the memory side of that trade-off
+template<size_t BlockBytes>
+void BM_BlockBytes(benchmark::State &state) {
+    int64_t size = state.range(0);
+    CountingResource resource;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        Deque<int, BlockBytes> container(&resource);
+        for (int64_t i = 0; i < size; ++i) {
+            container.PushBack(static_cast<int>(i));
+        }
+        int64_t sum = 0;
+        for (int value : container) {
+            sum += value;
+        }
+        benchmark::DoNotOptimize(sum);
+        bytes = resource.bytes;
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+    state.counters["bytes_per_element"] = static_cast<double>(bytes) / static_cast<double>(size);
+}
+
+constexpr size_t kRingCapacity = 1 << 16;
+
+// Every thread pushes a batch of range(0) elements and pops up to as many, so producers and
+// consumers fight over both ends all the time
+void BM_MpmcRing(benchmark::State &state) {
+    static std::unique_ptr<MpmcRing<int>> ring;
+    if (state.thread_index() == 0) {
+        ring = std::make_unique<MpmcRing<int>>(kRingCapacity);
+    }
+    std::vector<int> batch(state.range(0), state.thread_index());
+    std::vector<int> out(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ring->TryPushBatch(batch));
+        benchmark::DoNotOptimize(ring->TryPopBatch(out));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    if (state.thread_index() == 0) {
+        ring.reset();
+    }
+}
+
+void BM_MutexDeque(benchmark::State &state) {
+    static std::mutex mutex;
+    static Deque<int> deque;
+    if (state.thread_index() == 0) {
+        deque.Clear();
+    }
+    std::vector<int> batch(state.range(0), state.thread_index());
+    std::vector<int> out(state.range(0));
+    for (auto _ : state) {
+        {
+            std::lock_guard lock(mutex);
+            deque.PushBackRange(batch);
+        }
+        std::lock_guard lock(mutex);
+        size_t count = std::min(out.size(), deque.Size());
+        std::copy_n(deque.begin(), count, out.begin());
+        deque.PopFrontN(count);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}  // namespace
+
+#define DEQUE_BENCHMARK(name)                                                                   \
+    BENCHMARK_TEMPLATE(name, Deque<int>)->RangeMultiplier(8)->Range(kMinSize, kMaxSize);      \
+    BENCHMARK_TEMPLATE(name, std::deque<int>)->RangeMultiplier(8)->Range(kMinSize, kMaxSize)
+
+DEQUE_BENCHMARK(BM_PushBack);
+DEQUE_BENCHMARK(BM_PushFront);
+DEQUE_BENCHMARK(BM_PopBack);
+DEQUE_BENCHMARK(BM_PopFront);
+DEQUE_BENCHMARK(BM_RandomAccess);
+DEQUE_BENCHMARK(BM_SequentialScan);
+DEQUE_BENCHMARK(BM_Copy);
+DEQUE_BENCHMARK(BM_MiddleEraseInsert);
+BENCHMARK(BM_SequentialScanSegments)->RangeMultiplier(8)->Range(kMinSize, kMaxSize);
+BENCHMARK(BM_SequentialScanIndex)->RangeMultiplier(8)->Range(kMinSize, kMaxSize);
+BENCHMARK_TEMPLATE(BM_BlockBytes, deque_settings::kSmallBlockBytes)->Range(16, kMaxSize);
+BENCHMARK_TEMPLATE(BM_BlockBytes, deque_settings::kBlockBytes)->Range(16, kMaxSize);
+BENCHMARK_TEMPLATE(BM_BlockBytes, deque_settings::kPageBlockBytes)->Range(16, kMaxSize);
+BENCHMARK_TEMPLATE(BM_BlockBytes, deque_settings::kLargeBlockBytes)->Range(16, kMaxSize);
+BENCHMARK(BM_MpmcRing)->Arg(1)->Arg(32)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_MutexDeque)->Arg(1)->Arg(32)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_ParallelReduce)->ArgsProduct({{1 << 16, kMaxSize}, {0, 1}})->UseRealTime();
+BENCHMARK(BM_ParallelSort)->ArgsProduct({{1 << 16, kMaxSize}, {0, 1}})->UseRealTime();
+BENCHMARK(BM_ExpandBuffer)->RangeMultiplier(8)->Range(1 << 4, 1 << 13)->UseManualTime();
+
+BENCHMARK_MAIN();
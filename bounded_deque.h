@@ -0,0 +1,286 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <tuple>
+#include <utility>
+
+#include "deque.h"
+
+// Sliding window over the last capacity elements pushed, for windowed metrics. The elements
+// live in a Deque that evicts with Deque::PushBackEvict, and the blocks a full window spans
+// are allocated up front, so pushing allocates nothing at all. Aggregates of the window are
+// kept up to date as elements enter and leave it, each at O(1) amortized cost per element.
+
+// What BoundedDeque updates for every element entering and leaving the window. Elements leave
+// in the order they entered. An aggregate is built with the capacity of the window and the
+// memory resource of its deque, to allocate everything it needs up front
+template<class A, class T>
+concept WindowAggregate =
+        std::constructible_from<A, size_t, std::pmr::memory_resource *> and
+        requires(A &aggregate, const A &const_aggregate, const T &value) {
+            aggregate.Add(value);
+            aggregate.Remove(value);
+            aggregate.Clear();
+            const_aggregate.GetValue();
+        };
+
+namespace window_detail {
+
+// Makes sure a deque holding a window of capacity elements never allocates: such a window
+// spans at most this many blocks, wherever in a block it starts
+template<class T, size_t BlockBytes>
+void ReserveWindow(Deque<T, BlockBytes> &deque, size_t capacity) {
+    deque.Reserve(capacity + deque_settings::kBlockSize<T, BlockBytes> - 1);
+}
+
+}  // namespace window_detail
+
+// Running sum. A floating point sum drifts from the exact one as elements are subtracted back
+template<class T>
+class WindowSum {
+public:
+    WindowSum(size_t capacity, std::pmr::memory_resource *resource);
+
+    void Add(const T &value);
+
+    void Remove(const T &value);
+
+    void Clear();
+
+    const T &GetValue() const;
+
+private:
+    T sum_{};
+};
+
+// Least element by Compare, read from a monotone deque: candidates_ holds the elements that
+// no later element precedes, so the front one is the answer and every element is pushed and
+// popped at most once
+template<class T, class Compare = std::less<>, size_t BlockBytes = deque_settings::kBlockBytes>
+class WindowExtremum {
+public:
+    WindowExtremum(size_t capacity, std::pmr::memory_resource *resource);
+
+    void Add(const T &value);
+
+    void Remove(const T &value);
+
+    void Clear();
+
+    // The window must not be empty
+    const T &GetValue() const;
+
+private:
+    Deque<T, BlockBytes> candidates_;
+    [[no_unique_address]] Compare compare_;
+};
+
+template<class T>
+using WindowMin = WindowExtremum<T, std::less<>>;
+
+template<class T>
+using WindowMax = WindowExtremum<T, std::greater<>>;
+
+template<class T, size_t BlockBytes = deque_settings::kBlockBytes,
+         WindowAggregate<T>... Aggregates>
+class BoundedDeque {
+public:
+    using value_type = T;
+    using const_iterator = typename Deque<T, BlockBytes>::const_iterator;
+
+    // capacity must be positive
+    explicit BoundedDeque(size_t capacity,
+                          std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // Append an element, the first one leaves the window when it is full
+    void PushBack(const T &value);
+
+    void PushBack(T &&value);
+
+    template<class... Args>
+    const T &EmplaceBack(Args &&...args);
+
+    void PopFront();
+
+    void Clear();
+
+    // Elements are read only, the aggregates would not see a change
+    const T &operator[](size_t ind) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    size_t Size() const;
+
+    size_t GetCapacity() const;
+
+    bool IsFull() const;
+
+    // E.g. for ForEachSegment over the window
+    const Deque<T, BlockBytes> &GetElements() const;
+
+    template<class A>
+    const A &GetAggregate() const;
+
+private:
+    size_t capacity_;
+    Deque<T, BlockBytes> elements_;
+    std::tuple<Aggregates...> aggregates_;
+
+    template<class Fn>
+    void ForEachAggregate(Fn &&fn) {
+        std::apply([&](Aggregates &...aggregates) { (fn(aggregates), ...); }, aggregates_);
+    }
+};
+
+template<class T>
+WindowSum<T>::WindowSum(size_t, std::pmr::memory_resource *) {
+}
+
+template<class T>
+void WindowSum<T>::Add(const T &value) {
+    sum_ += value;
+}
+
+template<class T>
+void WindowSum<T>::Remove(const T &value) {
+    sum_ -= value;
+}
+
+template<class T>
+void WindowSum<T>::Clear() {
+    sum_ = T{};
+}
+
+template<class T>
+const T &WindowSum<T>::GetValue() const {
+    return sum_;
+}
+
+template<class T, class Compare, size_t BlockBytes>
+WindowExtremum<T, Compare, BlockBytes>::WindowExtremum(size_t capacity,
+                                                       std::pmr::memory_resource *resource)
+    : candidates_(resource) {
+    window_detail::ReserveWindow(candidates_, capacity);
+}
+
+template<class T, class Compare, size_t BlockBytes>
+void WindowExtremum<T, Compare, BlockBytes>::Add(const T &value) {
+    // Equal candidates stay, each of them leaves with its own element
+    const Deque<T, BlockBytes> &candidates = candidates_;
+    while (candidates.Size() > 0 and compare_(value, candidates[candidates.Size() - 1])) {
+        candidates_.PopBack();
+    }
+    candidates_.PushBack(value);
+}
+
+template<class T, class Compare, size_t BlockBytes>
+void WindowExtremum<T, Compare, BlockBytes>::Remove(const T &value) {
+    // value is the oldest element, it is a candidate only if it is still the front one
+    if (!compare_(std::as_const(candidates_)[0], value)) {
+        candidates_.PopFront();
+    }
+}
+
+template<class T, class Compare, size_t BlockBytes>
+void WindowExtremum<T, Compare, BlockBytes>::Clear() {
+    candidates_.Clear();
+}
+
+template<class T, class Compare, size_t BlockBytes>
+const T &WindowExtremum<T, Compare, BlockBytes>::GetValue() const {
+    return candidates_[0];
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+BoundedDeque<T, BlockBytes, Aggregates...>::BoundedDeque(size_t capacity,
+                                                         std::pmr::memory_resource *resource)
+    : capacity_(capacity), elements_(resource), aggregates_(Aggregates(capacity, resource)...) {
+    window_detail::ReserveWindow(elements_, capacity);
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+void BoundedDeque<T, BlockBytes, Aggregates...>::PushBack(const T &value) {
+    EmplaceBack(value);
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+void BoundedDeque<T, BlockBytes, Aggregates...>::PushBack(T &&value) {
+    EmplaceBack(std::move(value));
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+template<class... Args>
+const T &BoundedDeque<T, BlockBytes, Aggregates...>::EmplaceBack(Args &&...args) {
+    if (!IsFull()) {
+        const T &value = elements_.EmplaceBack(std::forward<Args>(args)...);
+        ForEachAggregate([&](auto &aggregate) { aggregate.Add(value); });
+        return value;
+    }
+    // args may refer to the first element. It leaves the aggregates only once the new one is
+    // built, so that a constructor that throws leaves them in step with the window
+    T element(std::forward<Args>(args)...);
+    ForEachAggregate([&](auto &aggregate) { aggregate.Remove(std::as_const(elements_)[0]); });
+    const T &value = elements_.EmplaceBackEvict(capacity_, std::move(element));
+    ForEachAggregate([&](auto &aggregate) { aggregate.Add(value); });
+    return value;
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+void BoundedDeque<T, BlockBytes, Aggregates...>::PopFront() {
+    ForEachAggregate([&](auto &aggregate) { aggregate.Remove(std::as_const(elements_)[0]); });
+    elements_.PopFront();
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+void BoundedDeque<T, BlockBytes, Aggregates...>::Clear() {
+    elements_.Clear();
+    ForEachAggregate([](auto &aggregate) { aggregate.Clear(); });
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+const T &BoundedDeque<T, BlockBytes, Aggregates...>::operator[](size_t ind) const {
+    return elements_[ind];
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+typename BoundedDeque<T, BlockBytes, Aggregates...>::const_iterator
+BoundedDeque<T, BlockBytes, Aggregates...>::begin() const {
+    return elements_.begin();
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+typename BoundedDeque<T, BlockBytes, Aggregates...>::const_iterator
+BoundedDeque<T, BlockBytes, Aggregates...>::end() const {
+    return elements_.end();
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+size_t BoundedDeque<T, BlockBytes, Aggregates...>::Size() const {
+    return elements_.Size();
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+size_t BoundedDeque<T, BlockBytes, Aggregates...>::GetCapacity() const {
+    return capacity_;
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+bool BoundedDeque<T, BlockBytes, Aggregates...>::IsFull() const {
+    return elements_.Size() == capacity_;
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+const Deque<T, BlockBytes> &BoundedDeque<T, BlockBytes, Aggregates...>::GetElements() const {
+    return elements_;
+}
+
+template<class T, size_t BlockBytes, WindowAggregate<T>... Aggregates>
+template<class A>
+const A &BoundedDeque<T, BlockBytes, Aggregates...>::GetAggregate() const {
+    return std::get<A>(aggregates_);
+}
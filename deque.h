@@ -2,624 +2,3535 @@
 
 #include <initializer_list>
 #include <algorithm>
+#include <atomic>
 #include <deque>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <cstdint>
 #include <cstring>
+#include <bit>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <utility>
 
 namespace deque_settings {
-    constexpr size_t kBlockSize = 512 / sizeof(int);
+    constexpr size_t kBlockBytes = 512;
+
+    // Block size presets: two cache lines for programs with many tiny deques, a page and
+    // 64 KiB for long streaming buffers where the block map and the pointer hop between
+    // blocks should almost never show up
+    constexpr size_t kSmallBlockBytes = 128;
+    constexpr size_t kPageBlockBytes = 4096;
+    constexpr size_t kLargeBlockBytes = 1 << 16;
+
+    constexpr size_t kCacheLineSize = 64;
+
+    // Block storage starts on a cache line, so that full blocks can be read with aligned
+    // vector loads
+    constexpr size_t kBlockAlignment = kCacheLineSize;
+
+    // Elements of type T per block, a block holds at least one element
+    template<class T, size_t BlockBytes = kBlockBytes>
+    constexpr size_t kBlockSize = std::max<size_t>(1, BlockBytes / sizeof(T));
+
+    // Removed elements are only destroyed, nothing is written to their slots. With DEQUE_SCRUB
+    // defined their bytes are zeroed too, for programs that keep secrets in deques
+#ifdef DEQUE_SCRUB
+    constexpr bool kScrubRemoved = true;
+#else
+    constexpr bool kScrubRemoved = false;
+#endif
+
+    // Slots of the block map a deque holds inside itself, so that deques of that many blocks
+    // allocate no map at all. Maps taken from the memory resource have kBufferInitMaxSize slots
+    // or more
+    constexpr size_t kInlineMapSize = 2;
     constexpr size_t kBufferInitMaxSize = 1 << 4;
+    constexpr size_t kBlockPoolMaxSize = 1 << 3;
+    constexpr size_t kSlabMinBlocks = 1 << 4;
+    constexpr size_t kSlabMaxBlocks = 1 << 8;
+
+    // The block map only ever doubles from here, which keeps ring wraparound a bit mask
+    static_assert(std::has_single_bit(kInlineMapSize));
+    static_assert(std::has_single_bit(kBufferInitMaxSize));
+    static_assert(kInlineMapSize < kBufferInitMaxSize);
 }  // namespace deque_settings
 
-template<size_t BlockSize>
-struct Block {
-private:
-    int data_[BlockSize];
-    size_t size_ = 0;
-    size_t head_ = 0;
-    size_t tail_ = 0;
-
-public:
-    Block() = default;
+// kSeparate allocates every block on its own, kSlab carves blocks out of large chunks
+enum class BlockStorage {
+    kSeparate,
+    kSlab,
+};
 
-    Block(size_t, int);
+// What Deque::Stats() reports. The gauges are read when it is called. The counters are only
+// collected when DEQUE_STATS is defined, the same way in every translation unit, and stay zero
+// otherwise, so that the push and pop paths do no extra work by default
+struct DequeStats {
+    size_t size = 0;
+    // Blocks the deque uses and the empty ones it keeps for reuse
+    size_t live_blocks = 0;
+    size_t pooled_blocks = 0;
+    // Slots of the block map
+    size_t map_capacity = 0;
+    // Free element slots in front of the first element and behind the last one
+    size_t head_slack = 0;
+    size_t tail_slack = 0;
+    // Bytes taken from the memory resource for blocks and maps. Blocks the deque still shares
+    // with its snapshots count here too
+    size_t allocated_bytes = 0;
+
+    size_t peak_size = 0;
+    size_t map_expansions = 0;
+    // Block pointers copied into grown or shrunk maps, in bytes
+    size_t map_bytes_moved = 0;
+    size_t block_allocations = 0;
+    size_t block_frees = 0;
+    // Blocks handed out again instead of being allocated
+    size_t pool_hits = 0;
+    // Emptied first blocks that became the last block in place, see Deque::PushBackEvict
+    size_t blocks_recycled = 0;
+};
 
-    Block(const Block &other);
+// Memory holding blocks that no memory resource allocated, such as a private mapping of a file
+// (see deque_io.h). Deques use and write such blocks where they are and never free them, copies
+// of a deque copy them. Every deque holding some of them is a user, the last one to let go calls
+// release
+struct ExternalBlocks {
+    const std::byte *begin = nullptr;
+    const std::byte *end = nullptr;
+    void (*release)(ExternalBlocks *) = nullptr;
+    std::atomic<size_t> users = 1;
+
+    void AddUser() {
+        users.fetch_add(1, std::memory_order_relaxed);
+    }
 
-    Block &operator=(const Block &other);
+    void DropUser() {
+        if (users.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(this);
+        }
+    }
+};
 
-    Block(Block &&) noexcept;
+// Start of a saved deque, see Deque::WriteImage. The images of the blocks follow it, each
+// laid out like the Block in memory and in the byte order of the machine that saved it
+struct DequeImageHeader {
+    // "DEQUEIMG" read as a little endian number
+    static constexpr uint64_t kMagic = 0x474d494555514544;
+    static constexpr uint32_t kVersion = 3;
+
+    uint64_t magic = kMagic;
+    uint32_t version = kVersion;
+    uint32_t element_size = 0;
+    // Elements per block and bytes per block image
+    uint64_t block_size = 0;
+    uint64_t block_bytes = 0;
+    uint64_t size = 0;
+    uint64_t blocks = 0;
+    // Position of the first element in the first block and the one right after the last
+    // element in the last block
+    uint64_t head_begin = 0;
+    uint64_t tail_end = 0;
+};
 
-    Block &operator=(Block &&other) noexcept;
+// Room for BlockSize elements and nothing else, so that a block is a whole number of cache
+// lines. Which slots hold an element is kept by the CircularBuffer the block is used in: only
+// its head block may start after position 0 and only its tail block may end before BlockSize
+template<class T, size_t BlockSize>
+struct Block {
+private:
+    alignas(std::max(alignof(T), deque_settings::kBlockAlignment))
+            std::byte data_[sizeof(T) * BlockSize];
 
-    void Init(size_t);
+public:
+    Block() noexcept {
+    }
 
-    void PushBack(int);
+    // Elements are constructed and destroyed by the owner of the block, which knows where
+    // they are
+    Block(const Block &) = delete;
 
-    void PushFront(int);
+    Block &operator=(const Block &) = delete;
 
-    void PopBack();
+    // The element or the free slot at position
+    const T &At(size_t position) const;
 
-    void PopFront();
+    T &At(size_t position);
 
-    int Get(size_t) const;
+    template<class... Args>
+    T &Emplace(size_t position, Args &&...args);
 
-    int &Get(size_t);
+    // Constructs count elements from position on: value-initialized ones, or copies of filler
+    // if there is one
+    template<class... Filler>
+    void Fill(size_t position, size_t count, const Filler &...filler);
 
-    size_t Size() const;
+    // Constructs count elements from position on out of first, which is advanced past them
+    template<class It>
+    void ConstructRange(size_t position, It &first, size_t count);
 
-    size_t GetHead() const;
+    // Constructs the count elements before last (which is moved back to the first of them)
+    // right before position, keeping their order
+    template<class It>
+    void ConstructRangeBefore(size_t position, It &last, size_t count);
 
-    size_t GetTail() const;
+    // Destroys count elements from position on and scrubs their slots if asked to
+    void Destroy(size_t position, size_t count);
 
-    bool IsEmpty() const;
+private:
+    T *GetSlot(size_t position) {
+        return std::launder(reinterpret_cast<T *>(data_ + position * sizeof(T)));
+    }
 
-    bool IsFull() const;
+    const T *GetSlot(size_t position) const {
+        return std::launder(reinterpret_cast<const T *>(data_ + position * sizeof(T)));
+    }
 
-    bool IsHeadShifted() const;
+    // All zero bytes are a value-initialized T, so elements can be zeroed with one memset
+    static constexpr bool kIsZeroedByMemset =
+            std::is_arithmetic_v<T> or std::is_enum_v<T> or std::is_pointer_v<T>;
 
-    bool IsRightClose() const;
+    template<class It>
+    static constexpr bool kIsCopyableByMemcpy =
+            std::is_trivially_copyable_v<T> and std::is_pointer_v<It> and
+            std::is_same_v<std::remove_cv_t<std::remove_pointer_t<It>>, T>;
 };
 
-template<size_t BlockSize>
-bool Block<BlockSize>::IsRightClose() const {
-    return head_ + size_ >= BlockSize;
+template<class T, size_t BlockSize>
+const T &Block<T, BlockSize>::At(size_t position) const {
+    return *GetSlot(position);
 }
 
-template<size_t BlockSize>
-size_t Block<BlockSize>::GetTail() const {
-    return tail_;
+template<class T, size_t BlockSize>
+T &Block<T, BlockSize>::At(size_t position) {
+    return *GetSlot(position);
 }
 
-template<size_t BlockSize>
-size_t Block<BlockSize>::GetHead() const {
-    return head_;
+template<class T, size_t BlockSize>
+template<class... Args>
+T &Block<T, BlockSize>::Emplace(size_t position, Args &&...args) {
+    return *std::construct_at(GetSlot(position), std::forward<Args>(args)...);
 }
 
-template<size_t BlockSize>
-void Block<BlockSize>::Init(size_t size) {
-    size_ = size;
-    head_ = 0;
-    tail_ = size_ - 1;
-    for (size_t i = head_; i <= tail_; ++i) {
-        data_[i] = 0;
+template<class T, size_t BlockSize>
+template<class... Filler>
+void Block<T, BlockSize>::Fill(size_t position, size_t count, const Filler &...filler) {
+    static_assert(sizeof...(Filler) <= 1);
+    if constexpr (sizeof...(Filler) == 0 and kIsZeroedByMemset) {
+        std::memset(data_ + position * sizeof(T), 0, count * sizeof(T));
+    } else if constexpr (sizeof...(Filler) == 0) {
+        std::uninitialized_value_construct_n(GetSlot(position), count);
+    } else {
+        std::uninitialized_fill_n(GetSlot(position), count, filler...);
     }
 }
 
-template<size_t BlockSize>
-Block<BlockSize>::Block(size_t size, int filler) {
-    size_ = size;
-    head_ = 0;
-    tail_ = size_ - 1;
-    for (size_t i = head_; i <= tail_; ++i) {
-        data_[i] = filler;
+template<class T, size_t BlockSize>
+template<class It>
+void Block<T, BlockSize>::ConstructRange(size_t position, It &first, size_t count) {
+    if constexpr (kIsCopyableByMemcpy<It>) {
+        if (count != 0) {
+            std::memcpy(GetSlot(position), first, count * sizeof(T));
+            first += count;
+        }
+    } else {
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed, ++first) {
+                std::construct_at(GetSlot(position + constructed), *first);
+            }
+        } catch (...) {
+            Destroy(position, constructed);
+            throw;
+        }
     }
 }
 
-template<size_t BlockSize>
-Block<BlockSize> &Block<BlockSize>::operator=(Block &&other) noexcept {
-    if (this != &other) {
-        data_ = std::move(other.data_);
-        size_ = other.size_;
-        head_ = other.head_;
-        tail_ = other.tail_;
-
-        other.data_ = {};
-        other.size_ = 0;
-        other.head_ = 0;
-        other.tail_ = 0;
+template<class T, size_t BlockSize>
+template<class It>
+void Block<T, BlockSize>::ConstructRangeBefore(size_t position, It &last, size_t count) {
+    if constexpr (kIsCopyableByMemcpy<It>) {
+        if (count != 0) {
+            last -= count;
+            std::memcpy(GetSlot(position - count), last, count * sizeof(T));
+        }
+    } else {
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                --last;
+                std::construct_at(GetSlot(position - 1 - constructed), *last);
+            }
+        } catch (...) {
+            Destroy(position - constructed, constructed);
+            throw;
+        }
     }
-    return *this;
-}
-
-template<size_t BlockSize>
-Block<BlockSize>::Block(Block &&other) noexcept
-        : data_{std::move(other.data_)}, size_{other.size_}, head_{other.head_}, tail_{other.tail_} {
-    other.data_ = {};
-    other.size_ = 0;
-    other.head_ = 0;
-    other.tail_ = 0;
-}
-
-template<size_t BlockSize>
-Block<BlockSize>::Block(const Block &other)
-        : size_(other.size_), head_(other.head_), tail_(other.tail_), data_(other.data_) {
 }
 
-template<size_t BlockSize>
-Block<BlockSize> &Block<BlockSize>::operator=(const Block &other) {
-    if (this != &other) {
-        size_ = other.size_;
-        head_ = other.head_;
-        tail_ = other.tail_;
-        std::memcpy(&data_, &other.data_, sizeof(other.data_));
+template<class T, size_t BlockSize>
+void Block<T, BlockSize>::Destroy(size_t position, size_t count) {
+    std::destroy_n(GetSlot(position), count);
+    if constexpr (deque_settings::kScrubRemoved) {
+        // Called through a volatile pointer, so that the stores are not dropped as dead
+        static void *(*const volatile scrub)(void *, int, size_t) = std::memset;
+        scrub(data_ + position * sizeof(T), 0, count * sizeof(T));
     }
-    return *this;
 }
 
-template<size_t BlockSize>
-void Block<BlockSize>::PushFront(int value) {
-    if (head_ == tail_ and head_ == 0) {
-        head_ = tail_ = BlockSize - 1;
-        data_[head_] = value;
-    } else {
-        head_ -= 1;
-        data_[head_] = value;
-    }
-    size_ += 1;
-}
+// Allocates blocks from a memory resource and keeps retired ones so that the ring can reuse them
+template<class T, size_t BlockSize>
+class BlockPool {
+private:
+    using DataBlock = Block<T, BlockSize>;
+    using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+    struct SlabChunk {
+        SlabChunk *next;
+        size_t capacity;
+        size_t used;
+    };
+
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    static constexpr size_t kChunkHeaderSize =
+            (sizeof(SlabChunk) + alignof(DataBlock) - 1) / alignof(DataBlock) * alignof(DataBlock);
+    static constexpr size_t kChunkAlignment = std::max(alignof(SlabChunk), alignof(DataBlock));
+
+    // Null in a pool constructed at compile time, such as that of a constinit deque, which takes
+    // the default resource at its first allocation
+    std::pmr::memory_resource *resource_ = nullptr;
+    BlockStorage storage_ = BlockStorage::kSeparate;
+    size_t size_ = 0;
+    size_t max_size_ = deque_settings::kBlockPoolMaxSize;
+    DataBlock **blocks_ = nullptr;
+    SlabChunk *chunks_ = nullptr;
+    FreeSlot *free_slots_ = nullptr;
+    size_t free_slots_count_ = 0;
+    ExternalBlocks *external_ = nullptr;
+#ifdef DEQUE_STATS
+    DequeStats counters_;
+#endif
 
-template<size_t BlockSize>
-void Block<BlockSize>::PushBack(int value) {
-    if (head_ == tail_ and tail_ == 0 and size_ == 0) {
-        data_[tail_] = value;
-    } else {
-        tail_ += 1;
-        data_[tail_] = value;
-    }
-    size_ += 1;
-}
+public:
+    // Uses the default resource
+    constexpr BlockPool() noexcept;
 
-template<size_t BlockSize>
-void Block<BlockSize>::PopFront() {
-    data_[head_] = 0;
-    head_ += 1;
-    size_ -= 1;
-}
+    constexpr explicit BlockPool(std::pmr::memory_resource *resource,
+                                 BlockStorage storage = BlockStorage::kSeparate) noexcept;
 
-template<size_t BlockSize>
-void Block<BlockSize>::PopBack() {
-    data_[tail_] = 0;
-    tail_ -= 1;
-    size_ -= 1;
-}
+    BlockPool(const BlockPool &other) = delete;
 
-template<size_t BlockSize>
-int Block<BlockSize>::Get(size_t index) const {
-    return data_[head_ + index];
-}
+    BlockPool &operator=(const BlockPool &other) = delete;
 
-template<size_t BlockSize>
-int &Block<BlockSize>::Get(size_t index) {
-    return data_[head_ + index];
-}
+    BlockPool(BlockPool &&other) noexcept;
 
-template<size_t BlockSize>
-size_t Block<BlockSize>::Size() const {
-    return size_;
-}
+    BlockPool &operator=(BlockPool &&other) noexcept;
 
-template<size_t BlockSize>
-bool Block<BlockSize>::IsEmpty() const {
-    return size_ == 0;
-}
+    ~BlockPool();
 
-template<size_t BlockSize>
-bool Block<BlockSize>::IsFull() const {
-    return size_ == BlockSize;
-}
+    void Swap(BlockPool &other) noexcept;
 
-template<size_t BlockSize>
-bool Block<BlockSize>::IsHeadShifted() const {
-    return head_ != 0;
-}
+    // Returns an empty block, taking it from the pool when possible
+    DataBlock *Acquire();
 
-template<size_t BlockSize>
-class CircularBuffer {
-private:
-    using DataBlock = Block<BlockSize>;
-    size_t size_ = 1;
-    size_t max_size_ = deque_settings::kBufferInitMaxSize;
-    size_t head_ = 0;
-    size_t tail_ = 0;
-    std::unique_ptr<std::unique_ptr<DataBlock>[]> buffer_;
+    // Always allocates a new block
+    DataBlock *Create();
 
-public:
-    CircularBuffer();
+    // Both take blocks that hold no element and leave external blocks alone
+    void Release(DataBlock *block);
 
-    CircularBuffer(size_t blocks_count);
+    void Destroy(DataBlock *block);
 
-    CircularBuffer(size_t blocks_count, int filler);
+    DataBlock **AllocateMap(size_t size);
 
-    CircularBuffer(const CircularBuffer &other);
+    // Leaves the slots uninitialized
+    DataBlock **AllocateRawMap(size_t size);
 
-    CircularBuffer(CircularBuffer &&other) noexcept;
+    void DeallocateMap(DataBlock **map, size_t size);
 
-    CircularBuffer &operator=(CircularBuffer &&other) noexcept;
+    void SetMaxSize(size_t max_size);
 
-    void Swap(CircularBuffer &);
+    // Allocates blocks in advance so that the next count calls to Acquire do not allocate
+    void Reserve(size_t count);
 
-    void AddTailDataBlock();
+    void ShrinkToFit();
 
-    void AddHeadDataBlock();
+    size_t Size() const;
 
-    void DeleteDataBlockFromTail();
+    size_t MaxSize() const;
 
-    void DeleteDataBlockFromHead();
+    std::pmr::memory_resource *GetMemoryResource() const;
 
-    bool IsFull() const;
+    BlockStorage GetStorage() const;
 
-    bool IsEmpty() const;
+    // Makes the pool a user of external, whose blocks it may then hand out. A pool uses one
+    // ExternalBlocks at a time, setting another one or nullptr stops using the previous one
+    void SetExternal(ExternalBlocks *external);
 
-    bool IsTailDataBlockFull() const;
+    ExternalBlocks *GetExternal() const;
 
-    bool IsHeadDataBlockFull() const;
+    bool IsExternal(const DataBlock *block) const {
+        auto address = reinterpret_cast<const std::byte *>(block);
+        return external_ != nullptr and std::less_equal<>()(external_->begin, address) and
+               std::less<>()(address, external_->end);
+    }
 
-    DataBlock *GetTailDataBlock();
+    // Add to or raise a counter of DequeStats, nothing unless DEQUE_STATS is defined
+    void Count(size_t DequeStats::*counter, size_t value = 1) {
+#ifdef DEQUE_STATS
+        counters_.*counter += value;
+#else
+        (void)counter;
+        (void)value;
+#endif
+    }
 
-    DataBlock *GetHeadDataBlock();
+    void CountMax(size_t DequeStats::*counter, size_t value) {
+#ifdef DEQUE_STATS
+        counters_.*counter = std::max(counters_.*counter, value);
+#else
+        (void)counter;
+        (void)value;
+#endif
+    }
 
-    int &GetElementByIndex(size_t);
+    // The counters and what the pool itself holds, used_blocks are the blocks handed out
+    DequeStats GetStats(size_t used_blocks) const;
 
-    int GetElementByIndex(size_t) const;
+private:
+    // resource_, taking the default resource first when there is none yet
+    std::pmr::memory_resource *GetResource();
 
-    void ExpandBuffer();
+    void *AllocateStorage();
 
-    void Clear();
+    void DeallocateStorage(void *storage);
 
-    // Check if block is head and like this [...[], [], []]
-    bool TailIsUsedHead();
+    void AddChunk();
 
-    // Check if head block is like as [] or ([[], []...] or [...[], []])
-    bool IsHeadStartNotShifted();
+    void ReleaseUnusedChunks();
 
-private:
-    static size_t GetBlocksCount(size_t elem_count) {
-        if (elem_count == 0) {
-            return 1;
-        }
-        return (elem_count - 1) / deque_settings::kBlockSize + 1;
+    static DataBlock *GetChunkBlocks(SlabChunk *chunk) {
+        return reinterpret_cast<DataBlock *>(reinterpret_cast<std::byte *>(chunk) +
+                                             kChunkHeaderSize);
+    }
+
+    static size_t GetChunkBytes(size_t capacity) {
+        return kChunkHeaderSize + capacity * sizeof(DataBlock);
     }
 };
 
-template<size_t BlockSize>
-CircularBuffer<BlockSize>::CircularBuffer() : buffer_(new std::unique_ptr<DataBlock>[max_size_]) {
-    buffer_[0] = std::make_unique<DataBlock>();
+template<class T, size_t BlockSize>
+constexpr BlockPool<T, BlockSize>::BlockPool() noexcept
+        : resource_(std::is_constant_evaluated() ? nullptr : std::pmr::get_default_resource()) {
 }
 
-template<size_t BlockSize>
-CircularBuffer<BlockSize>::CircularBuffer(size_t elem_count)
-        : size_(GetBlocksCount(elem_count)),
-          max_size_(std::max(size_, deque_settings::kBufferInitMaxSize)),
-          buffer_(new std::unique_ptr<DataBlock>[max_size_]) {
-    buffer_[0] = std::make_unique<DataBlock>();
-};
-
-template<size_t BlockSize>
-CircularBuffer<BlockSize>::CircularBuffer(size_t elem_count, int filler)
-        : size_(GetBlocksCount(elem_count)),
-          max_size_(std::max(size_, deque_settings::kBufferInitMaxSize)),
-          buffer_(new std::unique_ptr<DataBlock>[max_size_]) {
-    for (size_t i = 0; i < size_; ++i) {
-        if (i == size_ - 1) {
-            buffer_[i] = std::make_unique<DataBlock>(elem_count % BlockSize, filler);
-        } else {
-            buffer_[i] = std::make_unique<DataBlock>(BlockSize, filler);
-        }
-    }
-};
+template<class T, size_t BlockSize>
+constexpr BlockPool<T, BlockSize>::BlockPool(std::pmr::memory_resource *resource,
+                                             BlockStorage storage) noexcept
+        : resource_(resource), storage_(storage) {
+}
 
-template<size_t BlockSize>
-CircularBuffer<BlockSize>::CircularBuffer(CircularBuffer &&other) noexcept
-        : size_{other.size_},
+template<class T, size_t BlockSize>
+BlockPool<T, BlockSize>::BlockPool(BlockPool &&other) noexcept
+        : resource_{other.resource_},
+          storage_{other.storage_},
+          size_{other.size_},
           max_size_{other.max_size_},
-          head_{other.head_},
-          tail_{other.tail_},
-          buffer_{std::move(other.buffer_)} {
-    other.buffer_.reset();
-    other.size_ = 1;
-    other.max_size_ = 0;
-    other.head_ = 0;
-    other.tail_ = 0;
+          blocks_{other.blocks_},
+          chunks_{other.chunks_},
+          free_slots_{other.free_slots_},
+          free_slots_count_{other.free_slots_count_},
+          external_{other.external_} {
+#ifdef DEQUE_STATS
+    std::swap(counters_, other.counters_);
+#endif
+    other.size_ = 0;
+    other.blocks_ = nullptr;
+    other.chunks_ = nullptr;
+    other.free_slots_ = nullptr;
+    other.free_slots_count_ = 0;
+    other.external_ = nullptr;
 }
 
-template<size_t BlockSize>
-CircularBuffer<BlockSize> &CircularBuffer<BlockSize>::operator=(CircularBuffer &&other) noexcept {
+template<class T, size_t BlockSize>
+BlockPool<T, BlockSize> &BlockPool<T, BlockSize>::operator=(BlockPool &&other) noexcept {
     if (this != &other) {
-        size_ = other.size_;
-        max_size_ = other.max_size_;
-        head_ = other.head_;
-        tail_ = other.tail_;
-        buffer_ = std::move(other.buffer_);
-
-        other.buffer_.reset();
-        other.size_ = 1;
-        other.max_size_ = 0;
-        other.head_ = 0;
-        other.tail_ = 0;
+        BlockPool tmp(std::move(other));
+        Swap(tmp);
     }
     return *this;
 }
 
-template<size_t BlockSize>
-CircularBuffer<BlockSize>::CircularBuffer(const CircularBuffer &other)
-        : size_{other.size_},
-          max_size_{other.max_size_},
-          head_{other.head_},
-          tail_{other.tail_},
-          buffer_(new std::unique_ptr<DataBlock>[max_size_]) {
-    for (size_t i = 0; i < other.size_; ++i) {
-        buffer_[i] = std::make_unique<DataBlock>();
-        *buffer_[i] = *other.buffer_[i];
+template<class T, size_t BlockSize>
+BlockPool<T, BlockSize>::~BlockPool() {
+    ShrinkToFit();
+    SetExternal(nullptr);
+    while (chunks_ != nullptr) {
+        SlabChunk *next = chunks_->next;
+        GetResource()->deallocate(chunks_, GetChunkBytes(chunks_->capacity), kChunkAlignment);
+        chunks_ = next;
     }
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::Swap(CircularBuffer &other) {
-    std::swap(buffer_, other.buffer_);
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::Swap(BlockPool &other) noexcept {
+    std::swap(resource_, other.resource_);
+    std::swap(storage_, other.storage_);
+    std::swap(blocks_, other.blocks_);
     std::swap(size_, other.size_);
     std::swap(max_size_, other.max_size_);
-    std::swap(head_, other.head_);
-    std::swap(tail_, other.tail_);
+    std::swap(chunks_, other.chunks_);
+    std::swap(free_slots_, other.free_slots_);
+    std::swap(free_slots_count_, other.free_slots_count_);
+    std::swap(external_, other.external_);
+#ifdef DEQUE_STATS
+    std::swap(counters_, other.counters_);
+#endif
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::AddTailDataBlock() {
-    if (tail_ == max_size_ - 1) {
-        tail_ = 0;
-    } else {
-        tail_ += 1;
+template<class T, size_t BlockSize>
+typename BlockPool<T, BlockSize>::DataBlock *BlockPool<T, BlockSize>::Acquire() {
+    if (storage_ == BlockStorage::kSlab) {
+        return new (AllocateStorage()) DataBlock;
     }
-    buffer_[tail_] = std::make_unique<DataBlock>();
-    size_ += 1;
+    if (size_ == 0) {
+        return Create();
+    }
+    Count(&DequeStats::pool_hits);
+    return blocks_[--size_];
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::AddHeadDataBlock() {
-    if (head_ == 0) {
-        head_ = max_size_ - 1;
-    } else {
-        head_ -= 1;
+template<class T, size_t BlockSize>
+typename BlockPool<T, BlockSize>::DataBlock *BlockPool<T, BlockSize>::Create() {
+    if (storage_ == BlockStorage::kSlab) {
+        return new (AllocateStorage()) DataBlock;
     }
-    buffer_[head_] = std::make_unique<DataBlock>();
-    size_ += 1;
+    Count(&DequeStats::block_allocations);
+    return Allocator(GetResource()).new_object<DataBlock>();
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::DeleteDataBlockFromTail() {
-    buffer_[tail_].reset();
-    if (tail_ == head_) {
-        tail_ = 0;
-        head_ = 0;
-        size_ = 0;
-    } else {
-        if (tail_ == 0) {
-            tail_ = max_size_ - 1;
-        } else {
-            tail_ -= 1;
-        }
-        size_ -= 1;
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::Release(DataBlock *block) {
+    if (block == nullptr or IsExternal(block)) {
+        return;
+    }
+    // Slab slots are never given back to the resource one by one, so they all stay pooled
+    if (storage_ == BlockStorage::kSlab or size_ == max_size_) {
+        Destroy(block);
+        return;
     }
+    if (blocks_ == nullptr) {
+        blocks_ = Allocator(GetResource()).allocate_object<DataBlock *>(max_size_);
+    }
+    blocks_[size_++] = block;
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::DeleteDataBlockFromHead() {
-    buffer_[head_].reset();
-    if (head_ == tail_) {
-        tail_ = 0;
-        head_ = 0;
-        size_ = 0;
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::Destroy(DataBlock *block) {
+    if (block == nullptr or IsExternal(block)) {
+        return;
+    }
+    Count(&DequeStats::block_frees);
+    if (storage_ == BlockStorage::kSlab) {
+        block->~DataBlock();
+        DeallocateStorage(block);
     } else {
-        if (head_ == max_size_ - 1) {
-            head_ = 0;
-        } else {
-            head_ += 1;
-        }
-        size_ -= 1;
+        Allocator(GetResource()).delete_object(block);
     }
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::IsFull() const {
-    return size_ == max_size_;
+template<class T, size_t BlockSize>
+typename BlockPool<T, BlockSize>::DataBlock **BlockPool<T, BlockSize>::AllocateMap(size_t size) {
+    DataBlock **map = AllocateRawMap(size);
+    std::fill_n(map, size, nullptr);
+    return map;
+}
+
+template<class T, size_t BlockSize>
+typename BlockPool<T, BlockSize>::DataBlock **BlockPool<T, BlockSize>::AllocateRawMap(
+        size_t size) {
+    return Allocator(GetResource()).allocate_object<DataBlock *>(size);
+}
+
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::DeallocateMap(DataBlock **map, size_t size) {
+    if (map != nullptr) {
+        Allocator(GetResource()).deallocate_object(map, size);
+    }
+}
+
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::SetMaxSize(size_t max_size) {
+    if (max_size == max_size_) {
+        return;
+    }
+    DataBlock **new_blocks = nullptr;
+    size_t new_size = std::min(size_, max_size);
+    if (new_size != 0) {
+        new_blocks = Allocator(GetResource()).allocate_object<DataBlock *>(max_size);
+        std::copy_n(blocks_, new_size, new_blocks);
+    }
+    for (size_t i = new_size; i < size_; ++i) {
+        Destroy(blocks_[i]);
+    }
+    DeallocateMap(blocks_, max_size_);
+    blocks_ = new_blocks;
+    size_ = new_size;
+    max_size_ = max_size;
+}
+
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::Reserve(size_t count) {
+    if (storage_ == BlockStorage::kSlab) {
+        while (free_slots_count_ < count) {
+            if (chunks_ == nullptr or chunks_->used == chunks_->capacity) {
+                AddChunk();
+            }
+            DeallocateStorage(GetChunkBlocks(chunks_) + chunks_->used++);
+        }
+        return;
+    }
+    if (max_size_ < count) {
+        SetMaxSize(count);
+    }
+    if (blocks_ == nullptr and size_ < count) {
+        blocks_ = Allocator(GetResource()).allocate_object<DataBlock *>(max_size_);
+    }
+    while (size_ < count) {
+        blocks_[size_++] = Create();
+    }
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::IsEmpty() const {
-    return size_ == 1 and buffer_[0]->IsEmpty();
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::ShrinkToFit() {
+    for (size_t i = 0; i < size_; ++i) {
+        Destroy(blocks_[i]);
+    }
+    DeallocateMap(blocks_, max_size_);
+    blocks_ = nullptr;
+    size_ = 0;
+    ReleaseUnusedChunks();
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::IsTailDataBlockFull() const {
-    return buffer_[tail_]->IsFull();
+template<class T, size_t BlockSize>
+size_t BlockPool<T, BlockSize>::Size() const {
+    return size_;
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::IsHeadDataBlockFull() const {
-    return buffer_[head_]->IsFull();
+template<class T, size_t BlockSize>
+size_t BlockPool<T, BlockSize>::MaxSize() const {
+    return max_size_;
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::TailIsUsedHead() {
-    return buffer_[tail_]->IsRightClose();
+template<class T, size_t BlockSize>
+std::pmr::memory_resource *BlockPool<T, BlockSize>::GetMemoryResource() const {
+    return resource_ != nullptr ? resource_ : std::pmr::get_default_resource();
 }
 
-template<size_t BlockSize>
-bool CircularBuffer<BlockSize>::IsHeadStartNotShifted() {
-    return !buffer_[head_]->IsHeadShifted();
+template<class T, size_t BlockSize>
+BlockStorage BlockPool<T, BlockSize>::GetStorage() const {
+    return storage_;
 }
 
-template<size_t BlockSize>
-typename CircularBuffer<BlockSize>::DataBlock *CircularBuffer<BlockSize>::GetTailDataBlock() {
-    if (!buffer_[tail_]) {
-        buffer_[tail_] = std::make_unique<DataBlock>();
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::SetExternal(ExternalBlocks *external) {
+    if (external == external_) {
+        return;
+    }
+    if (external != nullptr) {
+        external->AddUser();
     }
-    return buffer_[tail_].get();
+    if (external_ != nullptr) {
+        external_->DropUser();
+    }
+    external_ = external;
 }
 
-template<size_t BlockSize>
-typename CircularBuffer<BlockSize>::DataBlock *CircularBuffer<BlockSize>::GetHeadDataBlock() {
-    return buffer_[head_].get();
+template<class T, size_t BlockSize>
+ExternalBlocks *BlockPool<T, BlockSize>::GetExternal() const {
+    return external_;
 }
 
-template<size_t BlockSize>
-int &CircularBuffer<BlockSize>::GetElementByIndex(size_t index) {
-    size_t head_size = buffer_[head_]->Size();
-    if (index < head_size) {
-        return buffer_[head_]->Get(index);
+template<class T, size_t BlockSize>
+DequeStats BlockPool<T, BlockSize>::GetStats(size_t used_blocks) const {
+    DequeStats stats;
+#ifdef DEQUE_STATS
+    stats = counters_;
+#endif
+    if (storage_ == BlockStorage::kSlab) {
+        stats.pooled_blocks = free_slots_count_;
+        for (SlabChunk *chunk = chunks_; chunk != nullptr; chunk = chunk->next) {
+            stats.allocated_bytes += GetChunkBytes(chunk->capacity);
+        }
+    } else {
+        stats.pooled_blocks = size_;
+        stats.allocated_bytes = (used_blocks + size_) * sizeof(DataBlock);
+        if (blocks_ != nullptr) {
+            stats.allocated_bytes += max_size_ * sizeof(DataBlock *);
+        }
     }
-    index -= head_size;
-    size_t target_block_index = (head_ + index / BlockSize + 1) % max_size_;
-    size_t target_elem_in_block_index = index % BlockSize;
-    return buffer_[target_block_index]->Get(target_elem_in_block_index);
+    return stats;
 }
 
-template<size_t BlockSize>
-int CircularBuffer<BlockSize>::GetElementByIndex(size_t index) const {
-    size_t head_size = buffer_[head_]->Size();
-    if (index < head_size) {
-        return buffer_[head_]->Get(index);
+template<class T, size_t BlockSize>
+std::pmr::memory_resource *BlockPool<T, BlockSize>::GetResource() {
+    if (resource_ == nullptr) [[unlikely]] {
+        resource_ = std::pmr::get_default_resource();
     }
-    index -= head_size;
-    size_t target_block_index = (head_ + index / BlockSize + 1) % max_size_;
-    size_t target_elem_in_block_index = index % BlockSize;
-    return buffer_[target_block_index]->Get(target_elem_in_block_index);
+    return resource_;
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::ExpandBuffer() {
-    size_t new_size = max_size_ * 2;
-    std::unique_ptr<std::unique_ptr<DataBlock>[]> new_buffer(
-            new std::unique_ptr<DataBlock>[new_size]);
-    size_t cnt = 0;
-    for (size_t i = head_; i != tail_; i = (i + 1) % max_size_) {
-        new_buffer[cnt++] = std::move(buffer_[i]);
+template<class T, size_t BlockSize>
+void *BlockPool<T, BlockSize>::AllocateStorage() {
+    if (free_slots_ != nullptr) {
+        Count(&DequeStats::pool_hits);
+        FreeSlot *slot = free_slots_;
+        free_slots_ = slot->next;
+        --free_slots_count_;
+        return slot;
     }
-    new_buffer[cnt] = std::move(buffer_[tail_]);
-    head_ = 0;
-    tail_ = size_ - 1;
-    buffer_ = std::move(new_buffer);
-    max_size_ = new_size;
+    if (chunks_ == nullptr or chunks_->used == chunks_->capacity) {
+        AddChunk();
+    }
+    Count(&DequeStats::block_allocations);
+    return GetChunkBlocks(chunks_) + chunks_->used++;
 }
 
-template<size_t BlockSize>
-void CircularBuffer<BlockSize>::Clear() {
-    for (size_t i = 0; i < size_; ++i) {
-        buffer_[i].reset();
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::DeallocateStorage(void *storage) {
+    free_slots_ = new (storage) FreeSlot{free_slots_};
+    ++free_slots_count_;
+}
+
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::AddChunk() {
+    size_t capacity = deque_settings::kSlabMinBlocks;
+    if (chunks_ != nullptr) {
+        capacity = std::min(chunks_->capacity * 2, deque_settings::kSlabMaxBlocks);
     }
-    buffer_[0] = std::make_unique<DataBlock>();
-    size_ = 0;
-    tail_ = 0;
-    head_ = 0;
-    max_size_ = deque_settings::kBufferInitMaxSize;
+    void *memory = GetResource()->allocate(GetChunkBytes(capacity), kChunkAlignment);
+    chunks_ = new (memory) SlabChunk{chunks_, capacity, 0};
 }
 
-class Deque {
+// Gives back every chunk none of whose slots is in use
+template<class T, size_t BlockSize>
+void BlockPool<T, BlockSize>::ReleaseUnusedChunks() {
+    SlabChunk **link = &chunks_;
+    while (*link != nullptr) {
+        SlabChunk *chunk = *link;
+        auto begin = reinterpret_cast<std::byte *>(GetChunkBlocks(chunk));
+        auto end = reinterpret_cast<std::byte *>(GetChunkBlocks(chunk) + chunk->used);
+        auto in_chunk = [begin, end](FreeSlot *slot) {
+            auto address = reinterpret_cast<std::byte *>(slot);
+            return std::less_equal<>()(begin, address) and std::less<>()(address, end);
+        };
+        size_t free_count = 0;
+        for (FreeSlot *slot = free_slots_; slot != nullptr; slot = slot->next) {
+            free_count += in_chunk(slot);
+        }
+        if (free_count != chunk->used) {
+            link = &chunk->next;
+            continue;
+        }
+        FreeSlot **slot_link = &free_slots_;
+        while (*slot_link != nullptr) {
+            if (in_chunk(*slot_link)) {
+                *slot_link = (*slot_link)->next;
+                --free_slots_count_;
+            } else {
+                slot_link = &(*slot_link)->next;
+            }
+        }
+        *link = chunk->next;
+        GetResource()->deallocate(chunk, GetChunkBytes(chunk->capacity), kChunkAlignment);
+    }
+}
+
+template<class T, size_t BlockSize>
+class CircularBuffer {
+private:
+    using DataBlock = Block<T, BlockSize>;
+    using HolderCount = std::atomic<size_t>;
+    // A buffer starts with the one slot it always uses empty, the block is acquired by the
+    // first push, so that constructing a deque allocates nothing
+    size_t size_ = 1;
+    size_t max_size_ = deque_settings::kInlineMapSize;
+    // Indices of the first and the last used slot. They are not wrapped, the map is indexed
+    // with them modulo its size, so that a block keeps its index when the map grows
+    size_t head_ = 0;
+    size_t tail_ = 0;
+    // Position of the first element in the head block and right after the last one in the
+    // tail block. The blocks in between are full
+    size_t head_begin_ = 0;
+    size_t tail_end_ = 0;
+    BlockPool<T, BlockSize> pool_;
+    DataBlock *inline_map_[deque_settings::kInlineMapSize] = {};
+    // inline_map_ until the buffer needs more slots
+    DataBlock **buffer_ = inline_map_;
+    // The map of twice the size while it is filled in. Once half of buffer_ is used, every
+    // added block copies a few more slots over, and the new map takes over when it is complete,
+    // so no single push copies the whole map. Lookups only ever read buffer_, which stays
+    // complete meanwhile: slots [0, migrated_) of it are written to both maps
+    DataBlock **new_buffer_ = nullptr;
+    size_t migrated_ = 0;
+    // The lent_count_ blocks from slot lent_head_ on are shared with snapshots. Every shared
+    // block has a holder count of its own, which its holders point to from their holders_
+    // arrays, the one of slot lent_head_ at lent_first_. Counts live beside the blocks rather
+    // than in them, which keeps the blocks free of bookkeeping and the paths that do not share
+    // free of atomics. The buffer reads lent blocks where they are and copies one before
+    // writing to it unless it turns out to be the last holder. No holder changes the edges of
+    // a shared block, so all of them see the same elements in it, and the last one to drop it
+    // destroys those and frees the block and its count
+    HolderCount **holders_ = nullptr;
+    size_t holders_size_ = 0;
+    size_t lent_first_ = 0;
+    size_t lent_head_ = 0;
+    size_t lent_count_ = 0;
+
 public:
-    Deque() = default;
+    // Buffers are constructed without a block and with the inline map, so that constinit
+    // deques are possible
+    constexpr CircularBuffer() noexcept = default;
 
-    Deque(const Deque &rhs) = default;
+    constexpr explicit CircularBuffer(std::pmr::memory_resource *resource,
+                                      BlockStorage storage = BlockStorage::kSeparate) noexcept;
 
-    Deque(Deque &&rhs) = default;
+    // Sizes the block map for elem_count elements but creates no block
+    CircularBuffer(size_t elem_count,
+                   std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
-    explicit Deque(size_t size);
+    // Copies all blocks of other, the external and the lent ones too
+    CircularBuffer(const CircularBuffer &other,
+                   std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
-    Deque(std::initializer_list<int> list);
+    // Leaves other like a new buffer
+    CircularBuffer(CircularBuffer &&other) noexcept;
 
-    Deque &operator=(Deque rhs);
+    CircularBuffer &operator=(CircularBuffer &&other) noexcept;
 
-    void Swap(Deque &rhs);
+    ~CircularBuffer();
 
-    void PushBack(int value);
+    std::pmr::memory_resource *GetMemoryResource() const;
 
-    void PopBack();
+    BlockStorage GetStorage() const;
+
+    void Swap(CircularBuffer &) noexcept;
+
+    // Makes the buffer hold the elements of other while keeping its own pool, memory resource
+    // and, when it is large enough, block map. The elements are copied into the blocks the
+    // buffer already owns where it has some
+    void Assign(const CircularBuffer &other);
+
+    // Makes snapshot, a new buffer with the same memory resource and separate blocks, hold the
+    // used blocks too
+    void ShareDataBlocksWith(CircularBuffer &snapshot);
+
+    // Copies the lent blocks, so that the buffer writes only to blocks of its own. The element
+    // accessors do not check for lent blocks, Deque calls this before it hands out references
+    // that may be written through
+    void Unshare() {
+        if constexpr (kCanLend) {
+            if (lent_count_ != 0) [[unlikely]] {
+                CopyLentDataBlocks();
+            }
+        }
+    }
+
+    // Blocks are added empty at the end they fill from: a tail block at 0, a head block at
+    // BlockSize. The edge block they go next to has to be full up to that end
+    void AddTailDataBlock();
 
-    void PushFront(int value);
+    void AddHeadDataBlock();
+
+    // Both destroy the elements the block still holds
+    void DeleteDataBlockFromTail();
+
+    void DeleteDataBlockFromHead();
+
+    // Moves the emptied head block of a buffer with more than one block behind the tail, so
+    // that it is the next tail block without going through the pool. False when the block is
+    // lent or external and has to be released instead
+    bool RecycleHeadDataBlock();
+
+    // Starts the only block, which holds no element, over at position: pushes to the back
+    // start there and pushes to the front end there. Acquires the block if there is none yet
+    void ResetDataBlock(size_t position = 0);
+
+    // The pushes do not check for room, the caller makes sure there is some. All element
+    // operations at the ends copy a lent edge block first
+
+    template<class... Args>
+    T &EmplaceBack(Args &&...args);
+
+    template<class... Args>
+    T &EmplaceFront(Args &&...args);
+
+    void PopBack();
 
     void PopFront();
 
-    int &operator[](size_t ind);
+    // Constructs count elements from first (which is advanced past them) right after the tail
+    template<class It>
+    void PushBackRange(It &first, size_t count);
 
-    int operator[](size_t ind) const;
+    // Constructs the count elements before last (which is moved back to the first of them)
+    // right before the head, keeping their order
+    template<class It>
+    void PushFrontRange(It &last, size_t count);
 
-    size_t Size() const;
+    // Remove count elements of the tail block or of the head block
+    void PopBackN(size_t count);
 
-    void Clear();
+    void PopFrontN(size_t count);
 
-private:
-    using DataBlock = Block<deque_settings::kBlockSize>;
-    CircularBuffer<deque_settings::kBlockSize> data_proxy_;
-    size_t size_ = 0;
-};
+    bool IsFull() const;
 
-Deque::Deque(size_t size) : data_proxy_(size, 0), size_(size) {
-}
+    bool IsEmpty() const;
 
-Deque::Deque(std::initializer_list<int> list) : data_proxy_(list.size()) {
-    for (int el: list) {
-        PushBack(el);
-    }
-}
+    // Free slots behind the last element and before the first one in the edge blocks
+    size_t GetTailBackRoom() const;
 
-Deque &Deque::operator=(Deque rhs) {
-    size_ = std::move(rhs.size_);
-    data_proxy_ = std::move(rhs.data_proxy_);
-    return *this;
-}
+    size_t GetHeadFrontRoom() const;
 
-void Deque::Swap(Deque &rhs) {
-    std::swap(size_, rhs.size_);
-    data_proxy_.Swap(rhs.data_proxy_);
-}
+    // Number of elements in the edge blocks
+    size_t GetTailSize() const;
 
-void Deque::PushBack(int value) {
-    if (data_proxy_.IsFull() and data_proxy_.IsTailDataBlockFull()) {
-        data_proxy_.ExpandBuffer();
-    }
-    if (data_proxy_.IsTailDataBlockFull() or data_proxy_.TailIsUsedHead()) {
-        data_proxy_.AddTailDataBlock();
-    }
-    DataBlock *tail_data_block = data_proxy_.GetTailDataBlock();
-    // tail_data_block is guaranteed valid block to standard PushBack
-    tail_data_block->PushBack(value);
-    ++size_;
-}
+    size_t GetHeadSize() const;
 
-void Deque::PopBack() {
-    DataBlock *tail_data_block = data_proxy_.GetTailDataBlock();
-    tail_data_block->PopBack();
-    if (tail_data_block->IsEmpty() and size_ > 1) {
-        data_proxy_.DeleteDataBlockFromTail();
+    // Position of the first element in the head block and right after the last one in the
+    // tail block
+    size_t GetHeadBegin() const {
+        return head_begin_;
     }
-    --size_;
-}
 
-void Deque::PushFront(int value) {
-    if (data_proxy_.IsFull() and data_proxy_.IsHeadDataBlockFull()) {
-        data_proxy_.ExpandBuffer();
+    size_t GetTailEnd() const {
+        return tail_end_;
     }
-    if (!data_proxy_.IsEmpty() and data_proxy_.IsHeadStartNotShifted()) {
-        data_proxy_.AddHeadDataBlock();
-    }
-    DataBlock *head_data_block = data_proxy_.GetHeadDataBlock();
-    // head_data_block is guaranteed valid block to standard PushFront
-    head_data_block->PushFront(value);
-    ++size_;
-}
 
-void Deque::PopFront() {
-    DataBlock *head_data_block = data_proxy_.GetHeadDataBlock();
-    head_data_block->PopFront();
-    if (head_data_block->IsEmpty() and size_ > 1) {
-        data_proxy_.DeleteDataBlockFromHead();
-    }
-    --size_;
-}
+    // May be null before the first push and right after the only block was deleted
+    const DataBlock *GetTailDataBlock() const;
 
-int &Deque::operator[](size_t ind) {
-    return data_proxy_.GetElementByIndex(ind);
-}
+    const DataBlock *GetHeadDataBlock() const;
 
-int Deque::operator[](size_t ind) const {
-    return data_proxy_.GetElementByIndex(ind);
-}
+    T &GetElementByIndex(size_t);
 
-size_t Deque::Size() const {
-    return size_;
-}
+    const T &GetElementByIndex(size_t) const;
 
-void Deque::Clear() {
+    // Elements of the block that holds the element with the given index
+    std::span<T> GetSegmentByIndex(size_t index);
+
+    std::span<const T> GetSegmentByIndex(size_t index) const;
+
+    // Elements of the used block block_index blocks after the head one
+    std::span<T> GetSegment(size_t block_index);
+
+    std::span<const T> GetSegment(size_t block_index) const;
+
+    // Calls fn with the elements of every used block from head to tail
+    template<class Fn>
+    void ForEachSegment(Fn &&fn);
+
+    template<class Fn>
+    void ForEachSegment(Fn &&fn) const;
+
+    // Replaces the only block of a buffer that is still empty with elem_count elements
+    // constructed from filler
+    template<class... Filler>
+    void Fill(size_t elem_count, const Filler &...filler);
+
+    // Replaces the only block of a buffer that is still empty with count blocks whose elements
+    // start at head_begin in the first one and end at tail_end in the last one. Blocks that
+    // lie in external are used where they are, the others are copied
+    void LoadDataBlocks(DataBlock *blocks, size_t count, size_t head_begin, size_t tail_end,
+                        ExternalBlocks *external);
+
+    // Doubles a full block map at once. AddTailDataBlock/AddHeadDataBlock grow the map ahead
+    // of time, so this only happens to the inline map and to maps filled up by the bulk
+    // operations
+    void ExpandBuffer();
+
+    // Grows the block map until count more blocks fit into it
+    void ReserveSlots(size_t count);
+
+    // Also allocates the count blocks in advance, and grows the map far enough that adding
+    // them allocates no larger one
+    void ReserveBlocks(size_t count);
+
+    void Clear();
+
+    void SetBlockPoolMaxSize(size_t);
+
+    // Frees the retired blocks kept for reuse and shrinks the block map to the smallest
+    // power of two that holds the used blocks. Stops using external blocks once none is left
+    void ShrinkToFit();
+
+    size_t GetUsedBlocksCount() const;
+
+    // Blocks can be handed over to other when both pools allocate every block on its own
+    // from equal resources and use the same external blocks, if any
+    bool CanMoveDataBlocksTo(const CircularBuffer &other) const;
+
+    // Hand the last or the first count blocks over to other, behind its tail or before its
+    // head, keeping their order. The edge block of other they go next to has to be full up to
+    // that end. An empty block of other is dropped, a buffer left without blocks is left like
+    // a new one. The buffer must lend no block
+    void MoveTailDataBlocksTo(size_t count, CircularBuffer &other);
+
+    void MoveHeadDataBlocksTo(size_t count, CircularBuffer &other);
+
+    // Passed on to BlockPool, so that all counters of a deque live in one place
+    void CountMax(size_t DequeStats::*counter, size_t value) {
+        pool_.CountMax(counter, value);
+    }
+
+    // Everything but the size, the peak size and the slack of the deque
+    DequeStats GetStats() const;
+
+    // Number of blocks needed for elem_count elements, at least one
+    static size_t GetBlocksCount(size_t elem_count) {
+        if (elem_count == 0) {
+            return 1;
+        }
+        return GetBlockIndex(elem_count - 1) + 1;
+    }
+
+private:
+    static constexpr bool kIsBlockSizePowerOfTwo = std::has_single_bit(BlockSize);
+    static constexpr size_t kBlockShift = std::countr_zero(BlockSize);
+
+    static size_t GetBlockIndex(size_t position) {
+        if constexpr (kIsBlockSizePowerOfTwo) {
+            return position >> kBlockShift;
+        } else {
+            return position / BlockSize;
+        }
+    }
+
+    static size_t GetPositionInBlock(size_t position) {
+        if constexpr (kIsBlockSizePowerOfTwo) {
+            return position & (BlockSize - 1);
+        } else {
+            return position % BlockSize;
+        }
+    }
+
+    // max_size_ is always a power of two
+    size_t Wrap(size_t index) const {
+        return index & (max_size_ - 1);
+    }
+
+    // Slots copied into the new map per added block. Growth starts with half of the map free,
+    // so copying two fills the new map in before the old one is full
+    static constexpr size_t kMigrationStep = 2;
+
+    DataBlock *GetSlot(size_t index) const {
+        return buffer_[Wrap(index)];
+    }
+
+    // Where the elements of the block in slot index start and end
+    size_t GetBlockBegin(size_t index) const {
+        return index == head_ ? head_begin_ : 0;
+    }
+
+    size_t GetBlockEnd(size_t index) const {
+        return index == tail_ ? tail_end_ : BlockSize;
+    }
+
+    // The edge blocks to write to: acquired if the slot has none yet, copied if lent
+    DataBlock *GetOwnTailDataBlock();
+
+    DataBlock *GetOwnHeadDataBlock();
+
+    // Destroys the elements of block, the one in slot index, unless it is null or external
+    void DestroyElements(size_t index, DataBlock *block);
+
+    // A new block with copies of the elements of block, which sits in slot index of a buffer
+    // with the same edges as this one
+    DataBlock *CreateCopy(size_t index, const DataBlock &block);
+
+    void SetSlot(size_t index, DataBlock *block) {
+        buffer_[Wrap(index)] = block;
+        if (new_buffer_ != nullptr and Wrap(index) < migrated_) {
+            new_buffer_[index & (2 * max_size_ - 1)] = block;
+        }
+    }
+
+    // Starts growing the map once half of it is used and copies the next slots over
+    void GrowMap();
+
+    // Copies up to count slots into the new map, which takes over after the last one
+    void MigrateSlots(size_t count);
+
+    // Stops growing the map, for the operations that replace or rebuild it anyway
+    void DropNewMap() {
+        pool_.DeallocateMap(new_buffer_, 2 * max_size_);
+        new_buffer_ = nullptr;
+    }
+
+    // Only snapshots share blocks, and the buffer has to copy the elements of a shared block
+    static constexpr bool kCanLend = std::is_copy_constructible_v<T>;
+
+    bool IsLent(size_t index) const {
+        return index - lent_head_ < lent_count_;
+    }
+
+    // The holder count of the lent block in slot index
+    HolderCount *GetHolders(size_t index) const {
+        return holders_[lent_first_ + (index - lent_head_)];
+    }
+
+    // Removes the buffer from the holders of the lent block in slot index, false if it was the
+    // last one and owns the block again
+    bool DropHolder(size_t index);
+
+    // Replaces block, the one in slot index at an end of the used ones, with a copy of its own
+    // if it is lent
+    DataBlock *GetOwnDataBlock(size_t index, DataBlock *block);
+
+    // Kept apart from GetOwnDataBlock so that the check inlines into the push paths. index is
+    // at an end of the lent blocks
+    DataBlock *CopyLentDataBlock(size_t index);
+
+    void CopyLentDataBlocks();
+
+    // Takes slot index, at an end of the lent blocks, out of them
+    void ReturnLentDataBlock(size_t index);
+
+    // Drops the holds on the lent blocks and empties their slots
+    void DropLentDataBlocks();
+
+    // Releases the block in slot index, at an end of the used ones, to the pool unless it is
+    // lent and has other holders, and empties the slot
+    void ReleaseSlot(size_t index);
+
+    // Moves the used blocks to the start of a new map of new_size slots, at least
+    // kBufferInitMaxSize of them
+    void ReallocateMap(size_t new_size);
+
+    // Gives map back to the resource unless it is inline_map_
+    void DeallocateMap(DataBlock **map, size_t size) {
+        if (map != inline_map_) {
+            pool_.DeallocateMap(map, size);
+        }
+    }
+};
+
+template<class T, size_t BlockSize>
+constexpr CircularBuffer<T, BlockSize>::CircularBuffer(std::pmr::memory_resource *resource,
+                                                       BlockStorage storage) noexcept
+        : pool_(resource, storage) {
+}
+
+template<class T, size_t BlockSize>
+CircularBuffer<T, BlockSize>::CircularBuffer(size_t elem_count,
+                                             std::pmr::memory_resource *resource)
+        : pool_(resource) {
+    size_t blocks = GetBlocksCount(elem_count);
+    if (blocks > deque_settings::kInlineMapSize) {
+        max_size_ = std::bit_ceil(std::max(blocks, deque_settings::kBufferInitMaxSize));
+        buffer_ = pool_.AllocateMap(max_size_);
+    }
+}
+
+template<class T, size_t BlockSize>
+template<class... Filler>
+void CircularBuffer<T, BlockSize>::Fill(size_t elem_count, const Filler &...filler) {
+    pool_.Release(buffer_[0]);
+    buffer_[0] = nullptr;
+    size_ = GetBlocksCount(elem_count);
+    tail_ = size_ - 1;
+    tail_end_ = elem_count - tail_ * BlockSize;
+    // A block goes into its slot once it is filled, so that the destructor only meets
+    // complete ones
+    for (size_t i = 0; i < size_; ++i) {
+        DataBlock *block = pool_.Create();
+        try {
+            block->Fill(0, GetBlockEnd(i), filler...);
+        } catch (...) {
+            pool_.Destroy(block);
+            throw;
+        }
+        buffer_[i] = block;
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::LoadDataBlocks(DataBlock *blocks, size_t count,
+                                                  size_t head_begin, size_t tail_end,
+                                                  ExternalBlocks *external) {
+    if (count == 0) {
+        return;
+    }
+    ReserveSlots(count);
+    pool_.Release(GetSlot(head_));
+    SetSlot(head_, nullptr);
+    pool_.SetExternal(external);
+    head_ = 0;
+    tail_ = count - 1;
+    size_ = count;
+    head_begin_ = head_begin;
+    tail_end_ = tail_end;
+    for (size_t i = 0; i < count; ++i) {
+        DataBlock *block = blocks + i;
+        SetSlot(i, pool_.IsExternal(block) ? block : CreateCopy(i, *block));
+    }
+}
+
+template<class T, size_t BlockSize>
+CircularBuffer<T, BlockSize>::CircularBuffer(CircularBuffer &&other) noexcept
+        : size_{other.size_},
+          max_size_{other.max_size_},
+          head_{other.head_},
+          tail_{other.tail_},
+          head_begin_{other.head_begin_},
+          tail_end_{other.tail_end_},
+          pool_{std::move(other.pool_)},
+          buffer_{other.buffer_},
+          new_buffer_{other.new_buffer_},
+          migrated_{other.migrated_},
+          holders_{other.holders_},
+          holders_size_{other.holders_size_},
+          lent_first_{other.lent_first_},
+          lent_head_{other.lent_head_},
+          lent_count_{other.lent_count_} {
+    if (other.buffer_ == other.inline_map_) {
+        std::copy_n(other.inline_map_, deque_settings::kInlineMapSize, inline_map_);
+        buffer_ = inline_map_;
+    }
+    std::fill_n(other.inline_map_, deque_settings::kInlineMapSize, nullptr);
+    other.buffer_ = other.inline_map_;
+    other.new_buffer_ = nullptr;
+    other.holders_ = nullptr;
+    other.lent_count_ = 0;
+    other.size_ = 1;
+    other.max_size_ = deque_settings::kInlineMapSize;
+    other.head_ = 0;
+    other.tail_ = 0;
+    other.head_begin_ = 0;
+    other.tail_end_ = 0;
+}
+
+template<class T, size_t BlockSize>
+CircularBuffer<T, BlockSize> &CircularBuffer<T, BlockSize>::operator=(
+        CircularBuffer &&other) noexcept {
+    if (this != &other) {
+        CircularBuffer tmp(std::move(other));
+        Swap(tmp);
+    }
+    return *this;
+}
+
+template<class T, size_t BlockSize>
+CircularBuffer<T, BlockSize>::CircularBuffer(const CircularBuffer &other,
+                                             std::pmr::memory_resource *resource)
+        : size_{other.size_},
+          max_size_{other.max_size_},
+          head_{other.head_},
+          tail_{other.tail_},
+          head_begin_{other.head_begin_},
+          tail_end_{other.tail_end_},
+          pool_(resource, other.GetStorage()),
+          buffer_(other.buffer_ == other.inline_map_ ? inline_map_
+                                                      : pool_.AllocateMap(max_size_)) {
+    // The destructor does not run for a constructor that throws, so a throwing copy of an
+    // element gives back what was built so far here. The pool is a member and cleans up itself
+    size_t i = head_;
+    try {
+        for (; i != tail_ + 1; ++i) {
+            if (const DataBlock *block = other.GetSlot(i)) {
+                buffer_[Wrap(i)] = CreateCopy(i, *block);
+            }
+        }
+    } catch (...) {
+        for (size_t j = head_; j != i; ++j) {
+            DestroyElements(j, buffer_[Wrap(j)]);
+            pool_.Destroy(buffer_[Wrap(j)]);
+        }
+        DeallocateMap(buffer_, max_size_);
+        throw;
+    }
+}
+
+template<class T, size_t BlockSize>
+CircularBuffer<T, BlockSize>::~CircularBuffer() {
+    DropNewMap();
+    DropLentDataBlocks();
+    for (size_t i = 0; i < size_; ++i) {
+        DestroyElements(head_ + i, GetSlot(head_ + i));
+    }
+    for (size_t i = 0; i < max_size_; ++i) {
+        pool_.Destroy(buffer_[i]);
+    }
+    DeallocateMap(buffer_, max_size_);
+}
+
+template<class T, size_t BlockSize>
+std::pmr::memory_resource *CircularBuffer<T, BlockSize>::GetMemoryResource() const {
+    return pool_.GetMemoryResource();
+}
+
+template<class T, size_t BlockSize>
+BlockStorage CircularBuffer<T, BlockSize>::GetStorage() const {
+    return pool_.GetStorage();
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::Swap(CircularBuffer &other) noexcept {
+    std::swap(buffer_, other.buffer_);
+    std::swap(size_, other.size_);
+    std::swap(max_size_, other.max_size_);
+    std::swap(head_, other.head_);
+    std::swap(tail_, other.tail_);
+    std::swap(head_begin_, other.head_begin_);
+    std::swap(tail_end_, other.tail_end_);
+    std::swap(new_buffer_, other.new_buffer_);
+    std::swap(migrated_, other.migrated_);
+    std::swap(holders_, other.holders_);
+    std::swap(holders_size_, other.holders_size_);
+    std::swap(lent_first_, other.lent_first_);
+    std::swap(lent_head_, other.lent_head_);
+    std::swap(lent_count_, other.lent_count_);
+    std::swap(inline_map_, other.inline_map_);
+    // An inline map stays with its buffer, only its slots change places
+    if (buffer_ == other.inline_map_) {
+        buffer_ = inline_map_;
+    }
+    if (other.buffer_ == inline_map_) {
+        other.buffer_ = other.inline_map_;
+    }
+    pool_.Swap(other.pool_);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::Assign(const CircularBuffer &other) {
+    DropNewMap();
+    size_t count = other.size_;
+    // Allocate everything up front, so that nothing but copying an element can throw below.
+    // Either buffer may have no block yet, its slot is null then like the unused ones. Lent
+    // blocks stay with their snapshots, so their slots need new ones as well
+    if (max_size_ < count) {
+        ReallocateMap(std::bit_ceil(count));
+    }
+    size_t new_blocks = 0;
+    for (size_t k = 0; k < count; ++k) {
+        const DataBlock *block = GetSlot(head_ + k);
+        new_blocks += other.GetSlot(other.head_ + k) != nullptr and
+                      (block == nullptr or pool_.IsExternal(block) or IsLent(head_ + k));
+    }
+    pool_.Reserve(new_blocks);
+    DropLentDataBlocks();
+    for (size_t k = 0; k < size_; ++k) {
+        DestroyElements(head_ + k, GetSlot(head_ + k));
+    }
+    for (size_t k = 0; k < count; ++k) {
+        const DataBlock *source = other.GetSlot(other.head_ + k);
+        DataBlock *&slot = buffer_[Wrap(head_ + k)];
+        if (source == nullptr) {
+            pool_.Release(slot);
+            slot = nullptr;
+            continue;
+        }
+        if (slot == nullptr or pool_.IsExternal(slot)) {
+            slot = pool_.Acquire();
+        }
+    }
+    for (size_t k = count; k < size_; ++k) {
+        DataBlock *&slot = buffer_[Wrap(head_ + k)];
+        pool_.Release(slot);
+        slot = nullptr;
+    }
+    // No external block is left, they were all either replaced or dropped
+    pool_.SetExternal(nullptr);
+    size_ = count;
+    tail_ = head_ + count - 1;
+    head_begin_ = other.head_begin_;
+    tail_end_ = other.tail_end_;
+    for (size_t k = 0; k < count; ++k) {
+        const DataBlock *source = other.GetSlot(other.head_ + k);
+        if (source == nullptr) {
+            continue;
+        }
+        size_t begin = GetBlockBegin(head_ + k);
+        const T *first = &source->At(begin);
+        try {
+            GetSlot(head_ + k)->ConstructRange(begin, first, GetBlockEnd(head_ + k) - begin);
+        } catch (...) {
+            // The buffer keeps the blocks copied so far, every one of them is full up to its
+            // end. The rest hold nothing and go back to the pool
+            for (size_t j = k; j < count; ++j) {
+                pool_.Release(GetSlot(head_ + j));
+                SetSlot(head_ + j, nullptr);
+            }
+            size_ = std::max<size_t>(k, 1);
+            tail_ = head_ + size_ - 1;
+            tail_end_ = k == 0 ? head_begin_ : BlockSize;
+            throw;
+        }
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ShareDataBlocksWith(CircularBuffer &snapshot) {
+    DropNewMap();
+    if (buffer_ != inline_map_) {
+        snapshot.buffer_ = snapshot.pool_.AllocateMap(max_size_);
+        snapshot.max_size_ = max_size_;
+    }
+    // Both buffers get a holders array of their own, and the blocks the buffer does not lend
+    // yet a count. They are all allocated before any count changes
+    std::pmr::polymorphic_allocator<> allocator(GetMemoryResource());
+    HolderCount **holders = allocator.allocate_object<HolderCount *>(size_);
+    HolderCount **snapshot_holders = nullptr;
+    size_t i = 0;
+    try {
+        snapshot_holders = allocator.allocate_object<HolderCount *>(size_);
+        for (; i < size_; ++i) {
+            holders[i] = IsLent(head_ + i) ? GetHolders(head_ + i)
+                                           : allocator.new_object<HolderCount>(1);
+        }
+    } catch (...) {
+        for (size_t j = 0; j < i; ++j) {
+            if (!IsLent(head_ + j)) {
+                allocator.delete_object(holders[j]);
+            }
+        }
+        if (snapshot_holders != nullptr) {
+            allocator.deallocate_object(snapshot_holders, size_);
+        }
+        allocator.deallocate_object(holders, size_);
+        throw;
+    }
+    for (i = 0; i < size_; ++i) {
+        holders[i]->fetch_add(1, std::memory_order_relaxed);
+    }
+    std::copy_n(holders, size_, snapshot_holders);
+    if (holders_ != nullptr) {
+        allocator.deallocate_object(holders_, holders_size_);
+    }
+    std::copy_n(buffer_, max_size_, snapshot.buffer_);
+    snapshot.size_ = size_;
+    snapshot.head_ = head_;
+    snapshot.tail_ = tail_;
+    snapshot.head_begin_ = head_begin_;
+    snapshot.tail_end_ = tail_end_;
+    snapshot.pool_.SetExternal(pool_.GetExternal());
+    holders_ = holders;
+    snapshot.holders_ = snapshot_holders;
+    snapshot.holders_size_ = holders_size_ = size_;
+    snapshot.lent_first_ = lent_first_ = 0;
+    snapshot.lent_head_ = lent_head_ = head_;
+    snapshot.lent_count_ = lent_count_ = size_;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::AddTailDataBlock() {
+    GrowMap();
+    SetSlot(tail_ + 1, pool_.Acquire());
+    tail_ += 1;
+    size_ += 1;
+    tail_end_ = 0;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::AddHeadDataBlock() {
+    GrowMap();
+    SetSlot(head_ - 1, pool_.Acquire());
+    head_ -= 1;
+    size_ += 1;
+    head_begin_ = BlockSize;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::DeleteDataBlockFromTail() {
+    ReleaseSlot(tail_);
+    if (tail_ == head_) {
+        tail_ = 0;
+        head_ = 0;
+        size_ = 0;
+        head_begin_ = 0;
+        tail_end_ = 0;
+    } else {
+        tail_ -= 1;
+        size_ -= 1;
+        tail_end_ = BlockSize;
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::DeleteDataBlockFromHead() {
+    ReleaseSlot(head_);
+    if (head_ == tail_) {
+        tail_ = 0;
+        head_ = 0;
+        size_ = 0;
+        head_begin_ = 0;
+        tail_end_ = 0;
+    } else {
+        head_ += 1;
+        size_ -= 1;
+        head_begin_ = 0;
+    }
+}
+
+template<class T, size_t BlockSize>
+bool CircularBuffer<T, BlockSize>::RecycleHeadDataBlock() {
+    DataBlock *block = GetSlot(head_);
+    if (IsLent(head_) or pool_.IsExternal(block)) {
+        return false;
+    }
+    MigrateSlots(kMigrationStep);
+    // With a full map the slot after the tail is the head one
+    SetSlot(head_, nullptr);
+    head_ += 1;
+    tail_ += 1;
+    SetSlot(tail_, block);
+    head_begin_ = 0;
+    tail_end_ = 0;
+    pool_.Count(&DequeStats::blocks_recycled);
+    return true;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ResetDataBlock(size_t position) {
+    GetOwnTailDataBlock();
+    head_begin_ = position;
+    tail_end_ = position;
+}
+
+template<class T, size_t BlockSize>
+template<class... Args>
+T &CircularBuffer<T, BlockSize>::EmplaceBack(Args &&...args) {
+    DataBlock *block = GetOwnTailDataBlock();
+    T &value = block->Emplace(tail_end_, std::forward<Args>(args)...);
+    ++tail_end_;
+    return value;
+}
+
+template<class T, size_t BlockSize>
+template<class... Args>
+T &CircularBuffer<T, BlockSize>::EmplaceFront(Args &&...args) {
+    DataBlock *block = GetOwnHeadDataBlock();
+    T &value = block->Emplace(head_begin_ - 1, std::forward<Args>(args)...);
+    --head_begin_;
+    return value;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::PopBack() {
+    DataBlock *block = GetOwnTailDataBlock();
+    --tail_end_;
+    block->Destroy(tail_end_, 1);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::PopFront() {
+    DataBlock *block = GetOwnHeadDataBlock();
+    block->Destroy(head_begin_, 1);
+    ++head_begin_;
+}
+
+template<class T, size_t BlockSize>
+template<class It>
+void CircularBuffer<T, BlockSize>::PushBackRange(It &first, size_t count) {
+    DataBlock *block = GetOwnTailDataBlock();
+    block->ConstructRange(tail_end_, first, count);
+    tail_end_ += count;
+}
+
+template<class T, size_t BlockSize>
+template<class It>
+void CircularBuffer<T, BlockSize>::PushFrontRange(It &last, size_t count) {
+    DataBlock *block = GetOwnHeadDataBlock();
+    block->ConstructRangeBefore(head_begin_, last, count);
+    head_begin_ -= count;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::PopBackN(size_t count) {
+    DataBlock *block = GetOwnTailDataBlock();
+    tail_end_ -= count;
+    block->Destroy(tail_end_, count);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::PopFrontN(size_t count) {
+    DataBlock *block = GetOwnHeadDataBlock();
+    block->Destroy(head_begin_, count);
+    head_begin_ += count;
+}
+
+template<class T, size_t BlockSize>
+bool CircularBuffer<T, BlockSize>::IsFull() const {
+    return size_ == max_size_;
+}
+
+template<class T, size_t BlockSize>
+bool CircularBuffer<T, BlockSize>::IsEmpty() const {
+    return size_ == 1 and (GetSlot(head_) == nullptr or head_begin_ == tail_end_);
+}
+
+// A missing block has no room, so that the push paths go get one
+
+template<class T, size_t BlockSize>
+size_t CircularBuffer<T, BlockSize>::GetTailBackRoom() const {
+    return GetSlot(tail_) == nullptr ? 0 : BlockSize - tail_end_;
+}
+
+template<class T, size_t BlockSize>
+size_t CircularBuffer<T, BlockSize>::GetHeadFrontRoom() const {
+    return GetSlot(head_) == nullptr ? 0 : head_begin_;
+}
+
+template<class T, size_t BlockSize>
+size_t CircularBuffer<T, BlockSize>::GetTailSize() const {
+    return tail_end_ - GetBlockBegin(tail_);
+}
+
+template<class T, size_t BlockSize>
+size_t CircularBuffer<T, BlockSize>::GetHeadSize() const {
+    return GetBlockEnd(head_) - head_begin_;
+}
+
+template<class T, size_t BlockSize>
+typename CircularBuffer<T, BlockSize>::DataBlock *
+CircularBuffer<T, BlockSize>::GetOwnTailDataBlock() {
+    DataBlock *block = GetSlot(tail_);
+    if (block == nullptr) {
+        block = pool_.Acquire();
+        SetSlot(tail_, block);
+    }
+    return GetOwnDataBlock(tail_, block);
+}
+
+template<class T, size_t BlockSize>
+typename CircularBuffer<T, BlockSize>::DataBlock *
+CircularBuffer<T, BlockSize>::GetOwnHeadDataBlock() {
+    DataBlock *block = GetSlot(head_);
+    if (block == nullptr) {
+        block = pool_.Acquire();
+        SetSlot(head_, block);
+    }
+    return GetOwnDataBlock(head_, block);
+}
+
+template<class T, size_t BlockSize>
+const typename CircularBuffer<T, BlockSize>::DataBlock *
+CircularBuffer<T, BlockSize>::GetTailDataBlock() const {
+    return GetSlot(tail_);
+}
+
+template<class T, size_t BlockSize>
+const typename CircularBuffer<T, BlockSize>::DataBlock *
+CircularBuffer<T, BlockSize>::GetHeadDataBlock() const {
+    return GetSlot(head_);
+}
+
+template<class T, size_t BlockSize>
+typename CircularBuffer<T, BlockSize>::DataBlock *CircularBuffer<T, BlockSize>::CopyLentDataBlock(
+        size_t index) {
+    DataBlock *block = GetSlot(index);
+    // Only the buffer that lent the block adds holders, so one that is the last stays the last
+    HolderCount *holders = GetHolders(index);
+    if (holders->load(std::memory_order_acquire) == 1) {
+        std::pmr::polymorphic_allocator<>(GetMemoryResource()).delete_object(holders);
+        ReturnLentDataBlock(index);
+        return block;
+    }
+    DataBlock *copy = CreateCopy(index, *block);
+    ReleaseSlot(index);
+    SetSlot(index, copy);
+    return copy;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::CopyLentDataBlocks() {
+    // One block at a time, so that a copy that throws leaves the rest lent
+    while (lent_count_ != 0) {
+        CopyLentDataBlock(lent_head_);
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ReturnLentDataBlock(size_t index) {
+    if (index == lent_head_) {
+        lent_head_ += 1;
+        lent_first_ += 1;
+    }
+    if (--lent_count_ == 0) {
+        std::pmr::polymorphic_allocator<>(GetMemoryResource())
+                .deallocate_object(std::exchange(holders_, nullptr), holders_size_);
+    }
+}
+
+template<class T, size_t BlockSize>
+bool CircularBuffer<T, BlockSize>::DropHolder(size_t index) {
+    HolderCount *holders = GetHolders(index);
+    if (holders->fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return true;
+    }
+    std::pmr::polymorphic_allocator<>(GetMemoryResource()).delete_object(holders);
+    return false;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::DropLentDataBlocks() {
+    if (lent_count_ == 0) {
+        return;
+    }
+    for (size_t i = 0; i < lent_count_; ++i) {
+        DataBlock *block = GetSlot(lent_head_ + i);
+        if (!DropHolder(lent_head_ + i)) {
+            DestroyElements(lent_head_ + i, block);
+            pool_.Release(block);
+        }
+        SetSlot(lent_head_ + i, nullptr);
+    }
+    lent_count_ = 0;
+    std::pmr::polymorphic_allocator<>(GetMemoryResource())
+            .deallocate_object(std::exchange(holders_, nullptr), holders_size_);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ReleaseSlot(size_t index) {
+    DataBlock *block = GetSlot(index);
+    if (!IsLent(index)) {
+        DestroyElements(index, block);
+        pool_.Release(block);
+    } else {
+        if (!DropHolder(index)) {
+            DestroyElements(index, block);
+            pool_.Release(block);
+        }
+        ReturnLentDataBlock(index);
+    }
+    SetSlot(index, nullptr);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::DestroyElements(size_t index, DataBlock *block) {
+    if (block != nullptr and !pool_.IsExternal(block)) {
+        block->Destroy(GetBlockBegin(index), GetBlockEnd(index) - GetBlockBegin(index));
+    }
+}
+
+template<class T, size_t BlockSize>
+typename CircularBuffer<T, BlockSize>::DataBlock *CircularBuffer<T, BlockSize>::CreateCopy(
+        size_t index, const DataBlock &block) {
+    DataBlock *copy = pool_.Create();
+    size_t begin = GetBlockBegin(index);
+    const T *first = &block.At(begin);
+    try {
+        copy->ConstructRange(begin, first, GetBlockEnd(index) - begin);
+    } catch (...) {
+        pool_.Destroy(copy);
+        throw;
+    }
+    return copy;
+}
+
+template<class T, size_t BlockSize>
+typename CircularBuffer<T, BlockSize>::DataBlock *CircularBuffer<T, BlockSize>::GetOwnDataBlock(
+        size_t index, DataBlock *block) {
+    if constexpr (kCanLend) {
+        if (IsLent(index)) [[unlikely]] {
+            return CopyLentDataBlock(index);
+        }
+    }
+    return block;
+}
+
+template<class T, size_t BlockSize>
+T &CircularBuffer<T, BlockSize>::GetElementByIndex(size_t index) {
+    // Only the head block may start in the middle, every next one begins at position 0
+    size_t position = head_begin_ + index;
+    return GetSlot(head_ + GetBlockIndex(position))->At(GetPositionInBlock(position));
+}
+
+template<class T, size_t BlockSize>
+const T &CircularBuffer<T, BlockSize>::GetElementByIndex(size_t index) const {
+    // Only the head block may start in the middle, every next one begins at position 0
+    size_t position = head_begin_ + index;
+    return GetSlot(head_ + GetBlockIndex(position))->At(GetPositionInBlock(position));
+}
+
+template<class T, size_t BlockSize>
+std::span<T> CircularBuffer<T, BlockSize>::GetSegmentByIndex(size_t index) {
+    return GetSegment(GetBlockIndex(head_begin_ + index));
+}
+
+template<class T, size_t BlockSize>
+std::span<const T> CircularBuffer<T, BlockSize>::GetSegmentByIndex(size_t index) const {
+    return GetSegment(GetBlockIndex(head_begin_ + index));
+}
+
+template<class T, size_t BlockSize>
+std::span<T> CircularBuffer<T, BlockSize>::GetSegment(size_t block_index) {
+    size_t index = head_ + block_index;
+    size_t begin = GetBlockBegin(index);
+    return std::span<T>(&GetSlot(index)->At(begin), GetBlockEnd(index) - begin);
+}
+
+template<class T, size_t BlockSize>
+std::span<const T> CircularBuffer<T, BlockSize>::GetSegment(size_t block_index) const {
+    size_t index = head_ + block_index;
+    size_t begin = GetBlockBegin(index);
+    return std::span<const T>(&GetSlot(index)->At(begin), GetBlockEnd(index) - begin);
+}
+
+template<class T, size_t BlockSize>
+template<class Fn>
+void CircularBuffer<T, BlockSize>::ForEachSegment(Fn &&fn) {
+    for (size_t i = 0; i < size_; ++i) {
+        if (GetSlot(head_ + i) != nullptr) {
+            fn(GetSegment(i));
+        }
+    }
+}
+
+template<class T, size_t BlockSize>
+template<class Fn>
+void CircularBuffer<T, BlockSize>::ForEachSegment(Fn &&fn) const {
+    for (size_t i = 0; i < size_; ++i) {
+        if (GetSlot(head_ + i) != nullptr) {
+            fn(GetSegment(i));
+        }
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ExpandBuffer() {
+    // A map filled in the meantime is dropped too, the used slots are copied once below
+    DropNewMap();
+    ReallocateMap(max_size_ * 2);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::GrowMap() {
+    // The inline map has too few slots to copy them a few at a time
+    if (new_buffer_ == nullptr and buffer_ != inline_map_ and size_ >= max_size_ / 2) {
+        new_buffer_ = pool_.AllocateRawMap(max_size_ * 2);
+        migrated_ = 0;
+        pool_.Count(&DequeStats::map_expansions);
+    }
+    MigrateSlots(kMigrationStep);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::MigrateSlots(size_t count) {
+    for (; count > 0 and new_buffer_ != nullptr; --count) {
+        // Slot migrated_ goes to one of the two slots of the new map that it wraps to, the
+        // one the index of its block wraps to there. The other one, and both for an unused
+        // slot, start out empty
+        size_t index = head_ + Wrap(migrated_ - head_);
+        if (index - head_ >= size_) {
+            index = migrated_;
+        }
+        new_buffer_[index & (2 * max_size_ - 1)] = buffer_[migrated_];
+        new_buffer_[(index + max_size_) & (2 * max_size_ - 1)] = nullptr;
+        pool_.Count(&DequeStats::map_bytes_moved, sizeof(DataBlock *));
+        if (++migrated_ == max_size_) {
+            pool_.DeallocateMap(buffer_, max_size_);
+            buffer_ = std::exchange(new_buffer_, nullptr);
+            max_size_ *= 2;
+        }
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ReallocateMap(size_t new_size) {
+    DropNewMap();
+    new_size = std::max(new_size, deque_settings::kBufferInitMaxSize);
+    DataBlock **new_buffer = pool_.AllocateMap(new_size);
+    for (size_t i = 0; i < size_; ++i) {
+        new_buffer[i] = GetSlot(head_ + i);
+    }
+    lent_head_ -= head_;
+    head_ = 0;
+    tail_ = size_ - 1;
+    if (new_size > max_size_) {
+        pool_.Count(&DequeStats::map_expansions);
+    }
+    pool_.Count(&DequeStats::map_bytes_moved, size_ * sizeof(DataBlock *));
+    DeallocateMap(buffer_, max_size_);
+    buffer_ = new_buffer;
+    max_size_ = new_size;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ReserveSlots(size_t count) {
+    if (max_size_ - size_ < count) {
+        ReallocateMap(std::bit_ceil(size_ + count));
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ReserveBlocks(size_t count) {
+    // Adding blocks to a map that is half used grows it, which must not allocate either
+    bool fits = buffer_ == inline_map_ ? size_ + count <= max_size_
+                                       : 2 * (size_ + count) <= max_size_;
+    if (!fits) {
+        ReallocateMap(std::bit_ceil(2 * (size_ + count)));
+    }
+    pool_.Reserve(count);
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::Clear() {
+    DropNewMap();
+    DropLentDataBlocks();
+    for (size_t i = 0; i < size_; ++i) {
+        DestroyElements(head_ + i, GetSlot(head_ + i));
+    }
+    // The next push takes a block from the pool
+    for (size_t i = 0; i < max_size_; ++i) {
+        pool_.Release(buffer_[i]);
+        buffer_[i] = nullptr;
+    }
+    size_ = 1;
+    tail_ = 0;
+    head_ = 0;
+    head_begin_ = 0;
+    tail_end_ = 0;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::SetBlockPoolMaxSize(size_t max_size) {
+    pool_.SetMaxSize(max_size);
+}
+
+template<class T, size_t BlockSize>
+size_t CircularBuffer<T, BlockSize>::GetUsedBlocksCount() const {
+    return size_;
+}
+
+template<class T, size_t BlockSize>
+bool CircularBuffer<T, BlockSize>::CanMoveDataBlocksTo(const CircularBuffer &other) const {
+    return GetStorage() == BlockStorage::kSeparate and
+           other.GetStorage() == BlockStorage::kSeparate and
+           *GetMemoryResource() == *other.GetMemoryResource() and
+           pool_.GetExternal() == other.pool_.GetExternal();
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::MoveTailDataBlocksTo(size_t count, CircularBuffer &other) {
+    if (count == 0) {
+        return;
+    }
+    other.ReserveSlots(count);
+    if (other.IsEmpty()) {
+        other.pool_.Release(other.GetSlot(other.head_));
+        other.SetSlot(other.head_, nullptr);
+        other.size_ = 0;
+        other.tail_ = other.head_ - 1;
+        other.head_begin_ = GetBlockBegin(head_ + size_ - count);
+    }
+    for (size_t i = size_ - count; i < size_; ++i) {
+        other.tail_ += 1;
+        other.SetSlot(other.tail_, GetSlot(head_ + i));
+        other.size_ += 1;
+        SetSlot(head_ + i, nullptr);
+    }
+    other.tail_end_ = tail_end_;
+    size_ -= count;
+    tail_ -= count;
+    tail_end_ = BlockSize;
+    if (size_ == 0) {
+        tail_ = head_;
+        size_ = 1;
+        head_begin_ = 0;
+        tail_end_ = 0;
+    }
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::MoveHeadDataBlocksTo(size_t count, CircularBuffer &other) {
+    if (count == 0) {
+        return;
+    }
+    other.ReserveSlots(count);
+    if (other.IsEmpty()) {
+        other.pool_.Release(other.GetSlot(other.head_));
+        other.SetSlot(other.head_, nullptr);
+        other.size_ = 0;
+        other.head_ = other.tail_ + 1;
+        other.tail_end_ = GetBlockEnd(head_ + count - 1);
+    }
+    for (size_t i = count; i > 0; --i) {
+        other.head_ -= 1;
+        other.SetSlot(other.head_, GetSlot(head_ + i - 1));
+        other.size_ += 1;
+        SetSlot(head_ + i - 1, nullptr);
+    }
+    other.head_begin_ = head_begin_;
+    size_ -= count;
+    head_ += count;
+    head_begin_ = 0;
+    if (size_ == 0) {
+        head_ = tail_;
+        size_ = 1;
+        tail_end_ = 0;
+    }
+}
+
+template<class T, size_t BlockSize>
+DequeStats CircularBuffer<T, BlockSize>::GetStats() const {
+    // Only the slot of a buffer that has not pushed yet is used without a block
+    size_t live_blocks = GetSlot(head_) == nullptr ? 0 : size_;
+    size_t own_blocks = live_blocks;
+    if (pool_.GetExternal() != nullptr) {
+        for (size_t i = 0; i < size_; ++i) {
+            own_blocks -= pool_.IsExternal(GetSlot(head_ + i));
+        }
+    }
+    DequeStats stats = pool_.GetStats(own_blocks);
+    stats.live_blocks = live_blocks;
+    stats.map_capacity = max_size_;
+    size_t max_size = buffer_ == inline_map_ ? 0 : max_size_;
+    size_t new_max_size = new_buffer_ == nullptr ? 0 : 2 * max_size_;
+    stats.allocated_bytes += (max_size + new_max_size) * sizeof(DataBlock *);
+    return stats;
+}
+
+template<class T, size_t BlockSize>
+void CircularBuffer<T, BlockSize>::ShrinkToFit() {
+    pool_.ShrinkToFit();
+    if (pool_.GetExternal() != nullptr) {
+        bool is_external_used = false;
+        for (size_t i = 0; i < size_ and !is_external_used; ++i) {
+            is_external_used = pool_.IsExternal(GetSlot(head_ + i));
+        }
+        if (!is_external_used) {
+            pool_.SetExternal(nullptr);
+        }
+    }
+    size_t new_size = std::bit_ceil(std::max(size_, deque_settings::kBufferInitMaxSize));
+    if (new_size < max_size_) {
+        ReallocateMap(new_size);
+    }
+}
+
+// Random access iterator that keeps the bounds of the current block, so that stepping inside
+// a block is a pointer increment and only crossing a block boundary goes through the map
+template<class T, size_t BlockSize, bool IsConst>
+class DequeIterator {
+private:
+    using Buffer = std::conditional_t<IsConst, const CircularBuffer<T, BlockSize>,
+                                      CircularBuffer<T, BlockSize>>;
+
+public:
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<IsConst, const T *, T *>;
+    using reference = std::conditional_t<IsConst, const T &, T &>;
+
+    DequeIterator() = default;
+
+    DequeIterator(Buffer *buffer, size_t size, size_t index);
+
+    // An iterator converts to a const_iterator
+    template<bool OtherIsConst>
+        requires(IsConst and !OtherIsConst)
+    DequeIterator(const DequeIterator<T, BlockSize, OtherIsConst> &other)
+        : buffer_(other.buffer_),
+          size_(other.size_),
+          index_(other.index_),
+          cur_(other.cur_),
+          begin_(other.begin_),
+          end_(other.end_) {
+    }
+
+    reference operator*() const {
+        return *cur_;
+    }
+
+    pointer operator->() const {
+        return cur_;
+    }
+
+    reference operator[](difference_type offset) const {
+        return *(*this + offset);
+    }
+
+    DequeIterator &operator++() {
+        ++index_;
+        if (++cur_ == end_ and index_ < size_) {
+            Reload();
+        }
+        return *this;
+    }
+
+    DequeIterator operator++(int) {
+        DequeIterator copy = *this;
+        ++*this;
+        return copy;
+    }
+
+    DequeIterator &operator--() {
+        --index_;
+        if (cur_ == begin_) {
+            Reload();
+        } else {
+            --cur_;
+        }
+        return *this;
+    }
+
+    DequeIterator operator--(int) {
+        DequeIterator copy = *this;
+        --*this;
+        return copy;
+    }
+
+    DequeIterator &operator+=(difference_type offset);
+
+    DequeIterator &operator-=(difference_type offset) {
+        return *this += -offset;
+    }
+
+    friend DequeIterator operator+(DequeIterator it, difference_type offset) {
+        return it += offset;
+    }
+
+    friend DequeIterator operator+(difference_type offset, DequeIterator it) {
+        return it += offset;
+    }
+
+    friend DequeIterator operator-(DequeIterator it, difference_type offset) {
+        return it -= offset;
+    }
+
+    friend difference_type operator-(const DequeIterator &lhs, const DequeIterator &rhs) {
+        return static_cast<difference_type>(lhs.index_) - static_cast<difference_type>(rhs.index_);
+    }
+
+    friend bool operator==(const DequeIterator &lhs, const DequeIterator &rhs) {
+        return lhs.index_ == rhs.index_;
+    }
+
+    friend auto operator<=>(const DequeIterator &lhs, const DequeIterator &rhs) {
+        return lhs.index_ <=> rhs.index_;
+    }
+
+private:
+    template<class, size_t, bool>
+    friend class DequeIterator;
+
+    Buffer *buffer_ = nullptr;
+    size_t size_ = 0;
+    size_t index_ = 0;
+    pointer cur_ = nullptr;
+    pointer begin_ = nullptr;
+    pointer end_ = nullptr;
+
+    // Finds the block of index_ in the map. The end iterator points nowhere, so that end()
+    // costs nothing, stepping back from it reloads
+    void Reload();
+};
+
+template<class T, size_t BlockSize, bool IsConst>
+DequeIterator<T, BlockSize, IsConst>::DequeIterator(Buffer *buffer, size_t size, size_t index)
+    : buffer_(buffer), size_(size), index_(index) {
+    Reload();
+}
+
+template<class T, size_t BlockSize, bool IsConst>
+DequeIterator<T, BlockSize, IsConst> &DequeIterator<T, BlockSize, IsConst>::operator+=(
+        difference_type offset) {
+    index_ += offset;
+    difference_type position = cur_ - begin_ + offset;
+    if (position >= 0 and position < end_ - begin_) {
+        cur_ = begin_ + position;
+    } else {
+        Reload();
+    }
+    return *this;
+}
+
+template<class T, size_t BlockSize, bool IsConst>
+void DequeIterator<T, BlockSize, IsConst>::Reload() {
+    if (index_ >= size_) {
+        cur_ = begin_ = end_ = nullptr;
+        return;
+    }
+    auto segment = buffer_->GetSegmentByIndex(index_);
+    begin_ = segment.data();
+    end_ = begin_ + segment.size();
+    cur_ = &buffer_->GetElementByIndex(index_);
+}
+
+template<class T, size_t BlockBytes>
+class DequeSnapshot;
+
+template<class T = int, size_t BlockBytes = deque_settings::kBlockBytes>
+class Deque {
+private:
+    // Keeps blocks a whole number of cache lines or pages
+    static_assert(std::has_single_bit(BlockBytes));
+
+    static constexpr size_t kBlockSize = deque_settings::kBlockSize<T, BlockBytes>;
+
+public:
+    using value_type = T;
+    using iterator = DequeIterator<T, kBlockSize, false>;
+    using const_iterator = DequeIterator<T, kBlockSize, true>;
+
+    // Empty deques allocate nothing: the block map has its first slots inside the deque and
+    // the first block is allocated by the first push. Construction is constexpr, so that
+    // deques with static storage can be constinit, e.g. constinit Deque<int> log;
+    constexpr Deque() noexcept = default;
+
+    // Copies the elements into blocks of its own from the default resource. Snapshot shares
+    // the blocks instead
+    Deque(const Deque &rhs) = default;
+
+    // Moves steal the blocks and a block map of the memory resource, the slots of the inline
+    // map are copied. A moved-from deque is empty
+    Deque(Deque &&rhs) noexcept;
+
+    explicit Deque(size_t size);
+
+    Deque(std::initializer_list<T> list);
+
+    // Blocks and the block map of the deque are allocated from resource,
+    // which has to outlive the deque
+    constexpr explicit Deque(std::pmr::memory_resource *resource) noexcept;
+
+    Deque(size_t size, std::pmr::memory_resource *resource);
+
+    Deque(std::initializer_list<T> list, std::pmr::memory_resource *resource);
+
+    Deque(const Deque &rhs, std::pmr::memory_resource *resource);
+
+    // With BlockStorage::kSlab blocks are carved out of large chunks, so neighbouring blocks
+    // share pages; copies keep the storage kind of the source
+    constexpr explicit Deque(
+            BlockStorage storage,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource()) noexcept;
+
+    // Keeps the memory resource and the storage kind of this deque, and its block map when
+    // that is large enough. The elements are copied into the blocks this deque already has.
+    // If copying T may throw, they are copied into a new deque first, so that a throw leaves
+    // this one as it was
+    Deque &operator=(const Deque &rhs);
+
+    Deque &operator=(Deque &&rhs) noexcept;
+
+    void Swap(Deque &rhs) noexcept;
+
+    // Read-only copy of the elements as they are now, which costs a block map and a holder
+    // count per block. The deque shares its blocks with the snapshot and copies an edge block
+    // before it pushes or pops there, and all shared blocks before the other modifiers and
+    // before begin(), GetSegment and ForEachSegment hand out references that may be written
+    // through. The non-const operator[] does not check, so that indexing loops stay as fast
+    // as without snapshots: call Unshare() before writing through it. Slab blocks belong to
+    // the chunks of their pool, so a slab deque is copied right away. Snapshots may be read
+    // and copied on other threads while the deque changes
+    DequeSnapshot<T, BlockBytes> Snapshot()
+        requires std::is_copy_constructible_v<T>;
+
+    // Copies the blocks the deque shares with its snapshots, if it shares any
+    void Unshare() {
+        data_proxy_.Unshare();
+    }
+
+    void PushBack(const T &value);
+
+    void PushBack(T &&value);
+
+    template<class... Args>
+    T &EmplaceBack(Args &&...args);
+
+    void PopBack();
+
+    void PushFront(const T &value);
+
+    void PushFront(T &&value);
+
+    template<class... Args>
+    T &EmplaceFront(Args &&...args);
+
+    void PopFront();
+
+    // Sliding window of at most capacity elements, capacity > 0: appends value, removing the
+    // first element first when there are capacity of them already. A first block emptied
+    // right when the last one is full becomes the next last block in place and the other
+    // emptied blocks are pooled, so a window with its blocks reserved up front allocates
+    // nothing (see bounded_deque.h). value may be an element of the deque. If constructing
+    // the element throws, nothing is removed, if moving it into a new last block throws, the
+    // removed element stays removed
+    void PushBackEvict(size_t capacity, const T &value);
+
+    void PushBackEvict(size_t capacity, T &&value);
+
+    template<class... Args>
+    T &EmplaceBackEvict(size_t capacity, Args &&...args);
+
+    // Appends the elements of range in order. Blocks are filled a whole free span at a time,
+    // with memcpy for contiguous ranges of a trivially copyable T
+    template<std::ranges::input_range R>
+    void PushBackRange(R &&range);
+
+    // Inserts the elements of range before the first one, so that they keep their order
+    template<std::ranges::input_range R>
+    void PushFrontRange(R &&range);
+
+    // Remove count elements from an end, count must not exceed Size()
+    void PopBackN(size_t count);
+
+    void PopFrontN(size_t count);
+
+    // Move all elements of other to the back or to the front, leaving other empty. When the
+    // elements of other sit at the block positions they will have here, whole blocks change
+    // hands and only the boundary blocks are merged element by element, which keeps pointers
+    // to the other elements valid. Otherwise, or when the two deques can not trade blocks,
+    // the elements are moved one block at a time
+    void Append(Deque &&other);
+
+    void Prepend(Deque &&other);
+
+    // Moves the elements from index on into a new deque with the storage and memory resource
+    // of this one. The blocks after the one holding index change hands whole
+    Deque SplitAt(size_t index);
+
+    // Inserts before the element at index, moving the elements on whichever side of it is
+    // shorter like std::deque does. They are moved a block segment at a time, with memmove for
+    // a trivially copyable T. If T throws, the deque stays valid but its elements are
+    // unspecified
+    template<class... Args>
+    T &Emplace(size_t index, Args &&...args);
+
+    void Insert(size_t index, const T &value);
+
+    void Insert(size_t index, T &&value);
+
+    template<std::ranges::input_range R>
+    void InsertRange(size_t index, R &&range);
+
+    // Removes count elements starting from index, moving the shorter side over the gap
+    void Erase(size_t index, size_t count = 1);
+
+    T &operator[](size_t ind);
+
+    const T &operator[](size_t ind) const;
+
+    iterator begin();
+
+    iterator end();
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    const_iterator cbegin() const;
+
+    const_iterator cend() const;
+
+    // Calls fn with a std::span over every block's elements from front to back, so that hot
+    // loops run over contiguous memory instead of indexing the deque element by element
+    template<class Fn>
+    void ForEachSegment(Fn &&fn);
+
+    template<class Fn>
+    void ForEachSegment(Fn &&fn) const;
+
+    // The segments ForEachSegment passes by number, so that runs of them can be handed to
+    // different threads. The non-const GetSegment copies the blocks lent to snapshots, so
+    // only call it concurrently once the non-const ForEachSegment has run
+    size_t GetSegmentsCount() const;
+
+    std::span<T> GetSegment(size_t segment);
+
+    std::span<const T> GetSegment(size_t segment) const;
+
+    // The same segments as a random access range of spans, e.g. to build the iovec array of
+    // a writev call. The spans are invalidated with the iterators
+    auto Segments();
+
+    auto Segments() const;
+
+    // Copies the elements to the start of out, which holds at least Size() of them, with one
+    // bulk copy per block. Returns the part of out that was written
+    std::span<T> Linearize(std::span<T> out) const;
+
+    // The elements as one span: the block holding them all when there is one, the part of
+    // buffer they were linearized into otherwise
+    std::span<const T> AsContiguous(std::span<T> buffer) const;
+
+    // The image of a deque of trivially copyable elements is a DequeImageHeader followed by the
+    // images of its blocks, so that a loaded deque can use the blocks right where the image is.
+    // See deque_io.h for saving to and loading from files
+    size_t GetImageSize() const;
+
+    // Passes the image to sink in order, a std::span<const std::byte> at a time
+    template<class Sink>
+    void WriteImage(Sink &&sink) const;
+
+    // Replaces the elements with those of image, which starts aligned like a block. The blocks
+    // that lie in external are used and written where they are: image has to be writable, such
+    // as a private mapping, and must not change otherwise until external is released. Without
+    // external the blocks are copied at once. Returns false and keeps the elements when image
+    // is not one of a deque like this one
+    bool ReadImage(std::span<const std::byte> image, ExternalBlocks *external = nullptr);
+
+    size_t Size() const;
+
+    void Clear();
+
+    // Make room for count more elements at the back or at the front: the block map is grown
+    // and the blocks they need are allocated up front, so the next count pushes at that end
+    // allocate nothing
+    void Reserve(size_t count);
+
+    void ReserveFront(size_t count);
+
+    // Limits how many freed blocks are kept for reuse by later pushes
+    void SetBlockPoolMaxSize(size_t max_size);
+
+    // Gives back pooled blocks and the block map slots the current elements do not need
+    void ShrinkToFit();
+
+    std::pmr::memory_resource *GetMemoryResource() const;
+
+    BlockStorage GetStorage() const;
+
+    // Memory use and, with DEQUE_STATS defined, counters of what the deque has done so far
+    DequeStats Stats() const;
+
+private:
+    using DataBlock = Block<T, kBlockSize>;
+
+    friend class DequeSnapshot<T, BlockBytes>;
+
+    // The block images start here, aligned like blocks
+    static constexpr size_t kImageBlocksOffset =
+            (sizeof(DequeImageHeader) + alignof(DataBlock) - 1) / alignof(DataBlock) *
+            alignof(DataBlock);
+    CircularBuffer<T, kBlockSize> data_proxy_;
+    size_t size_ = 0;
+
+    // Iterator over range that Block can copy with memcpy where possible
+    template<class R>
+    static auto GetRangeBegin(R &range) {
+        if constexpr (std::ranges::contiguous_range<R> and
+                      std::is_same_v<std::ranges::range_value_t<R>, T>) {
+            return std::ranges::data(range);
+        } else {
+            return std::ranges::begin(range);
+        }
+    }
+
+    // Number of blocks that must be added to fit count more elements behind room free slots
+    static size_t GetExtraBlocksCount(size_t count, size_t room) {
+        return count <= room ? 0 : CircularBuffer<T, kBlockSize>::GetBlocksCount(count - room);
+    }
+
+    // Iterator that moves the elements of segment out of it, with memcpy where Block can
+    static auto GetMovingBegin(std::span<T> segment) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            return segment.data();
+        } else {
+            return std::make_move_iterator(segment.data());
+        }
+    }
+
+    // Block position right after the last element, where the next one would go
+    size_t GetEndPosition() const {
+        return data_proxy_.GetTailEnd() % kBlockSize;
+    }
+
+    // Make room for one more element at an end whose block has none. An empty deque moves
+    // the position of its only block instead, true if a block was added
+    bool MakeBackRoom();
+
+    bool MakeFrontRoom();
+
+    // Free slots at the ends, an empty deque can start its block from either end. One that has
+    // not pushed yet has no block and so no room
+    size_t GetBackRoom() const {
+        return size_ == 0 ? GetEmptyRoom() : data_proxy_.GetTailBackRoom();
+    }
+
+    size_t GetFrontRoom() const {
+        return size_ == 0 ? GetEmptyRoom() : data_proxy_.GetHeadFrontRoom();
+    }
+
+    size_t GetEmptyRoom() const {
+        return data_proxy_.GetHeadDataBlock() == nullptr ? 0 : kBlockSize;
+    }
+
+    void UpdatePeakSize() {
+        data_proxy_.CountMax(&DequeStats::peak_size, size_);
+    }
+
+    // Append and Prepend for deques whose blocks do not line up
+    void AppendElements(Deque &other);
+
+    void PrependElements(Deque &other);
+
+    // Range that moves the elements of segment out of it, with memcpy where Block can
+    static auto GetMovingRange(std::span<T> segment) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            return segment;
+        } else {
+            return std::ranges::subrange(std::make_move_iterator(segment.begin()),
+                                         std::make_move_iterator(segment.end()));
+        }
+    }
+
+    // The elements from index on, or before end, that lie in the same block, at most count
+    std::span<T> GetSegmentFrom(size_t index, size_t count);
+
+    std::span<T> GetSegmentBefore(size_t end, size_t count);
+
+    // Inserts count values from first, which is only advanced, with std::next
+    template<class It>
+    void InsertValues(size_t index, It first, size_t count);
+
+    // Pushes the elements [index, index + count) moved out of their places to an end
+    void PushBackMoved(size_t index, size_t count);
+
+    void PushFrontMoved(size_t index, size_t count);
+
+    // Moves count elements from index from to index to, the two ranges may overlap
+    void MoveElements(size_t from, size_t to, size_t count);
+
+    template<class It>
+    void AssignValues(size_t index, It first, size_t count);
+};
+
+// What Deque::Snapshot returns: a const deque that shares its blocks with the deque it was
+// taken of and with other snapshots of it. Copies of a snapshot share that const deque. A
+// moved-from snapshot can only be assigned to or destroyed
+template<class T, size_t BlockBytes>
+class DequeSnapshot {
+public:
+    DequeSnapshot(const DequeSnapshot &other) noexcept : state_(other.state_) {
+        state_->users.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    DequeSnapshot(DequeSnapshot &&other) noexcept : state_(std::exchange(other.state_, nullptr)) {
+    }
+
+    DequeSnapshot &operator=(DequeSnapshot other) noexcept {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    ~DequeSnapshot() {
+        if (state_ != nullptr and state_->users.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::pmr::polymorphic_allocator<State>(state_->deque.GetMemoryResource())
+                    .delete_object(state_);
+        }
+    }
+
+    const Deque<T, BlockBytes> &Get() const {
+        return state_->deque;
+    }
+
+    size_t Size() const {
+        return Get().Size();
+    }
+
+    const T &operator[](size_t index) const {
+        return Get()[index];
+    }
+
+    auto begin() const {
+        return Get().begin();
+    }
+
+    auto end() const {
+        return Get().end();
+    }
+
+private:
+    friend class Deque<T, BlockBytes>;
+
+    // Allocated from the memory resource of the deque, which the snapshot deque uses too
+    struct State {
+        Deque<T, BlockBytes> deque;
+        std::atomic<size_t> users = 1;
+
+        explicit State(std::pmr::memory_resource *resource) : deque(resource) {
+        }
+    };
+
+    State *state_;
+
+    explicit DequeSnapshot(State *state) : state_(state) {
+    }
+};
+
+template<class T = int>
+using SmallBlockDeque = Deque<T, deque_settings::kSmallBlockBytes>;
+
+template<class T = int>
+using PageBlockDeque = Deque<T, deque_settings::kPageBlockBytes>;
+
+template<class T = int>
+using LargeBlockDeque = Deque<T, deque_settings::kLargeBlockBytes>;
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(size_t size) : data_proxy_(size), size_(size) {
+    data_proxy_.Fill(size);
+    UpdatePeakSize();
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(std::initializer_list<T> list) : data_proxy_(list.size()) {
+    for (const T &el: list) {
+        PushBack(el);
+    }
+}
+
+template<class T, size_t BlockBytes>
+constexpr Deque<T, BlockBytes>::Deque(std::pmr::memory_resource *resource) noexcept
+        : data_proxy_(resource) {
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(size_t size, std::pmr::memory_resource *resource)
+        : data_proxy_(size, resource), size_(size) {
+    data_proxy_.Fill(size);
+    UpdatePeakSize();
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(std::initializer_list<T> list, std::pmr::memory_resource *resource)
+        : data_proxy_(list.size(), resource) {
+    for (const T &el: list) {
+        PushBack(el);
+    }
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(const Deque &rhs, std::pmr::memory_resource *resource)
+        : data_proxy_(rhs.data_proxy_, resource), size_(rhs.size_) {
+}
+
+template<class T, size_t BlockBytes>
+constexpr Deque<T, BlockBytes>::Deque(BlockStorage storage,
+                                      std::pmr::memory_resource *resource) noexcept
+        : data_proxy_(resource, storage) {
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes>::Deque(Deque &&rhs) noexcept
+        : data_proxy_(std::move(rhs.data_proxy_)), size_(std::exchange(rhs.size_, 0)) {
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes> &Deque<T, BlockBytes>::operator=(const Deque &rhs) {
+    if (this == &rhs) {
+        return *this;
+    }
+    if (std::is_nothrow_copy_constructible_v<T>) {
+        data_proxy_.Assign(rhs.data_proxy_);
+        size_ = rhs.size_;
+        UpdatePeakSize();
+    } else {
+        Deque copy(GetStorage(), GetMemoryResource());
+        copy.data_proxy_.Assign(rhs.data_proxy_);
+        copy.size_ = rhs.size_;
+        Swap(copy);
+        UpdatePeakSize();
+    }
+    return *this;
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes> &Deque<T, BlockBytes>::operator=(Deque &&rhs) noexcept {
+    if (this != &rhs) {
+        data_proxy_ = std::move(rhs.data_proxy_);
+        size_ = std::exchange(rhs.size_, 0);
+    }
+    return *this;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Swap(Deque &rhs) noexcept {
+    std::swap(size_, rhs.size_);
+    data_proxy_.Swap(rhs.data_proxy_);
+}
+
+template<class T, size_t BlockBytes>
+DequeSnapshot<T, BlockBytes> Deque<T, BlockBytes>::Snapshot()
+    requires std::is_copy_constructible_v<T>
+{
+    using State = typename DequeSnapshot<T, BlockBytes>::State;
+    DequeSnapshot<T, BlockBytes> snapshot(
+            std::pmr::polymorphic_allocator<State>(GetMemoryResource())
+                    .template new_object<State>(GetMemoryResource()));
+    Deque &copy = snapshot.state_->deque;
+    if (GetStorage() == BlockStorage::kSlab) {
+        copy = *this;
+    } else if (size_ != 0) {
+        data_proxy_.ShareDataBlocksWith(copy.data_proxy_);
+        copy.size_ = size_;
+    }
+    return snapshot;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushBack(const T &value) {
+    EmplaceBack(value);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushBack(T &&value) {
+    EmplaceBack(std::move(value));
+}
+
+template<class T, size_t BlockBytes>
+template<class... Args>
+T &Deque<T, BlockBytes>::EmplaceBack(Args &&...args) {
+    bool is_block_added = false;
+    if (data_proxy_.GetTailBackRoom() == 0) [[unlikely]] {
+        is_block_added = MakeBackRoom();
+    }
+    // The tail block has room now
+    try {
+        T &value = data_proxy_.EmplaceBack(std::forward<Args>(args)...);
+        ++size_;
+        UpdatePeakSize();
+        return value;
+    } catch (...) {
+        if (is_block_added) {
+            data_proxy_.DeleteDataBlockFromTail();
+        }
+        throw;
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushBackEvict(size_t capacity, const T &value) {
+    EmplaceBackEvict(capacity, value);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushBackEvict(size_t capacity, T &&value) {
+    EmplaceBackEvict(capacity, std::move(value));
+}
+
+template<class T, size_t BlockBytes>
+template<class... Args>
+T &Deque<T, BlockBytes>::EmplaceBackEvict(size_t capacity, Args &&...args) {
+    if (size_ < capacity) {
+        return EmplaceBack(std::forward<Args>(args)...);
+    }
+    // args may refer to an element of the deque, the first one too, so the new element is
+    // built before the first one goes: in place when the tail block has room, aside when the
+    // first block may have to become the next last one
+    if (data_proxy_.GetTailBackRoom() > 0) {
+        T &value = data_proxy_.EmplaceBack(std::forward<Args>(args)...);
+        ++size_;
+        PopFront();
+        return value;
+    }
+    T element(std::forward<Args>(args)...);
+    data_proxy_.PopFront();
+    --size_;
+    if (data_proxy_.GetHeadSize() != 0 or size_ == 0) {
+        if (size_ == 0) {
+            data_proxy_.ResetDataBlock();
+        }
+        return EmplaceBack(std::move(element));
+    }
+    if (!data_proxy_.RecycleHeadDataBlock()) {
+        data_proxy_.DeleteDataBlockFromHead();
+        return EmplaceBack(std::move(element));
+    }
+    try {
+        T &value = data_proxy_.EmplaceBack(std::move(element));
+        ++size_;
+        return value;
+    } catch (...) {
+        data_proxy_.DeleteDataBlockFromTail();
+        throw;
+    }
+}
+
+template<class T, size_t BlockBytes>
+bool Deque<T, BlockBytes>::MakeBackRoom() {
+    if (size_ == 0) {
+        data_proxy_.ResetDataBlock();
+        return false;
+    }
+    if (data_proxy_.IsFull()) {
+        data_proxy_.ExpandBuffer();
+    }
+    data_proxy_.AddTailDataBlock();
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PopBack() {
+    data_proxy_.PopBack();
+    if (data_proxy_.GetTailSize() == 0) {
+        if (size_ > 1) {
+            data_proxy_.DeleteDataBlockFromTail();
+        } else {
+            // The last block stays, start it over so that both ends have room again
+            data_proxy_.ResetDataBlock();
+        }
+    }
+    --size_;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushFront(const T &value) {
+    EmplaceFront(value);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushFront(T &&value) {
+    EmplaceFront(std::move(value));
+}
+
+template<class T, size_t BlockBytes>
+template<class... Args>
+T &Deque<T, BlockBytes>::EmplaceFront(Args &&...args) {
+    bool is_block_added = false;
+    if (data_proxy_.GetHeadFrontRoom() == 0) [[unlikely]] {
+        is_block_added = MakeFrontRoom();
+    }
+    // The head block has room now
+    try {
+        T &value = data_proxy_.EmplaceFront(std::forward<Args>(args)...);
+        ++size_;
+        UpdatePeakSize();
+        return value;
+    } catch (...) {
+        if (is_block_added) {
+            data_proxy_.DeleteDataBlockFromHead();
+        }
+        throw;
+    }
+}
+
+template<class T, size_t BlockBytes>
+bool Deque<T, BlockBytes>::MakeFrontRoom() {
+    if (size_ == 0) {
+        data_proxy_.ResetDataBlock(kBlockSize);
+        return false;
+    }
+    if (data_proxy_.IsFull()) {
+        data_proxy_.ExpandBuffer();
+    }
+    data_proxy_.AddHeadDataBlock();
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PopFront() {
+    data_proxy_.PopFront();
+    if (data_proxy_.GetHeadSize() == 0) {
+        if (size_ > 1) {
+            data_proxy_.DeleteDataBlockFromHead();
+        } else {
+            data_proxy_.ResetDataBlock();
+        }
+    }
+    --size_;
+}
+
+template<class T, size_t BlockBytes>
+template<std::ranges::input_range R>
+void Deque<T, BlockBytes>::PushBackRange(R &&range) {
+    if constexpr (!std::ranges::sized_range<R>) {
+        for (auto &&el: range) {
+            EmplaceBack(std::forward<decltype(el)>(el));
+        }
+    } else {
+        size_t count = std::ranges::size(range);
+        size_t old_size = size_;
+        data_proxy_.ReserveSlots(GetExtraBlocksCount(count, GetBackRoom()));
+        auto first = GetRangeBegin(range);
+        try {
+            while (size_ - old_size < count) {
+                if (data_proxy_.GetTailBackRoom() == 0) {
+                    MakeBackRoom();
+                }
+                size_t chunk = std::min(count - (size_ - old_size), data_proxy_.GetTailBackRoom());
+                data_proxy_.PushBackRange(first, chunk);
+                size_ += chunk;
+            }
+            UpdatePeakSize();
+        } catch (...) {
+            size_t pushed = size_ - old_size;
+            if (data_proxy_.GetTailSize() == 0 and size_ > 0) {
+                data_proxy_.DeleteDataBlockFromTail();
+            }
+            PopBackN(pushed);
+            throw;
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+template<std::ranges::input_range R>
+void Deque<T, BlockBytes>::PushFrontRange(R &&range) {
+    if constexpr (!std::ranges::sized_range<R> or !std::ranges::bidirectional_range<R>) {
+        size_t old_size = size_;
+        for (auto &&el: range) {
+            EmplaceFront(std::forward<decltype(el)>(el));
+        }
+        size_t count = size_ - old_size;
+        for (size_t i = 0; i < count / 2; ++i) {
+            std::swap((*this)[i], (*this)[count - 1 - i]);
+        }
+    } else {
+        size_t count = std::ranges::size(range);
+        size_t old_size = size_;
+        data_proxy_.ReserveSlots(GetExtraBlocksCount(count, GetFrontRoom()));
+        auto last = std::ranges::next(GetRangeBegin(range), count);
+        try {
+            while (size_ - old_size < count) {
+                if (data_proxy_.GetHeadFrontRoom() == 0) {
+                    MakeFrontRoom();
+                }
+                size_t chunk =
+                        std::min(count - (size_ - old_size), data_proxy_.GetHeadFrontRoom());
+                data_proxy_.PushFrontRange(last, chunk);
+                size_ += chunk;
+            }
+            UpdatePeakSize();
+        } catch (...) {
+            size_t pushed = size_ - old_size;
+            if (data_proxy_.GetHeadSize() == 0 and size_ > 0) {
+                data_proxy_.DeleteDataBlockFromHead();
+            }
+            PopFrontN(pushed);
+            throw;
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PopBackN(size_t count) {
+    while (count > 0) {
+        // Blocks popped whole are dropped unwritten, so shared ones are not copied first
+        size_t last = data_proxy_.GetTailSize();
+        if (last <= count and last < size_) {
+            size_ -= last;
+            count -= last;
+            data_proxy_.DeleteDataBlockFromTail();
+            continue;
+        }
+        size_t chunk = std::min(count, last);
+        data_proxy_.PopBackN(chunk);
+        size_ -= chunk;
+        count -= chunk;
+        if (data_proxy_.GetTailSize() == 0) {
+            if (size_ > 0) {
+                data_proxy_.DeleteDataBlockFromTail();
+            } else {
+                data_proxy_.ResetDataBlock();
+            }
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PopFrontN(size_t count) {
+    while (count > 0) {
+        size_t first = data_proxy_.GetHeadSize();
+        if (first <= count and first < size_) {
+            size_ -= first;
+            count -= first;
+            data_proxy_.DeleteDataBlockFromHead();
+            continue;
+        }
+        size_t chunk = std::min(count, first);
+        data_proxy_.PopFrontN(chunk);
+        size_ -= chunk;
+        count -= chunk;
+        if (data_proxy_.GetHeadSize() == 0) {
+            if (size_ > 0) {
+                data_proxy_.DeleteDataBlockFromHead();
+            } else {
+                data_proxy_.ResetDataBlock();
+            }
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Append(Deque &&other) {
+    if (other.size_ == 0) {
+        return;
+    }
+    if (!other.data_proxy_.CanMoveDataBlocksTo(data_proxy_)) {
+        AppendElements(other);
+        return;
+    }
+    other.data_proxy_.Unshare();
+    if (size_ != 0) {
+        size_t position = GetEndPosition();
+        if (position != other.data_proxy_.GetHeadBegin()) {
+            AppendElements(other);
+            return;
+        }
+        if (position != 0) {
+            // The head block of other continues our tail block
+            std::span<T> other_head = other.data_proxy_.GetSegment(0);
+            auto first = GetMovingBegin(other_head);
+            data_proxy_.PushBackRange(first, other_head.size());
+            size_ += other_head.size();
+            other.PopFrontN(other_head.size());
+        }
+    }
+    if (other.size_ != 0) {
+        size_ += other.size_;
+        other.data_proxy_.MoveTailDataBlocksTo(other.data_proxy_.GetUsedBlocksCount(),
+                                               data_proxy_);
+        other.size_ = 0;
+    }
+    UpdatePeakSize();
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Prepend(Deque &&other) {
+    if (other.size_ == 0) {
+        return;
+    }
+    if (!other.data_proxy_.CanMoveDataBlocksTo(data_proxy_)) {
+        PrependElements(other);
+        return;
+    }
+    other.data_proxy_.Unshare();
+    if (size_ != 0) {
+        data_proxy_.Unshare();
+        size_t position = other.GetEndPosition();
+        size_t head_end = data_proxy_.GetHeadBegin() + data_proxy_.GetHeadSize();
+        if (position != data_proxy_.GetHeadBegin()) {
+            PrependElements(other);
+            return;
+        }
+        if (position != 0 and
+            (other.size_ == other.data_proxy_.GetTailSize() or head_end == kBlockSize)) {
+            // The tail block of other goes in front of our head block
+            std::span<T> tail = other.data_proxy_.GetSegment(other.GetSegmentsCount() - 1);
+            auto last = GetMovingBegin(tail) + tail.size();
+            data_proxy_.PushFrontRange(last, tail.size());
+            size_ += tail.size();
+            other.PopBackN(tail.size());
+        } else if (position != 0) {
+            // Our only block does not reach its end, so it can not be followed by other
+            // blocks and its elements continue the tail block of other instead
+            std::span<T> head = data_proxy_.GetSegment(0);
+            auto first = GetMovingBegin(head);
+            other.data_proxy_.PushBackRange(first, head.size());
+            other.size_ += head.size();
+            PopFrontN(head.size());
+        }
+    }
+    if (other.size_ != 0) {
+        size_ += other.size_;
+        other.data_proxy_.MoveHeadDataBlocksTo(other.data_proxy_.GetUsedBlocksCount(),
+                                               data_proxy_);
+        other.size_ = 0;
+    }
+    UpdatePeakSize();
+}
+
+template<class T, size_t BlockBytes>
+Deque<T, BlockBytes> Deque<T, BlockBytes>::SplitAt(size_t index) {
+    Deque back(GetStorage(), GetMemoryResource());
+    if (index == size_) {
+        return back;
+    }
+    if (!data_proxy_.CanMoveDataBlocksTo(back.data_proxy_)) {
+        back.PushBackRange(std::ranges::subrange(std::make_move_iterator(begin() + index),
+                                                 std::make_move_iterator(end())));
+        PopBackN(size_ - index);
+        return back;
+    }
+    data_proxy_.Unshare();
+    std::span<T> split = data_proxy_.GetSegmentByIndex(index);
+    size_t offset = &data_proxy_.GetElementByIndex(index) - split.data();
+    size_t count = split.size() - offset;
+    size_t after = size_ - index - count;
+    // Every block after the split one but the tail is full, and the tail starts at 0
+    size_t blocks = after == 0 ? 0 : CircularBuffer<T, kBlockSize>::GetBlocksCount(after);
+    if (offset == 0) {
+        ++blocks;
+    } else {
+        // The elements keep their positions in the first block of back
+        auto last = GetMovingBegin(split) + split.size();
+        back.data_proxy_.ResetDataBlock(kBlockSize);
+        back.data_proxy_.PushFrontRange(last, count);
+    }
+    data_proxy_.MoveTailDataBlocksTo(blocks, back.data_proxy_);
+    if (offset != 0) {
+        // The split block is the tail block now
+        data_proxy_.PopBackN(count);
+    }
+    back.size_ = size_ - index;
+    back.UpdatePeakSize();
+    size_ = index;
+    return back;
+}
+
+template<class T, size_t BlockBytes>
+template<class... Args>
+T &Deque<T, BlockBytes>::Emplace(size_t index, Args &&...args) {
+    if (index == size_) {
+        return EmplaceBack(std::forward<Args>(args)...);
+    }
+    if (index == 0) {
+        return EmplaceFront(std::forward<Args>(args)...);
+    }
+    // args may refer to an element that is about to move
+    T value(std::forward<Args>(args)...);
+    InsertValues(index, std::make_move_iterator(&value), 1);
+    return (*this)[index];
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Insert(size_t index, const T &value) {
+    Emplace(index, value);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Insert(size_t index, T &&value) {
+    Emplace(index, std::move(value));
+}
+
+template<class T, size_t BlockBytes>
+template<std::ranges::input_range R>
+void Deque<T, BlockBytes>::InsertRange(size_t index, R &&range) {
+    if constexpr (std::ranges::forward_range<R> and std::ranges::sized_range<R>) {
+        InsertValues(index, GetRangeBegin(range), std::ranges::size(range));
+    } else {
+        // The values are read out of order, so a single pass range is collected first
+        Deque values(GetMemoryResource());
+        values.PushBackRange(std::forward<R>(range));
+        InsertValues(index, std::make_move_iterator(values.begin()), values.Size());
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Erase(size_t index, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    data_proxy_.Unshare();
+    size_t after = size_ - index - count;
+    if (index < after) {
+        MoveElements(0, count, index);
+        PopFrontN(count);
+    } else {
+        MoveElements(index + count, index, after);
+        PopBackN(count);
+    }
+}
+
+template<class T, size_t BlockBytes>
+template<class It>
+void Deque<T, BlockBytes>::InsertValues(size_t index, It first, size_t count) {
+    size_t before = index;
+    size_t after = size_ - index;
+    if (count == 0) {
+        return;
+    }
+    data_proxy_.Unshare();
+    if (after <= before) {
+        if (count <= after) {
+            // The last count elements move to new places at the back, the rest of the
+            // elements after index move by count inside the deque
+            PushBackMoved(size_ - count, count);
+            MoveElements(index, index + count, after - count);
+            AssignValues(index, first, count);
+        } else {
+            It middle = std::next(first, after);
+            PushBackRange(std::ranges::subrange(middle, std::next(middle, count - after)));
+            PushBackMoved(index, after);
+            AssignValues(index, first, after);
+        }
+    } else {
+        if (count <= before) {
+            PushFrontMoved(0, count);
+            MoveElements(2 * count, count, before - count);
+            AssignValues(index, first, count);
+        } else {
+            It middle = std::next(first, count - before);
+            PushFrontRange(std::ranges::subrange(first, middle));
+            PushFrontMoved(count - before, before);
+            AssignValues(count, middle, before);
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+std::span<T> Deque<T, BlockBytes>::GetSegmentFrom(size_t index, size_t count) {
+    std::span<T> segment = data_proxy_.GetSegmentByIndex(index);
+    T *first = &data_proxy_.GetElementByIndex(index);
+    size_t room = segment.data() + segment.size() - first;
+    return std::span<T>(first, std::min(count, room));
+}
+
+template<class T, size_t BlockBytes>
+std::span<T> Deque<T, BlockBytes>::GetSegmentBefore(size_t end, size_t count) {
+    std::span<T> segment = data_proxy_.GetSegmentByIndex(end - 1);
+    T *last = &data_proxy_.GetElementByIndex(end - 1) + 1;
+    size_t size = std::min<size_t>(count, last - segment.data());
+    return std::span<T>(last - size, size);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushBackMoved(size_t index, size_t count) {
+    // Pushing to the back keeps the indices and the blocks of the elements
+    while (count > 0) {
+        std::span<T> segment = GetSegmentFrom(index, count);
+        PushBackRange(GetMovingRange(segment));
+        index += segment.size();
+        count -= segment.size();
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PushFrontMoved(size_t index, size_t count) {
+    // Every push shifts the indices by the pushed count, which leaves the end of the
+    // elements still to push where it was
+    size_t end = index + count;
+    while (count > 0) {
+        std::span<T> segment = GetSegmentBefore(end, count);
+        PushFrontRange(GetMovingRange(segment));
+        count -= segment.size();
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::MoveElements(size_t from, size_t to, size_t count) {
+    if (count == 0 or from == to) {
+        return;
+    }
+    // A segment is looked up again only once it is used up
+    if (from > to) {
+        std::span<T> target = GetSegmentFrom(to, count);
+        std::span<T> source = GetSegmentFrom(from, count);
+        while (true) {
+            size_t chunk = std::min(source.size(), target.size());
+            if constexpr (std::is_trivially_copyable_v<T>) {
+                std::memmove(target.data(), source.data(), chunk * sizeof(T));
+            } else {
+                std::move(source.begin(), source.begin() + chunk, target.begin());
+            }
+            if ((count -= chunk) == 0) {
+                break;
+            }
+            from += chunk;
+            to += chunk;
+            source = source.size() == chunk ? GetSegmentFrom(from, count) : source.subspan(chunk);
+            target = target.size() == chunk ? GetSegmentFrom(to, count) : target.subspan(chunk);
+        }
+    } else {
+        std::span<T> target = GetSegmentBefore(to + count, count);
+        std::span<T> source = GetSegmentBefore(from + count, count);
+        while (true) {
+            size_t chunk = std::min(source.size(), target.size());
+            if constexpr (std::is_trivially_copyable_v<T>) {
+                std::memmove(target.data() + target.size() - chunk,
+                             source.data() + source.size() - chunk, chunk * sizeof(T));
+            } else {
+                std::move_backward(source.end() - chunk, source.end(), target.end());
+            }
+            if ((count -= chunk) == 0) {
+                break;
+            }
+            source = source.size() == chunk ? GetSegmentBefore(from + count, count)
+                                            : source.first(source.size() - chunk);
+            target = target.size() == chunk ? GetSegmentBefore(to + count, count)
+                                            : target.first(target.size() - chunk);
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+template<class It>
+void Deque<T, BlockBytes>::AssignValues(size_t index, It first, size_t count) {
+    while (count > 0) {
+        std::span<T> segment = GetSegmentFrom(index, count);
+        It last = std::next(first, segment.size());
+        std::copy(first, last, segment.begin());
+        first = last;
+        index += segment.size();
+        count -= segment.size();
+    }
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::AppendElements(Deque &other) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        std::as_const(other).ForEachSegment([this](std::span<const T> segment) {
+            PushBackRange(segment);
+        });
+    } else {
+        PushBackRange(std::ranges::subrange(std::make_move_iterator(other.begin()),
+                                            std::make_move_iterator(other.end())));
+    }
+    other.Clear();
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::PrependElements(Deque &other) {
+    PushFrontRange(std::ranges::subrange(std::make_move_iterator(other.begin()),
+                                         std::make_move_iterator(other.end())));
+    other.Clear();
+}
+
+template<class T, size_t BlockBytes>
+T &Deque<T, BlockBytes>::operator[](size_t ind) {
+    return data_proxy_.GetElementByIndex(ind);
+}
+
+template<class T, size_t BlockBytes>
+const T &Deque<T, BlockBytes>::operator[](size_t ind) const {
+    return data_proxy_.GetElementByIndex(ind);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::iterator Deque<T, BlockBytes>::begin() {
+    data_proxy_.Unshare();
+    return iterator(&data_proxy_, size_, 0);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::iterator Deque<T, BlockBytes>::end() {
+    data_proxy_.Unshare();
+    return iterator(&data_proxy_, size_, size_);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::const_iterator Deque<T, BlockBytes>::begin() const {
+    return const_iterator(&data_proxy_, size_, 0);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::const_iterator Deque<T, BlockBytes>::end() const {
+    return const_iterator(&data_proxy_, size_, size_);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::const_iterator Deque<T, BlockBytes>::cbegin() const {
+    return begin();
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::const_iterator Deque<T, BlockBytes>::cend() const {
+    return end();
+}
+
+template<class T, size_t BlockBytes>
+template<class Fn>
+void Deque<T, BlockBytes>::ForEachSegment(Fn &&fn) {
+    data_proxy_.Unshare();
+    data_proxy_.ForEachSegment([&fn](std::span<T> segment) {
+        if (!segment.empty()) {
+            fn(segment);
+        }
+    });
+}
+
+template<class T, size_t BlockBytes>
+template<class Fn>
+void Deque<T, BlockBytes>::ForEachSegment(Fn &&fn) const {
+    data_proxy_.ForEachSegment([&fn](std::span<const T> segment) {
+        if (!segment.empty()) {
+            fn(segment);
+        }
+    });
+}
+
+template<class T, size_t BlockBytes>
+size_t Deque<T, BlockBytes>::GetSegmentsCount() const {
+    return size_ == 0 ? 0 : data_proxy_.GetUsedBlocksCount();
+}
+
+template<class T, size_t BlockBytes>
+std::span<T> Deque<T, BlockBytes>::GetSegment(size_t segment) {
+    data_proxy_.Unshare();
+    return data_proxy_.GetSegment(segment);
+}
+
+template<class T, size_t BlockBytes>
+std::span<const T> Deque<T, BlockBytes>::GetSegment(size_t segment) const {
+    return data_proxy_.GetSegment(segment);
+}
+
+template<class T, size_t BlockBytes>
+auto Deque<T, BlockBytes>::Segments() {
+    return std::views::iota(size_t{0}, GetSegmentsCount()) |
+           std::views::transform([this](size_t segment) { return GetSegment(segment); });
+}
+
+template<class T, size_t BlockBytes>
+auto Deque<T, BlockBytes>::Segments() const {
+    return std::views::iota(size_t{0}, GetSegmentsCount()) |
+           std::views::transform([this](size_t segment) { return GetSegment(segment); });
+}
+
+template<class T, size_t BlockBytes>
+std::span<T> Deque<T, BlockBytes>::Linearize(std::span<T> out) const {
+    T *position = out.data();
+    ForEachSegment([&position](std::span<const T> segment) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            std::memcpy(position, segment.data(), segment.size_bytes());
+        } else {
+            std::ranges::copy(segment, position);
+        }
+        position += segment.size();
+    });
+    return out.first(size_);
+}
+
+template<class T, size_t BlockBytes>
+std::span<const T> Deque<T, BlockBytes>::AsContiguous(std::span<T> buffer) const {
+    if (GetSegmentsCount() == 1) {
+        return GetSegment(0);
+    }
+    return Linearize(buffer);
+}
+
+template<class T, size_t BlockBytes>
+size_t Deque<T, BlockBytes>::GetImageSize() const {
+    return kImageBlocksOffset + GetSegmentsCount() * sizeof(DataBlock);
+}
+
+template<class T, size_t BlockBytes>
+template<class Sink>
+void Deque<T, BlockBytes>::WriteImage(Sink &&sink) const {
+    static_assert(std::is_trivially_copyable_v<T>);
+    DequeImageHeader header;
+    header.element_size = sizeof(T);
+    header.block_size = kBlockSize;
+    header.block_bytes = sizeof(DataBlock);
+    header.size = size_;
+    header.blocks = GetSegmentsCount();
+    if (size_ != 0) {
+        header.head_begin = data_proxy_.GetHeadBegin();
+        header.tail_end = data_proxy_.GetTailEnd();
+    }
+    std::byte header_image[kImageBlocksOffset] = {};
+    std::memcpy(header_image, &header, sizeof(header));
+    sink(std::span<const std::byte>(header_image));
+
+    std::pmr::memory_resource *resource = GetMemoryResource();
+    void *image = resource->allocate(sizeof(DataBlock), alignof(DataBlock));
+    try {
+        // The elements go where they are in their block, the free slots are zeroed
+        for (size_t i = 0; i < header.blocks; ++i) {
+            std::span<const T> segment = data_proxy_.GetSegment(i);
+            size_t position = i == 0 ? header.head_begin : 0;
+            std::memset(image, 0, sizeof(DataBlock));
+            std::memcpy(static_cast<T *>(image) + position, segment.data(), segment.size_bytes());
+            sink(std::span<const std::byte>(static_cast<std::byte *>(image), sizeof(DataBlock)));
+        }
+    } catch (...) {
+        resource->deallocate(image, sizeof(DataBlock), alignof(DataBlock));
+        throw;
+    }
+    resource->deallocate(image, sizeof(DataBlock), alignof(DataBlock));
+}
+
+template<class T, size_t BlockBytes>
+bool Deque<T, BlockBytes>::ReadImage(std::span<const std::byte> image, ExternalBlocks *external) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (image.size() < kImageBlocksOffset or
+        reinterpret_cast<uintptr_t>(image.data()) % alignof(DataBlock) != 0) {
+        return false;
+    }
+    DequeImageHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (header.magic != DequeImageHeader::kMagic or
+        header.version != DequeImageHeader::kVersion or header.element_size != sizeof(T) or
+        header.block_size != kBlockSize or header.block_bytes != sizeof(DataBlock) or
+        header.blocks > (image.size() - kImageBlocksOffset) / sizeof(DataBlock)) {
+        return false;
+    }
+    std::byte *first = const_cast<std::byte *>(image.data()) + kImageBlocksOffset;
+    auto *blocks = reinterpret_cast<DataBlock *>(first);
+    // The blocks have to be laid out like in a deque: none is empty, only the first one may
+    // start after position 0 and only the last one may end before kBlockSize
+    size_t size = 0;
+    if (header.blocks != 0) {
+        bool is_laid_out = header.head_begin < kBlockSize and header.tail_end > 0 and
+                           header.tail_end <= kBlockSize and
+                           (header.blocks > 1 or header.head_begin < header.tail_end);
+        if (!is_laid_out) {
+            return false;
+        }
+        size = header.blocks * kBlockSize - header.head_begin - (kBlockSize - header.tail_end);
+    }
+    if (size != header.size) {
+        return false;
+    }
+    Deque loaded(GetStorage(), GetMemoryResource());
+    loaded.data_proxy_.LoadDataBlocks(blocks, header.blocks, header.head_begin, header.tail_end,
+                                      external);
+    loaded.size_ = size;
+    loaded.UpdatePeakSize();
+    Swap(loaded);
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+size_t Deque<T, BlockBytes>::Size() const {
+    return size_;
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Clear() {
     data_proxy_.Clear();
     size_ = 0;
 }
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::Reserve(size_t count) {
+    data_proxy_.ReserveBlocks(GetExtraBlocksCount(count, GetBackRoom()));
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::ReserveFront(size_t count) {
+    data_proxy_.ReserveBlocks(GetExtraBlocksCount(count, GetFrontRoom()));
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::SetBlockPoolMaxSize(size_t max_size) {
+    data_proxy_.SetBlockPoolMaxSize(max_size);
+}
+
+template<class T, size_t BlockBytes>
+void Deque<T, BlockBytes>::ShrinkToFit() {
+    data_proxy_.ShrinkToFit();
+}
+
+template<class T, size_t BlockBytes>
+std::pmr::memory_resource *Deque<T, BlockBytes>::GetMemoryResource() const {
+    return data_proxy_.GetMemoryResource();
+}
+
+template<class T, size_t BlockBytes>
+BlockStorage Deque<T, BlockBytes>::GetStorage() const {
+    return data_proxy_.GetStorage();
+}
+
+template<class T, size_t BlockBytes>
+DequeStats Deque<T, BlockBytes>::Stats() const {
+    DequeStats stats = data_proxy_.GetStats();
+    stats.size = size_;
+    stats.peak_size = std::max(stats.peak_size, size_);
+    stats.head_slack = GetFrontRoom();
+    stats.tail_slack = GetBackRoom();
+    return stats;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "deque.h"
+
+// Vectored I/O straight from the blocks of a Deque, without a staging buffer. Every segment of
+// the deque becomes one iovec entry, so writev, sendmsg and the like read the elements where
+// they are. Only trivially copyable elements have a byte representation worth writing out.
+//
+// SaveTo and LoadFrom keep a deque in a file as its image (see Deque::WriteImage). Loading
+// maps the file and by default uses the blocks right in the mapping, so it costs a check of
+// every block instead of a push of every element.
+
+namespace deque_io {
+
+// Entries passed to a single writev call
+#ifdef IOV_MAX
+constexpr size_t kMaxIoVectors = std::min<size_t>(IOV_MAX, 256);
+#else
+constexpr size_t kMaxIoVectors = 16;
+#endif
+
+// Describes the segments of deque from first_segment on in out, as many as fit. Returns the
+// number of entries filled
+template<class T, size_t BlockBytes>
+size_t GetIoVectors(const Deque<T, BlockBytes> &deque, std::span<iovec> out,
+                    size_t first_segment = 0) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    size_t count = std::min(out.size(), deque.GetSegmentsCount() - first_segment);
+    for (size_t i = 0; i < count; ++i) {
+        std::span<const T> segment = deque.GetSegment(first_segment + i);
+        // iovec is shared with readv, the bytes are only read here
+        out[i].iov_base = const_cast<T *>(segment.data());
+        out[i].iov_len = segment.size_bytes();
+    }
+    return count;
+}
+
+// Writes the bytes of all the elements to fd, kMaxIoVectors segments per writev call and
+// resuming after short writes. Returns the number of bytes written, or -1 with errno set by
+// the failed call
+template<class T, size_t BlockBytes>
+ssize_t WriteTo(int fd, const Deque<T, BlockBytes> &deque) {
+    iovec vectors[kMaxIoVectors];
+    size_t segments = deque.GetSegmentsCount();
+    size_t segment = 0;
+    // Bytes of the current segment that are already written
+    size_t skipped = 0;
+    size_t written = 0;
+    while (segment < segments) {
+        size_t count = GetIoVectors(deque, vectors, segment);
+        vectors[0].iov_base = static_cast<std::byte *>(vectors[0].iov_base) + skipped;
+        vectors[0].iov_len -= skipped;
+        ssize_t result = writev(fd, vectors, static_cast<int>(count));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += result;
+        size_t bytes = result;
+        size_t done = 0;
+        for (; done < count and bytes >= vectors[done].iov_len; ++done) {
+            bytes -= vectors[done].iov_len;
+        }
+        skipped = done == 0 ? skipped + bytes : bytes;
+        segment += done;
+    }
+    return written;
+}
+
+enum class LoadMode {
+    // Maps the file copy-on-write and uses its blocks where they are, so a page is copied by
+    // the kernel the first time the deque writes to it. The deque keeps the mapping until it
+    // holds none of its blocks, so the file must not change meanwhile. Copies of the deque
+    // copy the blocks
+    kMap,
+    // Copies all blocks out of the mapping, which is gone once LoadFrom returns
+    kCopy,
+};
+
+namespace detail {
+
+// Bytes gathered before a write call when saving
+constexpr size_t kSaveBufferBytes = 1 << 16;
+
+struct MappedFile : ExternalBlocks {
+    static void Unmap(ExternalBlocks *blocks) {
+        auto *file = static_cast<MappedFile *>(blocks);
+        munmap(const_cast<std::byte *>(file->begin), file->end - file->begin);
+        delete file;
+    }
+};
+
+// Writes all of bytes, resuming after short writes
+inline bool WriteAll(int fd, const std::byte *bytes, size_t count) {
+    while (count > 0) {
+        ssize_t result = write(fd, bytes, count);
+        if (result < 0 and errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            return false;
+        }
+        bytes += result;
+        count -= result;
+    }
+    return true;
+}
+
+}  // namespace detail
+
+// Saves the image of deque to the file at path, which is created or truncated. Returns false
+// with errno set by the failed call
+template<class T, size_t BlockBytes>
+bool SaveTo(const char *path, const Deque<T, BlockBytes> &deque) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    auto buffer = std::make_unique<std::byte[]>(detail::kSaveBufferBytes);
+    size_t used = 0;
+    bool is_written = true;
+    deque.WriteImage([&](std::span<const std::byte> piece) {
+        if (used + piece.size() > detail::kSaveBufferBytes) {
+            is_written = is_written and detail::WriteAll(fd, buffer.get(), used);
+            used = 0;
+        }
+        if (piece.size() > detail::kSaveBufferBytes) {
+            is_written = is_written and detail::WriteAll(fd, piece.data(), piece.size());
+        } else {
+            std::copy(piece.begin(), piece.end(), buffer.get() + used);
+            used += piece.size();
+        }
+    });
+    is_written = is_written and detail::WriteAll(fd, buffer.get(), used);
+    int error = errno;
+    if (close(fd) != 0 and is_written) {
+        return false;
+    }
+    errno = error;
+    return is_written;
+}
+
+// Replaces the elements of deque with those saved in the file at path. Returns false with
+// errno set by the failed call, or to EINVAL when the file does not hold the image of a deque
+// like this one. The deque keeps its elements then
+template<class T, size_t BlockBytes>
+bool LoadFrom(const char *path, Deque<T, BlockBytes> &deque, LoadMode mode = LoadMode::kMap) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+    if (status.st_size == 0) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    size_t length = status.st_size;
+    void *address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (address == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    auto *file = new detail::MappedFile;
+    file->begin = static_cast<const std::byte *>(address);
+    file->end = file->begin + length;
+    file->release = &detail::MappedFile::Unmap;
+    bool is_loaded = deque.ReadImage(std::span<const std::byte>(file->begin, length),
+                                     mode == LoadMode::kMap ? file : nullptr);
+    // The deque is a user of the mapping now if it took blocks from it
+    file->DropUser();
+    if (!is_loaded) {
+        errno = EINVAL;
+    }
+    return is_loaded;
+}
+
+}  // namespace deque_io
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "deque.h"
+
+// Parallel algorithms over a Deque. The elements are split into runs of whole blocks and every
+// run is a task for a shared pool of threads. Blocks start on a cache line and are allocated
+// apart, so threads working on different runs never write to the same cache line.
+//
+// The algorithms take a standard execution policy. With std::execution::par and par_unseq the
+// runs are spread over the pool, with seq and unseq they run one after another on the calling
+// thread. The unsequenced policies also let the loop over a block be vectorized. Like the
+// standard parallel algorithms, an exception escaping an element function calls
+// std::terminate with every policy, seq included. What the algorithms do before calling them,
+// allocating and copying the blocks a deque lends to snapshots, may still throw.
+
+namespace deque_parallel {
+
+template<class ExecutionPolicy>
+concept ExecutionPolicyType = std::is_execution_policy_v<std::remove_cvref_t<ExecutionPolicy>>;
+
+// Shorter runs are not worth a task of their own
+constexpr size_t kMinRunBlocks = 16;
+
+// More runs than threads let the threads that are done early take over the remaining work
+constexpr size_t kRunsPerThread = 4;
+
+namespace detail {
+
+template<class ExecutionPolicy>
+constexpr bool kIsParallel =
+        std::is_same_v<std::remove_cvref_t<ExecutionPolicy>, std::execution::parallel_policy> or
+        std::is_same_v<std::remove_cvref_t<ExecutionPolicy>,
+                       std::execution::parallel_unsequenced_policy>;
+
+template<class ExecutionPolicy>
+constexpr bool kIsUnsequenced =
+        std::is_same_v<std::remove_cvref_t<ExecutionPolicy>,
+                       std::execution::unsequenced_policy> or
+        std::is_same_v<std::remove_cvref_t<ExecutionPolicy>,
+                       std::execution::parallel_unsequenced_policy>;
+
+// Policy for the loop over a single block. The standard algorithms of libstdc++ 12 only take
+// policies that are lvalues
+template<class ExecutionPolicy>
+constexpr const auto &GetSegmentPolicy() {
+    if constexpr (kIsUnsequenced<ExecutionPolicy>) {
+        return std::execution::unseq;
+    } else {
+        return std::execution::seq;
+    }
+}
+
+// Worker threads that run the tasks of one job at a time together with the thread that
+// submitted it
+class ThreadPool {
+public:
+    // Shared by all algorithms, started on first use. It has a worker even on a single core,
+    // so that the parallel paths are exercised everywhere
+    static ThreadPool &Get() {
+        static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+    explicit ThreadPool(size_t workers_count);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    // Threads that work on a job, the one that submitted it included
+    size_t GetThreadsCount() const {
+        return workers_count_ + 1;
+    }
+
+    // Calls task(i) for every i in [0, count) and returns once all the calls are done. Jobs
+    // submitted by different threads run one after another, so a task must not submit one
+    template<class Task>
+    void Run(size_t count, Task &task);
+
+private:
+    struct Job {
+        void (*run)(void *task, size_t index) = nullptr;
+        void *task = nullptr;
+        size_t count = 0;
+    };
+
+    size_t workers_count_;
+    std::unique_ptr<std::thread[]> workers_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    Job job_;
+    size_t generation_ = 0;
+    // Workers that took the current job and are not done with it
+    size_t busy_ = 0;
+    bool stop_ = false;
+    std::atomic<size_t> next_ = 0;
+
+    void Work();
+
+    // Takes tasks of job until none are left
+    void RunTasks(const Job &job) noexcept;
+};
+
+inline ThreadPool::ThreadPool(size_t workers_count)
+    : workers_count_(workers_count), workers_(std::make_unique<std::thread[]>(workers_count)) {
+    for (size_t i = 0; i < workers_count_; ++i) {
+        workers_[i] = std::thread([this] { Work(); });
+    }
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_count_; ++i) {
+        workers_[i].join();
+    }
+}
+
+template<class Task>
+void ThreadPool::Run(size_t count, Task &task) {
+    Job job{[](void *task, size_t index) { (*static_cast<Task *>(task))(index); }, &task, count};
+    std::lock_guard run_lock(run_mutex_);
+    {
+        std::unique_lock lock(mutex_);
+        // A worker that woke up late may still be looking for tasks of the previous job
+        done_.wait(lock, [this] { return busy_ == 0; });
+        job_ = job;
+        next_.store(0, std::memory_order_relaxed);
+        ++generation_;
+    }
+    wake_.notify_all();
+    RunTasks(job);
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+}
+
+inline void ThreadPool::Work() {
+    size_t seen = 0;
+    std::unique_lock lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this, &seen] { return stop_ or generation_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = generation_;
+        Job job = job_;
+        ++busy_;
+        lock.unlock();
+        RunTasks(job);
+        lock.lock();
+        if (--busy_ == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+inline void ThreadPool::RunTasks(const Job &job) noexcept {
+    for (size_t index; (index = next_.fetch_add(1, std::memory_order_relaxed)) < job.count;) {
+        job.run(job.task, index);
+    }
+}
+
+template<class ExecutionPolicy>
+size_t GetRunsCount(size_t segments) {
+    if constexpr (!kIsParallel<ExecutionPolicy>) {
+        return std::min<size_t>(segments, 1);
+    } else {
+        size_t max_runs = ThreadPool::Get().GetThreadsCount() * kRunsPerThread;
+        return std::min(max_runs, (segments + kMinRunBlocks - 1) / kMinRunBlocks);
+    }
+}
+
+// First segment of a run, runs differ in length by at most one segment
+inline size_t GetRunStart(size_t run, size_t runs, size_t segments) {
+    return segments * run / runs;
+}
+
+// Index of the first element of a segment or Size() past the last one. Every segment but the
+// first and the last is a full block
+template<class T, size_t BlockBytes>
+size_t GetSegmentStart(const Deque<T, BlockBytes> &deque, size_t segment) {
+    if (segment == 0) {
+        return 0;
+    }
+    size_t start = deque.GetSegment(0).size() +
+                   (segment - 1) * deque_settings::kBlockSize<T, BlockBytes>;
+    return std::min(start, deque.Size());
+}
+
+// Element functions are only called from here, so an exception escaping one of them ends in
+// std::terminate whether the tasks run on the pool or on the calling thread
+template<class ExecutionPolicy, class Task>
+void RunTasks(size_t count, Task task) noexcept {
+    if (kIsParallel<ExecutionPolicy> and count > 1) {
+        ThreadPool::Get().Run(count, task);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        task(i);
+    }
+}
+
+// Calls fn(run, first, last) for the segments [first, last) of every run
+template<class ExecutionPolicy, class Fn>
+void ForEachRun(size_t segments, size_t runs, Fn fn) {
+    RunTasks<ExecutionPolicy>(runs, [&](size_t run) {
+        fn(run, GetRunStart(run, runs, segments), GetRunStart(run + 1, runs, segments));
+    });
+}
+
+// Copies the blocks lent to snapshots of the deque up front, so that the threads only read
+// the block map
+template<class T, size_t BlockBytes>
+void OwnBlocks(Deque<T, BlockBytes> &deque) {
+    deque.Unshare();
+}
+
+// Keeps the partial results of different threads on different cache lines
+template<class V>
+struct alignas(deque_settings::kCacheLineSize) Padded {
+    V value;
+};
+
+}  // namespace detail
+
+// Calls fn for every element, possibly concurrently and in any order
+template<ExecutionPolicyType ExecutionPolicy, class T, size_t BlockBytes, class Fn>
+void ForEach(ExecutionPolicy &&, Deque<T, BlockBytes> &deque, Fn fn) {
+    detail::OwnBlocks(deque);
+    size_t segments = deque.GetSegmentsCount();
+    size_t runs = detail::GetRunsCount<ExecutionPolicy>(segments);
+    detail::ForEachRun<ExecutionPolicy>(segments, runs, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            std::span<T> segment = deque.GetSegment(i);
+            std::for_each(detail::GetSegmentPolicy<ExecutionPolicy>(), segment.begin(),
+                          segment.end(), fn);
+        }
+    });
+}
+
+template<ExecutionPolicyType ExecutionPolicy, class T, size_t BlockBytes, class Fn>
+void ForEach(ExecutionPolicy &&, const Deque<T, BlockBytes> &deque, Fn fn) {
+    size_t segments = deque.GetSegmentsCount();
+    size_t runs = detail::GetRunsCount<ExecutionPolicy>(segments);
+    detail::ForEachRun<ExecutionPolicy>(segments, runs, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            std::span<const T> segment = deque.GetSegment(i);
+            std::for_each(detail::GetSegmentPolicy<ExecutionPolicy>(), segment.begin(),
+                          segment.end(), fn);
+        }
+    });
+}
+
+// Replaces every element x with fn(x)
+template<ExecutionPolicyType ExecutionPolicy, class T, size_t BlockBytes, class Fn>
+void Transform(ExecutionPolicy &&, Deque<T, BlockBytes> &deque, Fn fn) {
+    detail::OwnBlocks(deque);
+    size_t segments = deque.GetSegmentsCount();
+    size_t runs = detail::GetRunsCount<ExecutionPolicy>(segments);
+    detail::ForEachRun<ExecutionPolicy>(segments, runs, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            std::span<T> segment = deque.GetSegment(i);
+            std::transform(detail::GetSegmentPolicy<ExecutionPolicy>(), segment.begin(),
+                           segment.end(), segment.begin(), fn);
+        }
+    });
+}
+
+// Combines init and all elements with op in an unspecified order and grouping, so op has to be
+// associative and commutative as for std::reduce. U has to be constructible from T
+template<ExecutionPolicyType ExecutionPolicy, class T, size_t BlockBytes, class U,
+         class BinaryOp = std::plus<>>
+U Reduce(ExecutionPolicy &&, const Deque<T, BlockBytes> &deque, U init, BinaryOp op = {}) {
+    size_t segments = deque.GetSegmentsCount();
+    size_t runs = detail::GetRunsCount<ExecutionPolicy>(segments);
+    auto partials = std::make_unique<detail::Padded<std::optional<U>>[]>(runs);
+    detail::ForEachRun<ExecutionPolicy>(segments, runs, [&](size_t run, size_t first,
+                                                            size_t last) {
+        // Segments are never empty, a run starts from its first element
+        U partial(deque.GetSegment(first)[0]);
+        for (size_t i = first; i < last; ++i) {
+            std::span<const T> segment = deque.GetSegment(i);
+            partial = std::reduce(detail::GetSegmentPolicy<ExecutionPolicy>(),
+                                  segment.begin() + (i == first ? 1 : 0), segment.end(),
+                                  std::move(partial), op);
+        }
+        partials[run].value.emplace(std::move(partial));
+    });
+    detail::RunTasks<std::execution::sequenced_policy>(1, [&](size_t) {
+        for (size_t run = 0; run < runs; ++run) {
+            init = op(std::move(init), std::move(*partials[run].value));
+        }
+    });
+    return init;
+}
+
+// Sorts every run on its own and then merges neighbouring runs pairwise, a level of merges at
+// a time. The last level is a single merge of the whole deque on one thread. Not stable
+template<ExecutionPolicyType ExecutionPolicy, class T, size_t BlockBytes,
+         class Compare = std::less<>>
+void Sort(ExecutionPolicy &&, Deque<T, BlockBytes> &deque, Compare comp = {}) {
+    detail::OwnBlocks(deque);
+    size_t segments = deque.GetSegmentsCount();
+    size_t runs = detail::GetRunsCount<ExecutionPolicy>(segments);
+    auto get_run_begin = [&](size_t run) {
+        size_t segment = detail::GetRunStart(run, runs, segments);
+        return deque.begin() + detail::GetSegmentStart(std::as_const(deque), segment);
+    };
+    detail::RunTasks<ExecutionPolicy>(runs, [&](size_t run) {
+        std::sort(get_run_begin(run), get_run_begin(run + 1), comp);
+    });
+    for (size_t width = 1; width < runs; width *= 2) {
+        size_t merges = (runs + 2 * width - 1) / (2 * width);
+        detail::RunTasks<ExecutionPolicy>(merges, [&](size_t merge) {
+            size_t first = merge * 2 * width;
+            size_t middle = std::min(first + width, runs);
+            size_t last = std::min(first + 2 * width, runs);
+            if (middle < last) {
+                std::inplace_merge(get_run_begin(first), get_run_begin(middle),
+                                   get_run_begin(last), comp);
+            }
+        });
+    }
+}
+
+}  // namespace deque_parallel
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Memory resource that places the memory of deques on huge pages and on a chosen NUMA node.
+// It maps 2 MiB aligned regions and hands out pieces of them, so it is meant as the resource
+// of a slab storage deque: the slab chunks of the deque then share a few huge pages, a scan
+// over its blocks stays within one TLB entry per 2 MiB, and all of them sit on the node that
+// reads them. The mappings are bound with the mbind system call, so no NUMA library is needed.
+//
+//     deque_placement::PageResource resource({deque_placement::PageKind::kHuge,
+//                                             deque_placement::kLocalNode});
+//     Deque<int> deque(BlockStorage::kSlab, &resource);
+
+namespace deque_placement {
+
+constexpr size_t kHugePageBytes = size_t{1} << 21;
+
+enum class PageKind {
+    // Whatever the kernel does by default
+    kRegular,
+    // Regions are aligned to and advised for transparent huge pages, which the kernel backs
+    // them with when it can (MADV_HUGEPAGE)
+    kTransparentHuge,
+    // Regions come from the reserved huge pages (MAP_HUGETLB), as transparent huge pages when
+    // none are left
+    kHuge,
+};
+
+// Values of Placement::node besides the node numbers themselves
+constexpr int kAnyNode = -1;
+// The node of the CPU the thread mapping a region runs on
+constexpr int kLocalNode = -2;
+
+struct Placement {
+    PageKind pages = PageKind::kTransparentHuge;
+    // Pages of the regions are taken from this node while it has free memory
+    int node = kAnyNode;
+};
+
+// NUMA node of the CPU the calling thread runs on, 0 when the kernel does not tell
+int GetCurrentNode();
+
+// Not thread safe, like std::pmr::unsynchronized_pool_resource. Memory is carved out of the
+// current region, and a region is unmapped once everything carved out of it is deallocated.
+// Freed pieces are not reused before that, which suits slab chunks and pooled blocks that live
+// as long as their deque. Allocations larger than a region get a mapping of their own. All
+// mappings are gone with the resource
+class PageResource : public std::pmr::memory_resource {
+public:
+    explicit PageResource(Placement placement = {});
+
+    PageResource(const PageResource &) = delete;
+
+    PageResource &operator=(const PageResource &) = delete;
+
+    ~PageResource() override;
+
+    Placement GetPlacement() const;
+
+    size_t GetMappedBytes() const;
+
+    // The part of GetMappedBytes() that got reserved huge pages
+    size_t GetHugeTlbBytes() const;
+
+private:
+    // Starts every mapping, so that the region of an address is found by rounding it down
+    struct Region {
+        Region *prev;
+        Region *next;
+        size_t bytes;
+        size_t used;
+        // Allocations not yet deallocated
+        size_t live;
+        bool is_huge_tlb;
+    };
+
+    static constexpr size_t kHeaderBytes =
+            (sizeof(Region) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) *
+            alignof(std::max_align_t);
+
+    Placement placement_;
+    // All mappings, the current region is one of them
+    Region *regions_ = nullptr;
+    Region *current_ = nullptr;
+    size_t mapped_bytes_ = 0;
+    size_t huge_tlb_bytes_ = 0;
+
+    static size_t AlignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+    // Maps bytes, a multiple of kHugePageBytes, at a kHugePageBytes aligned address
+    Region *MapRegion(size_t bytes);
+
+    void UnmapRegion(Region *region);
+
+    // Applies the node of placement_ to a new mapping, which is left as it is when the kernel
+    // refuses
+    void BindToNode(void *address, size_t bytes) const;
+};
+
+inline int GetCurrentNode() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+inline PageResource::PageResource(Placement placement) : placement_(placement) {
+}
+
+inline PageResource::~PageResource() {
+    while (regions_ != nullptr) {
+        UnmapRegion(regions_);
+    }
+}
+
+inline Placement PageResource::GetPlacement() const {
+    return placement_;
+}
+
+inline size_t PageResource::GetMappedBytes() const {
+    return mapped_bytes_;
+}
+
+inline size_t PageResource::GetHugeTlbBytes() const {
+    return huge_tlb_bytes_;
+}
+
+inline void *PageResource::do_allocate(size_t bytes, size_t alignment) {
+    // The first allocation of a region has to start within its first kHugePageBytes
+    if (alignment >= kHugePageBytes) {
+        throw std::bad_alloc();
+    }
+    if (current_ != nullptr) {
+        size_t offset = AlignUp(current_->used, alignment);
+        if (offset <= current_->bytes and bytes <= current_->bytes - offset) {
+            current_->used = offset + bytes;
+            ++current_->live;
+            return reinterpret_cast<std::byte *>(current_) + offset;
+        }
+    }
+    size_t offset = AlignUp(kHeaderBytes, alignment);
+    Region *region = MapRegion(AlignUp(offset + bytes, kHugePageBytes));
+    region->used = offset + bytes;
+    region->live = 1;
+    // Only a region of one huge page can be found from anywhere inside it
+    if (region->bytes == kHugePageBytes) {
+        current_ = region;
+    }
+    return reinterpret_cast<std::byte *>(region) + offset;
+}
+
+inline void PageResource::do_deallocate(void *p, size_t, size_t) {
+    auto *region = reinterpret_cast<Region *>(reinterpret_cast<uintptr_t>(p) &
+                                              ~(uintptr_t{kHugePageBytes} - 1));
+    if (--region->live > 0) {
+        return;
+    }
+    if (region == current_) {
+        region->used = kHeaderBytes;
+    } else {
+        UnmapRegion(region);
+    }
+}
+
+inline bool PageResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+inline PageResource::Region *PageResource::MapRegion(size_t bytes) {
+    void *address = MAP_FAILED;
+    bool is_huge_tlb = false;
+    if (placement_.pages == PageKind::kHuge) {
+        // Huge page mappings are aligned to the huge page size
+        address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        is_huge_tlb = address != MAP_FAILED;
+    }
+    if (address == MAP_FAILED) {
+        // Map a huge page more and trim the ends to get an aligned region
+        size_t span = bytes + kHugePageBytes;
+        void *raw = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                         0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        auto begin = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = AlignUp(begin, kHugePageBytes);
+        if (aligned > begin) {
+            munmap(raw, aligned - begin);
+        }
+        munmap(reinterpret_cast<void *>(aligned + bytes), begin + span - aligned - bytes);
+        address = reinterpret_cast<void *>(aligned);
+        if (placement_.pages != PageKind::kRegular) {
+            madvise(address, bytes, MADV_HUGEPAGE);
+        }
+    }
+    // Before the first touch, so that no page is faulted in elsewhere
+    BindToNode(address, bytes);
+    auto *region = new (address) Region{nullptr, regions_, bytes, kHeaderBytes, 0, is_huge_tlb};
+    if (regions_ != nullptr) {
+        regions_->prev = region;
+    }
+    regions_ = region;
+    mapped_bytes_ += bytes;
+    huge_tlb_bytes_ += is_huge_tlb ? bytes : 0;
+    return region;
+}
+
+inline void PageResource::UnmapRegion(Region *region) {
+    if (region->prev != nullptr) {
+        region->prev->next = region->next;
+    } else {
+        regions_ = region->next;
+    }
+    if (region->next != nullptr) {
+        region->next->prev = region->prev;
+    }
+    if (region == current_) {
+        current_ = nullptr;
+    }
+    mapped_bytes_ -= region->bytes;
+    huge_tlb_bytes_ -= region->is_huge_tlb ? region->bytes : 0;
+    munmap(region, region->bytes);
+}
+
+inline void PageResource::BindToNode(void *address, size_t bytes) const {
+    int node = placement_.node == kLocalNode ? GetCurrentNode() : placement_.node;
+    constexpr size_t kMaskBits = 1024;
+    constexpr size_t kWordBits = sizeof(unsigned long) * CHAR_BIT;
+    if (node < 0 or static_cast<size_t>(node) >= kMaskBits) {
+        return;
+    }
+    unsigned long mask[kMaskBits / kWordBits] = {};
+    mask[node / kWordBits] = 1UL << (node % kWordBits);
+    // The kernel reads one bit less than maxnode
+    syscall(SYS_mbind, address, bytes, MPOL_PREFERRED, mask, kMaskBits + 1, 0);
+}
+
+}  // namespace deque_placement
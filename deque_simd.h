@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "deque.h"
+
+// Bulk algorithms over a Deque that run block by block on its contiguous segments. Segments of
+// int32_t use AVX2 (picked at run time on x86) or NEON, other types and machines fall back
+// to plain loops the compiler is free to vectorize.
+
+#if (defined(__x86_64__) or defined(__i386__)) and (defined(__GNUC__) or defined(__clang__))
+#define DEQUE_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__aarch64__) and defined(__ARM_NEON)
+#define DEQUE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace deque_simd {
+
+// Integers are summed in 64 bits
+template<class T>
+using SumType = std::conditional_t<
+        std::is_integral_v<T>, std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>, T>;
+
+namespace detail {
+
+template<class T>
+constexpr bool kIsVectorized = std::is_same_v<T, int32_t>;
+
+#if DEQUE_SIMD_AVX2
+
+#define DEQUE_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+
+inline bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+// Number of leading elements to handle one by one before data + result is 32-byte aligned.
+// Every block but the first starts at aligned storage, so this is zero for them
+inline size_t GetUnalignedCount(const int32_t *data, size_t size) {
+    size_t misalignment = reinterpret_cast<uintptr_t>(data) % 32;
+    return std::min(size, misalignment == 0 ? 0 : (32 - misalignment) / sizeof(int32_t));
+}
+
+DEQUE_SIMD_TARGET_AVX2 inline int64_t SumAvx2(const int32_t *data, size_t size) {
+    size_t i = 0;
+    int64_t sum = 0;
+    for (size_t head = GetUnalignedCount(data, size); i < head; ++i) {
+        sum += data[i];
+    }
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i));
+        low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(values)));
+        high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(values, 1)));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(low, high));
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < size; ++i) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+DEQUE_SIMD_TARGET_AVX2 inline std::pair<int32_t, int32_t> MinMaxAvx2(const int32_t *data,
+                                                                      size_t size) {
+    size_t i = 0;
+    int32_t min = data[0];
+    int32_t max = data[0];
+    for (size_t head = GetUnalignedCount(data, size); i < head; ++i) {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+    __m256i min_lanes = _mm256_set1_epi32(min);
+    __m256i max_lanes = _mm256_set1_epi32(max);
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i));
+        min_lanes = _mm256_min_epi32(min_lanes, values);
+        max_lanes = _mm256_max_epi32(max_lanes, values);
+    }
+    alignas(32) int32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), min_lanes);
+    min = *std::min_element(lanes, lanes + 8);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), max_lanes);
+    max = *std::max_element(lanes, lanes + 8);
+    for (; i < size; ++i) {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+    return {min, max};
+}
+
+DEQUE_SIMD_TARGET_AVX2 inline size_t FindAvx2(const int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    for (size_t head = GetUnalignedCount(data, size); i < head; ++i) {
+        if (data[i] == value) {
+            return i;
+        }
+    }
+    __m256i needle = _mm256_set1_epi32(value);
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i));
+        auto mask = static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi32(values, needle)));
+        if (mask != 0) {
+            return i + std::countr_zero(mask) / sizeof(int32_t);
+        }
+    }
+    for (; i < size; ++i) {
+        if (data[i] == value) {
+            return i;
+        }
+    }
+    return size;
+}
+
+DEQUE_SIMD_TARGET_AVX2 inline size_t CountAvx2(const int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    size_t count = 0;
+    for (size_t head = GetUnalignedCount(data, size); i < head; ++i) {
+        count += data[i] == value;
+    }
+    __m256i needle = _mm256_set1_epi32(value);
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256 matches = _mm256_castsi256_ps(_mm256_cmpeq_epi32(values, needle));
+        count += std::popcount(static_cast<uint32_t>(_mm256_movemask_ps(matches)));
+    }
+    for (; i < size; ++i) {
+        count += data[i] == value;
+    }
+    return count;
+}
+
+DEQUE_SIMD_TARGET_AVX2 inline void FillAvx2(int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    for (size_t head = GetUnalignedCount(data, size); i < head; ++i) {
+        data[i] = value;
+    }
+    __m256i values = _mm256_set1_epi32(value);
+    for (; i + 8 <= size; i += 8) {
+        _mm256_store_si256(reinterpret_cast<__m256i *>(data + i), values);
+    }
+    for (; i < size; ++i) {
+        data[i] = value;
+    }
+}
+
+#undef DEQUE_SIMD_TARGET_AVX2
+
+#elif DEQUE_SIMD_NEON
+
+inline int64_t SumNeon(const int32_t *data, size_t size) {
+    size_t i = 0;
+    int64x2_t sum = vdupq_n_s64(0);
+    for (; i + 4 <= size; i += 4) {
+        sum = vpadalq_s32(sum, vld1q_s32(data + i));
+    }
+    int64_t result = vaddvq_s64(sum);
+    for (; i < size; ++i) {
+        result += data[i];
+    }
+    return result;
+}
+
+inline std::pair<int32_t, int32_t> MinMaxNeon(const int32_t *data, size_t size) {
+    size_t i = 0;
+    int32x4_t min_lanes = vdupq_n_s32(data[0]);
+    int32x4_t max_lanes = min_lanes;
+    for (; i + 4 <= size; i += 4) {
+        int32x4_t values = vld1q_s32(data + i);
+        min_lanes = vminq_s32(min_lanes, values);
+        max_lanes = vmaxq_s32(max_lanes, values);
+    }
+    int32_t min = vminvq_s32(min_lanes);
+    int32_t max = vmaxvq_s32(max_lanes);
+    for (; i < size; ++i) {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+    return {min, max};
+}
+
+inline size_t FindNeon(const int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    int32x4_t needle = vdupq_n_s32(value);
+    for (; i + 4 <= size; i += 4) {
+        if (vmaxvq_u32(vceqq_s32(vld1q_s32(data + i), needle)) != 0) {
+            break;
+        }
+    }
+    for (; i < size; ++i) {
+        if (data[i] == value) {
+            return i;
+        }
+    }
+    return size;
+}
+
+inline size_t CountNeon(const int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    int32x4_t needle = vdupq_n_s32(value);
+    uint64x2_t count = vdupq_n_u64(0);
+    for (; i + 4 <= size; i += 4) {
+        uint32x4_t matches = vceqq_s32(vld1q_s32(data + i), needle);
+        count = vpadalq_u32(count, vshrq_n_u32(matches, 31));
+    }
+    size_t result = vaddvq_u64(count);
+    for (; i < size; ++i) {
+        result += data[i] == value;
+    }
+    return result;
+}
+
+inline void FillNeon(int32_t *data, size_t size, int32_t value) {
+    size_t i = 0;
+    int32x4_t values = vdupq_n_s32(value);
+    for (; i + 4 <= size; i += 4) {
+        vst1q_s32(data + i, values);
+    }
+    for (; i < size; ++i) {
+        data[i] = value;
+    }
+}
+
+#endif
+
+// Kernels over one contiguous segment
+
+template<class T>
+SumType<T> Sum(std::span<const T> segment) {
+    if constexpr (kIsVectorized<T>) {
+#if DEQUE_SIMD_AVX2
+        if (HasAvx2()) {
+            return SumAvx2(segment.data(), segment.size());
+        }
+#elif DEQUE_SIMD_NEON
+        return SumNeon(segment.data(), segment.size());
+#endif
+    }
+    return std::accumulate(segment.begin(), segment.end(), SumType<T>{});
+}
+
+// The segment must not be empty
+template<class T>
+std::pair<T, T> MinMax(std::span<const T> segment) {
+    if constexpr (kIsVectorized<T>) {
+#if DEQUE_SIMD_AVX2
+        if (HasAvx2()) {
+            return MinMaxAvx2(segment.data(), segment.size());
+        }
+#elif DEQUE_SIMD_NEON
+        return MinMaxNeon(segment.data(), segment.size());
+#endif
+    }
+    auto [min, max] = std::minmax_element(segment.begin(), segment.end());
+    return {*min, *max};
+}
+
+// Index of the first element equal to value, segment.size() if there is none
+template<class T>
+size_t Find(std::span<const T> segment, const T &value) {
+    if constexpr (kIsVectorized<T>) {
+#if DEQUE_SIMD_AVX2
+        if (HasAvx2()) {
+            return FindAvx2(segment.data(), segment.size(), value);
+        }
+#elif DEQUE_SIMD_NEON
+        return FindNeon(segment.data(), segment.size(), value);
+#endif
+    }
+    return std::find(segment.begin(), segment.end(), value) - segment.begin();
+}
+
+template<class T>
+size_t Count(std::span<const T> segment, const T &value) {
+    if constexpr (kIsVectorized<T>) {
+#if DEQUE_SIMD_AVX2
+        if (HasAvx2()) {
+            return CountAvx2(segment.data(), segment.size(), value);
+        }
+#elif DEQUE_SIMD_NEON
+        return CountNeon(segment.data(), segment.size(), value);
+#endif
+    }
+    return std::count(segment.begin(), segment.end(), value);
+}
+
+template<class T>
+void Fill(std::span<T> segment, const T &value) {
+    if constexpr (kIsVectorized<T>) {
+#if DEQUE_SIMD_AVX2
+        if (HasAvx2()) {
+            FillAvx2(segment.data(), segment.size(), value);
+            return;
+        }
+#elif DEQUE_SIMD_NEON
+        FillNeon(segment.data(), segment.size(), value);
+        return;
+#endif
+    }
+    std::fill(segment.begin(), segment.end(), value);
+}
+
+template<class T, size_t BlockBytes>
+size_t FindIndex(const Deque<T, BlockBytes> &deque, const T &value) {
+    size_t index = 0;
+    bool is_found = false;
+    deque.ForEachSegment([&](std::span<const T> segment) {
+        if (!is_found) {
+            size_t position = Find(segment, value);
+            index += position;
+            is_found = position < segment.size();
+        }
+    });
+    return index;
+}
+
+}  // namespace detail
+
+template<class T, size_t BlockBytes>
+SumType<T> Sum(const Deque<T, BlockBytes> &deque) {
+    SumType<T> sum{};
+    deque.ForEachSegment([&sum](std::span<const T> segment) { sum += detail::Sum(segment); });
+    return sum;
+}
+
+// Smallest and largest element, the deque must not be empty
+template<class T, size_t BlockBytes>
+std::pair<T, T> MinMax(const Deque<T, BlockBytes> &deque) {
+    std::pair<T, T> result{deque[0], deque[0]};
+    deque.ForEachSegment([&result](std::span<const T> segment) {
+        auto [min, max] = detail::MinMax(segment);
+        result.first = std::min(result.first, min);
+        result.second = std::max(result.second, max);
+    });
+    return result;
+}
+
+// Iterator to the first element equal to value or end()
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::const_iterator Find(const Deque<T, BlockBytes> &deque,
+                                                   const T &value) {
+    return deque.begin() + detail::FindIndex(deque, value);
+}
+
+template<class T, size_t BlockBytes>
+typename Deque<T, BlockBytes>::iterator Find(Deque<T, BlockBytes> &deque, const T &value) {
+    return deque.begin() + detail::FindIndex(std::as_const(deque), value);
+}
+
+template<class T, size_t BlockBytes>
+size_t Count(const Deque<T, BlockBytes> &deque, const T &value) {
+    size_t count = 0;
+    deque.ForEachSegment(
+            [&](std::span<const T> segment) { count += detail::Count(segment, value); });
+    return count;
+}
+
+template<class T, size_t BlockBytes>
+void Fill(Deque<T, BlockBytes> &deque, const T &value) {
+    deque.ForEachSegment([&value](std::span<T> segment) { detail::Fill(segment, value); });
+}
+
+// Replaces every element x with fn(x). The loop over a segment has no calls into the deque,
+// so an inlinable fn gets vectorized by the compiler
+template<class T, size_t BlockBytes, class Fn>
+void Transform(Deque<T, BlockBytes> &deque, Fn fn) {
+    deque.ForEachSegment([&fn](std::span<T> segment) {
+        for (T &value : segment) {
+            value = fn(value);
+        }
+    });
+}
+
+}  // namespace deque_simd
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <utility>
+
+#include "deque.h"
+
+// Operation traces of deques, so that workloads recorded in production can be replayed against
+// other deque implementations (see trace_replay.cpp). A trace is kMagic followed by one
+// record per operation: a byte with the operation in its low four bits and the argument, the
+// index or the count, in its high four bits when it is below kInlineArgLimit. A larger argument
+// follows as a LEB128 number, so pushes and pops take a byte each. Element values are not kept,
+// a replay pushes values of its own.
+
+namespace deque_trace {
+
+enum class Op : uint8_t {
+    kPushBack,
+    kPushFront,
+    kPopBack,
+    kPopFront,
+    // Reads the element at the index
+    kIndex,
+    // Push or pop count elements at once
+    kPushBackRange,
+    kPushFrontRange,
+    kPopBackN,
+    kPopFrontN,
+    kClear,
+};
+
+constexpr uint8_t kOpsCount = static_cast<uint8_t>(Op::kClear) + 1;
+
+struct Entry {
+    Op op;
+    uint64_t arg = 0;
+
+    friend bool operator==(const Entry &, const Entry &) = default;
+};
+
+constexpr char kMagic[8] = {'D', 'Q', 'T', 'R', 'A', 'C', 'E', '1'};
+
+constexpr uint64_t kInlineArgLimit = 15;
+
+// Largest size a deque replaying a trace may reach. A count that would take it further makes
+// the trace invalid, so replays add up counts and element values without overflowing
+constexpr uint64_t kMaxSize = uint64_t{1} << 40;
+
+// Appends the records of operations to a Deque of bytes, which deque_io::WriteTo writes out
+// without copying
+class TraceWriter {
+public:
+    explicit TraceWriter(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    void Record(Op op, uint64_t arg = 0);
+
+    size_t GetEntriesCount() const;
+
+    const Deque<std::byte> &GetBytes() const;
+
+private:
+    Deque<std::byte> bytes_;
+    size_t entries_count_ = 0;
+};
+
+// Appends the entries of trace to entries. Checks that every entry is valid for a deque
+// replaying the trace from empty, so that replays never pop an empty deque, index past its end
+// or grow it past kMaxSize. Returns false and leaves a prefix appended when trace is malformed
+// or invalid. The largest size the deque reaches is stored in peak_size
+bool ReadTrace(std::span<const std::byte> trace, Deque<Entry> &entries,
+               size_t *peak_size = nullptr);
+
+// Deque that records what is done to it. The recorded operations are those of Deque, so the
+// bulk ones stay single entries
+template<class T, size_t BlockBytes = deque_settings::kBlockBytes>
+class RecordingDeque {
+public:
+    explicit RecordingDeque(TraceWriter &writer,
+                            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    void PushBack(T value);
+
+    void PushFront(T value);
+
+    void PopBack();
+
+    void PopFront();
+
+    const T &operator[](size_t ind);
+
+    template<std::ranges::sized_range R>
+    void PushBackRange(R &&range);
+
+    template<std::ranges::sized_range R>
+    void PushFrontRange(R &&range);
+
+    void PopBackN(size_t count);
+
+    void PopFrontN(size_t count);
+
+    void Clear();
+
+    size_t Size() const;
+
+    const Deque<T, BlockBytes> &GetDeque() const;
+
+private:
+    TraceWriter *writer_;
+    Deque<T, BlockBytes> deque_;
+};
+
+inline TraceWriter::TraceWriter(std::pmr::memory_resource *resource) : bytes_(resource) {
+    bytes_.PushBackRange(std::as_bytes(std::span(kMagic)));
+}
+
+inline void TraceWriter::Record(Op op, uint64_t arg) {
+    auto code = static_cast<uint8_t>(op);
+    if (arg < kInlineArgLimit) {
+        bytes_.PushBack(static_cast<std::byte>(code | arg << 4));
+    } else {
+        bytes_.PushBack(static_cast<std::byte>(code | kInlineArgLimit << 4));
+        arg -= kInlineArgLimit;
+        // LEB128: seven bits a byte, the high bit tells another byte follows
+        while (arg >= 0x80) {
+            bytes_.PushBack(static_cast<std::byte>((arg & 0x7f) | 0x80));
+            arg >>= 7;
+        }
+        bytes_.PushBack(static_cast<std::byte>(arg));
+    }
+    ++entries_count_;
+}
+
+inline size_t TraceWriter::GetEntriesCount() const {
+    return entries_count_;
+}
+
+inline const Deque<std::byte> &TraceWriter::GetBytes() const {
+    return bytes_;
+}
+
+inline bool ReadTrace(std::span<const std::byte> trace, Deque<Entry> &entries,
+                      size_t *peak_size) {
+    if (trace.size() < sizeof(kMagic) or std::memcmp(trace.data(), kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    size_t size = 0;
+    size_t peak = 0;
+    for (size_t position = sizeof(kMagic); position < trace.size();) {
+        auto code = static_cast<uint8_t>(trace[position++]);
+        if ((code & 0xf) >= kOpsCount) {
+            return false;
+        }
+        Entry entry{static_cast<Op>(code & 0xf), static_cast<uint64_t>(code >> 4)};
+        if (entry.arg == kInlineArgLimit) {
+            uint64_t rest = 0;
+            for (int shift = 0;; shift += 7) {
+                if (position == trace.size() or shift > 63) {
+                    return false;
+                }
+                auto byte = static_cast<uint8_t>(trace[position++]);
+                rest |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    break;
+                }
+            }
+            entry.arg += rest;
+        }
+        switch (entry.op) {
+            case Op::kPushBack:
+            case Op::kPushFront:
+                if (size == kMaxSize) {
+                    return false;
+                }
+                ++size;
+                break;
+            case Op::kPopBack:
+            case Op::kPopFront:
+                if (size == 0) {
+                    return false;
+                }
+                --size;
+                break;
+            case Op::kIndex:
+                if (entry.arg >= size) {
+                    return false;
+                }
+                break;
+            case Op::kPushBackRange:
+            case Op::kPushFrontRange:
+                if (entry.arg > kMaxSize - size) {
+                    return false;
+                }
+                size += entry.arg;
+                break;
+            case Op::kPopBackN:
+            case Op::kPopFrontN:
+                if (entry.arg > size) {
+                    return false;
+                }
+                size -= entry.arg;
+                break;
+            case Op::kClear:
+                size = 0;
+                break;
+        }
+        peak = std::max(peak, size);
+        entries.PushBack(entry);
+    }
+    if (peak_size != nullptr) {
+        *peak_size = peak;
+    }
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+RecordingDeque<T, BlockBytes>::RecordingDeque(TraceWriter &writer,
+                                              std::pmr::memory_resource *resource)
+    : writer_(&writer), deque_(resource) {
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PushBack(T value) {
+    deque_.PushBack(std::move(value));
+    writer_->Record(Op::kPushBack);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PushFront(T value) {
+    deque_.PushFront(std::move(value));
+    writer_->Record(Op::kPushFront);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PopBack() {
+    deque_.PopBack();
+    writer_->Record(Op::kPopBack);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PopFront() {
+    deque_.PopFront();
+    writer_->Record(Op::kPopFront);
+}
+
+template<class T, size_t BlockBytes>
+const T &RecordingDeque<T, BlockBytes>::operator[](size_t ind) {
+    writer_->Record(Op::kIndex, ind);
+    return std::as_const(deque_)[ind];
+}
+
+template<class T, size_t BlockBytes>
+template<std::ranges::sized_range R>
+void RecordingDeque<T, BlockBytes>::PushBackRange(R &&range) {
+    size_t count = std::ranges::size(range);
+    deque_.PushBackRange(std::forward<R>(range));
+    writer_->Record(Op::kPushBackRange, count);
+}
+
+template<class T, size_t BlockBytes>
+template<std::ranges::sized_range R>
+void RecordingDeque<T, BlockBytes>::PushFrontRange(R &&range) {
+    size_t count = std::ranges::size(range);
+    deque_.PushFrontRange(std::forward<R>(range));
+    writer_->Record(Op::kPushFrontRange, count);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PopBackN(size_t count) {
+    deque_.PopBackN(count);
+    writer_->Record(Op::kPopBackN, count);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::PopFrontN(size_t count) {
+    deque_.PopFrontN(count);
+    writer_->Record(Op::kPopFrontN, count);
+}
+
+template<class T, size_t BlockBytes>
+void RecordingDeque<T, BlockBytes>::Clear() {
+    deque_.Clear();
+    writer_->Record(Op::kClear);
+}
+
+template<class T, size_t BlockBytes>
+size_t RecordingDeque<T, BlockBytes>::Size() const {
+    return deque_.Size();
+}
+
+template<class T, size_t BlockBytes>
+const Deque<T, BlockBytes> &RecordingDeque<T, BlockBytes>::GetDeque() const {
+    return deque_;
+}
+
+}  // namespace deque_trace
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "deque.h"
+
+// Bounded queue for any number of producer and consumer threads. The ring of blocks is
+// allocated once at construction and never grows.
+//
+// Every slot has a sequence number telling whose turn it is: a slot at position p is free
+// for the producer of lap p when it equals p and holds an element for the consumer of that lap
+// when it equals p + 1. A batch finds how many slots in a row are ready for it and claims them
+// all with a single CAS on the tail or the head, then fills or drains them without touching
+// shared counters again.
+template<class T, size_t BlockBytes = deque_settings::kBlockBytes>
+class MpmcRing {
+public:
+    // Holds at least capacity elements, rounded up to a power of two number of blocks
+    explicit MpmcRing(size_t capacity,
+                      std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    MpmcRing(const MpmcRing &) = delete;
+
+    MpmcRing &operator=(const MpmcRing &) = delete;
+
+    ~MpmcRing();
+
+    bool TryPush(const T &value);
+
+    bool TryPush(T &&value);
+
+    // Copies the longest prefix of values that fits, returns its length
+    size_t TryPushBatch(std::span<const T> values);
+
+    bool TryPop(T &value);
+
+    // Moves up to out.size() elements into out, returns how many there were
+    size_t TryPopBatch(std::span<T> out);
+
+    size_t Capacity() const;
+
+    std::pmr::memory_resource *GetMemoryResource() const;
+
+private:
+    static_assert(std::has_single_bit(BlockBytes));
+
+    static constexpr size_t kBlockSize =
+            std::bit_floor(deque_settings::kBlockSize<T, BlockBytes>);
+    static constexpr size_t kBlockShift = std::countr_zero(kBlockSize);
+
+    struct RingBlock {
+        alignas(std::max(alignof(T), deque_settings::kBlockAlignment))
+                std::byte data[sizeof(T) * kBlockSize];
+        std::atomic<uint64_t> sequence[kBlockSize];
+
+        T *GetSlot(size_t index) {
+            return std::launder(reinterpret_cast<T *>(data + index * sizeof(T)));
+        }
+    };
+
+    using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+    std::pmr::memory_resource *resource_;
+    RingBlock **blocks_;
+    size_t blocks_count_;
+    uint64_t capacity_;
+    alignas(deque_settings::kCacheLineSize) std::atomic<uint64_t> head_ = 0;
+    alignas(deque_settings::kCacheLineSize) std::atomic<uint64_t> tail_ = 0;
+
+    RingBlock &GetBlock(uint64_t position) const {
+        return *blocks_[(position >> kBlockShift) & (blocks_count_ - 1)];
+    }
+
+    std::atomic<uint64_t> &GetSequence(uint64_t position) const {
+        return GetBlock(position).sequence[position & (kBlockSize - 1)];
+    }
+
+    T *GetSlot(uint64_t position) const {
+        return GetBlock(position).GetSlot(position & (kBlockSize - 1));
+    }
+
+    // Claims up to count positions from counter whose slots have sequence equal to their
+    // position plus offset. Returns how many, the first goes to position
+    size_t Claim(std::atomic<uint64_t> &counter, uint64_t offset, size_t count,
+                 uint64_t &position);
+};
+
+template<class T, size_t BlockBytes>
+MpmcRing<T, BlockBytes>::MpmcRing(size_t capacity, std::pmr::memory_resource *resource)
+    : resource_(resource),
+      blocks_count_(std::bit_ceil(std::max<size_t>(1, (capacity + kBlockSize - 1) / kBlockSize))),
+      capacity_(blocks_count_ * kBlockSize) {
+    blocks_ = Allocator(resource_).allocate_object<RingBlock *>(blocks_count_);
+    for (size_t i = 0; i < blocks_count_; ++i) {
+        blocks_[i] = Allocator(resource_).new_object<RingBlock>();
+        for (size_t j = 0; j < kBlockSize; ++j) {
+            blocks_[i]->sequence[j].store(i * kBlockSize + j, std::memory_order_relaxed);
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+MpmcRing<T, BlockBytes>::~MpmcRing() {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    for (uint64_t position = head_.load(std::memory_order_relaxed); position != tail;
+         ++position) {
+        std::destroy_at(GetSlot(position));
+    }
+    for (size_t i = 0; i < blocks_count_; ++i) {
+        Allocator(resource_).delete_object(blocks_[i]);
+    }
+    Allocator(resource_).deallocate_object(blocks_, blocks_count_);
+}
+
+template<class T, size_t BlockBytes>
+size_t MpmcRing<T, BlockBytes>::Claim(std::atomic<uint64_t> &counter, uint64_t offset,
+                                      size_t count, uint64_t &position) {
+    position = counter.load(std::memory_order_relaxed);
+    while (true) {
+        size_t ready = 0;
+        while (ready < count and
+               GetSequence(position + ready).load(std::memory_order_acquire) ==
+                       position + ready + offset) {
+            ++ready;
+        }
+        if (ready == 0) {
+            // The slot is a lap behind: the ring is full for producers or empty for consumers.
+            // Otherwise another thread claimed it after we read the counter
+            if (GetSequence(position).load(std::memory_order_acquire) < position + offset) {
+                return 0;
+            }
+            position = counter.load(std::memory_order_relaxed);
+        } else if (counter.compare_exchange_weak(position, position + ready,
+                                                 std::memory_order_relaxed)) {
+            return ready;
+        }
+    }
+}
+
+template<class T, size_t BlockBytes>
+bool MpmcRing<T, BlockBytes>::TryPush(const T &value) {
+    return TryPushBatch(std::span<const T>(&value, 1)) == 1;
+}
+
+template<class T, size_t BlockBytes>
+bool MpmcRing<T, BlockBytes>::TryPush(T &&value) {
+    uint64_t position;
+    if (Claim(tail_, 0, 1, position) == 0) {
+        return false;
+    }
+    std::construct_at(GetSlot(position), std::move(value));
+    GetSequence(position).store(position + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+size_t MpmcRing<T, BlockBytes>::TryPushBatch(std::span<const T> values) {
+    uint64_t position;
+    size_t count = Claim(tail_, 0, values.size(), position);
+    for (size_t i = 0; i < count; ++i) {
+        std::construct_at(GetSlot(position + i), values[i]);
+        GetSequence(position + i).store(position + i + 1, std::memory_order_release);
+    }
+    return count;
+}
+
+template<class T, size_t BlockBytes>
+bool MpmcRing<T, BlockBytes>::TryPop(T &value) {
+    return TryPopBatch(std::span<T>(&value, 1)) == 1;
+}
+
+template<class T, size_t BlockBytes>
+size_t MpmcRing<T, BlockBytes>::TryPopBatch(std::span<T> out) {
+    uint64_t position;
+    size_t count = Claim(head_, 1, out.size(), position);
+    for (size_t i = 0; i < count; ++i) {
+        T *slot = GetSlot(position + i);
+        out[i] = std::move(*slot);
+        std::destroy_at(slot);
+        // Hands the slot to the producer of the next lap
+        GetSequence(position + i).store(position + i + capacity_, std::memory_order_release);
+    }
+    return count;
+}
+
+template<class T, size_t BlockBytes>
+size_t MpmcRing<T, BlockBytes>::Capacity() const {
+    return capacity_;
+}
+
+template<class T, size_t BlockBytes>
+std::pmr::memory_resource *MpmcRing<T, BlockBytes>::GetMemoryResource() const {
+    return resource_;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "deque.h"
+
+// Unbounded queue for exactly one producer thread, calling PushBack, and one consumer thread,
+// calling TryPopFront and IsEmpty. Elements live in a chain of fixed-size blocks like in Deque.
+// The producer publishes how many slots of its block are filled, the consumer publishes which
+// block it reads. Blocks the consumer has left stay chained behind it and are the free list
+// the producer takes blocks back from, so neither side ever waits for the other and the only
+// memory both sides write is the counter of the block they share.
+template<class T, size_t BlockBytes = deque_settings::kBlockBytes>
+class SpscDeque {
+public:
+    explicit SpscDeque(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    SpscDeque(const SpscDeque &) = delete;
+
+    SpscDeque &operator=(const SpscDeque &) = delete;
+
+    ~SpscDeque();
+
+    // Producer side
+
+    void PushBack(const T &value);
+
+    void PushBack(T &&value);
+
+    template<class... Args>
+    void EmplaceBack(Args &&...args);
+
+    // Consumer side
+
+    // Moves the first element into value, false if nothing has been published yet
+    bool TryPopFront(T &value);
+
+    bool IsEmpty() const;
+
+    std::pmr::memory_resource *GetMemoryResource() const;
+
+private:
+    static_assert(std::has_single_bit(BlockBytes));
+
+    static constexpr size_t kBlockSize = deque_settings::kBlockSize<T, BlockBytes>;
+
+    struct SpscBlock {
+        alignas(std::max(alignof(T), deque_settings::kBlockAlignment))
+                std::byte data[sizeof(T) * kBlockSize];
+        // Slots [0, published) hold elements the consumer may take
+        alignas(deque_settings::kCacheLineSize) std::atomic<size_t> published = 0;
+        std::atomic<SpscBlock *> next = nullptr;
+
+        T *GetSlot(size_t position) {
+            return std::launder(reinterpret_cast<T *>(data + position * sizeof(T)));
+        }
+    };
+
+    using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+    std::pmr::memory_resource *resource_;
+
+    // Written by the producer only
+    alignas(deque_settings::kCacheLineSize) SpscBlock *tail_block_;
+    size_t tail_ = 0;
+    // Oldest block of the chain, blocks before reader_block_copy_ are retired
+    SpscBlock *first_block_;
+    SpscBlock *reader_block_copy_;
+
+    // Written by the consumer only
+    alignas(deque_settings::kCacheLineSize) SpscBlock *head_block_;
+    size_t head_ = 0;
+    size_t published_copy_ = 0;
+
+    // Block the consumer reads, everything before it may be reused by the producer
+    alignas(deque_settings::kCacheLineSize) std::atomic<SpscBlock *> reader_block_;
+
+    // A retired block if one is free, a new one otherwise
+    SpscBlock *AcquireBlock();
+};
+
+template<class T, size_t BlockBytes>
+SpscDeque<T, BlockBytes>::SpscDeque(std::pmr::memory_resource *resource)
+    : resource_(resource),
+      tail_block_(Allocator(resource_).new_object<SpscBlock>()),
+      first_block_(tail_block_),
+      reader_block_copy_(tail_block_),
+      head_block_(tail_block_),
+      reader_block_(tail_block_) {
+}
+
+template<class T, size_t BlockBytes>
+SpscDeque<T, BlockBytes>::~SpscDeque() {
+    for (SpscBlock *block = head_block_; block != nullptr; block = block->next.load()) {
+        size_t published = block->published.load();
+        for (size_t i = block == head_block_ ? head_ : 0; i < published; ++i) {
+            std::destroy_at(block->GetSlot(i));
+        }
+    }
+    while (first_block_ != nullptr) {
+        SpscBlock *next = first_block_->next.load();
+        Allocator(resource_).delete_object(first_block_);
+        first_block_ = next;
+    }
+}
+
+template<class T, size_t BlockBytes>
+void SpscDeque<T, BlockBytes>::PushBack(const T &value) {
+    EmplaceBack(value);
+}
+
+template<class T, size_t BlockBytes>
+void SpscDeque<T, BlockBytes>::PushBack(T &&value) {
+    EmplaceBack(std::move(value));
+}
+
+template<class T, size_t BlockBytes>
+template<class... Args>
+void SpscDeque<T, BlockBytes>::EmplaceBack(Args &&...args) {
+    if (tail_ < kBlockSize) {
+        std::construct_at(tail_block_->GetSlot(tail_), std::forward<Args>(args)...);
+        tail_block_->published.store(++tail_, std::memory_order_release);
+        return;
+    }
+    // The element goes in before the block is linked, so a linked block is never empty
+    SpscBlock *block = AcquireBlock();
+    try {
+        std::construct_at(block->GetSlot(0), std::forward<Args>(args)...);
+    } catch (...) {
+        block->next.store(first_block_, std::memory_order_relaxed);
+        first_block_ = block;
+        throw;
+    }
+    block->published.store(1, std::memory_order_relaxed);
+    tail_block_->next.store(block, std::memory_order_release);
+    tail_block_ = block;
+    tail_ = 1;
+}
+
+template<class T, size_t BlockBytes>
+typename SpscDeque<T, BlockBytes>::SpscBlock *SpscDeque<T, BlockBytes>::AcquireBlock() {
+    if (first_block_ == reader_block_copy_) {
+        reader_block_copy_ = reader_block_.load(std::memory_order_acquire);
+    }
+    if (first_block_ == reader_block_copy_) {
+        return Allocator(resource_).new_object<SpscBlock>();
+    }
+    SpscBlock *block = first_block_;
+    first_block_ = block->next.load(std::memory_order_relaxed);
+    block->published.store(0, std::memory_order_relaxed);
+    block->next.store(nullptr, std::memory_order_relaxed);
+    return block;
+}
+
+template<class T, size_t BlockBytes>
+bool SpscDeque<T, BlockBytes>::TryPopFront(T &value) {
+    if (head_ == published_copy_) {
+        if (head_ == kBlockSize) {
+            SpscBlock *next = head_block_->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+            head_block_ = next;
+            head_ = 0;
+            // Hands the block just left, with all its elements destroyed, to the producer
+            reader_block_.store(next, std::memory_order_release);
+        }
+        published_copy_ = head_block_->published.load(std::memory_order_acquire);
+        if (head_ == published_copy_) {
+            return false;
+        }
+    }
+    T *slot = head_block_->GetSlot(head_);
+    value = std::move(*slot);
+    std::destroy_at(slot);
+    ++head_;
+    return true;
+}
+
+template<class T, size_t BlockBytes>
+bool SpscDeque<T, BlockBytes>::IsEmpty() const {
+    if (head_ < published_copy_) {
+        return false;
+    }
+    if (head_ < kBlockSize) {
+        return head_block_->published.load(std::memory_order_acquire) == head_;
+    }
+    return head_block_->next.load(std::memory_order_acquire) == nullptr;
+}
+
+template<class T, size_t BlockBytes>
+std::pmr::memory_resource *SpscDeque<T, BlockBytes>::GetMemoryResource() const {
+    return resource_;
+}
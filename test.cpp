@@ -4,10 +4,40 @@
 #include <vector>
 #include <random>
 #include <deque>
+#include <memory_resource>
+#include <memory>
+#include <array>
+#include <list>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <cstdint>
+#include <bit>
+#include <cstdio>
+#include <coroutine>
+#include <optional>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <deque.h>
+#include <deque_simd.h>
+#include <deque_parallel.h>
+#include <deque_io.h>
+#include <deque_trace.h>
+#include <bounded_deque.h>
+#include <deque_placement.h>
+#include <spsc_deque.h>
+#include <work_stealing_deque.h>
+#include <mpmc_ring.h>
+#include <async_deque.h>
 
-void Check(const Deque& actual, const std::vector<int>& expected) {
+void Check(const Deque<int>& actual, const std::vector<int>& expected) {
     REQUIRE(actual.Size() == expected.size());
     for (size_t i = 0; i < actual.Size(); ++i) {
         REQUIRE(actual[i] == expected[i]);
@@ -251,3 +281,2052 @@ TEST_CASE("Front and back traversing the same block") {
     }
     REQUIRE(a.Size() == 0u);
 }
+
+TEST_CASE("Retired blocks are reused") {
+    const int block_size = 128;
+    Deque a;
+    for (int i = 0; i < block_size; ++i) {
+        a.PushBack(i);
+    }
+    const int *first_block = &a[0];
+    a.PushBack(block_size);
+    for (int i = 0; i < block_size; ++i) {
+        a.PopFront();
+    }
+    for (int i = 1; i < block_size; ++i) {
+        a.PushBack(block_size + i);
+    }
+    a.PushBack(2 * block_size);
+    REQUIRE(&a[block_size] == first_block);
+    REQUIRE(a[block_size] == 2 * block_size);
+
+    a.SetBlockPoolMaxSize(0);
+    a.ShrinkToFit();
+    for (int i = 0; i < 10 * block_size; ++i) {
+        a.PushBack(i);
+        a.PopFront();
+    }
+    REQUIRE(a.Size() == static_cast<size_t>(block_size + 1));
+    REQUIRE(a[block_size] == 10 * block_size - 1);
+}
+
+TEST_CASE("Memory resource") {
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::memory_resource *resource = &arena;
+    {
+        Deque a(resource);
+        REQUIRE(a.GetMemoryResource() == resource);
+        for (int i = 0; i < 10000; ++i) {
+            a.PushBack(i);
+            a.PushFront(-i);
+        }
+        REQUIRE(a.Size() == 20000u);
+        REQUIRE(a[0] == -9999);
+        REQUIRE(a[19999] == 9999);
+
+        Deque b(a, resource);
+        REQUIRE(b.GetMemoryResource() == resource);
+        REQUIRE(b[10000] == 0);
+
+        Deque c(a);
+        REQUIRE(c.GetMemoryResource() == std::pmr::get_default_resource());
+        REQUIRE(c.Size() == a.Size());
+
+        c.Swap(a);
+        REQUIRE(c.GetMemoryResource() == resource);
+        REQUIRE(a.GetMemoryResource() == std::pmr::get_default_resource());
+    }
+    {
+        Deque a(300, resource);
+        Check(a, std::vector<int>(300));
+        a.PushBack(1);
+        REQUIRE(a[300] == 1);
+        Deque b({1, 2, 3}, resource);
+        Check(b, std::vector<int>{1, 2, 3});
+    }
+    {
+        Deque a(128);
+        Check(a, std::vector<int>(128));
+        a.PushFront(1);
+        a.PushBack(2);
+        Deque b(a);
+        REQUIRE(b.Size() == 130u);
+        REQUIRE(b[0] == 1);
+        REQUIRE(b[129] == 2);
+    }
+}
+
+TEST_CASE("Slab storage") {
+    using DataBlock = Block<int, deque_settings::kBlockSize<int>>;
+    const int iterations = 1e5;
+    Deque a(BlockStorage::kSlab);
+    REQUIRE(a.GetStorage() == BlockStorage::kSlab);
+    std::vector<int*> addr;
+    for (int i = 0; i < iterations; ++i) {
+        a.PushBack(i);
+        addr.push_back(&a[i]);
+    }
+    for (int i = 0; i < iterations; ++i) {
+        REQUIRE(*addr[i] == i);
+    }
+    // Blocks allocated one after another come from the same chunk
+    auto first = reinterpret_cast<const char*>(&a[0]);
+    auto second = reinterpret_cast<const char*>(&a[deque_settings::kBlockSize<int>]);
+    REQUIRE(second - first == static_cast<std::ptrdiff_t>(sizeof(DataBlock)));
+
+    std::deque<int> expected(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        expected[i] = i;
+    }
+    Deque b(a);
+    REQUIRE(b.GetStorage() == BlockStorage::kSlab);
+    Check(b, std::vector<int>(expected.begin(), expected.end()));
+    std::mt19937 gen(735675);
+    for (int i = 0; i < iterations; ++i) {
+        int value = gen();
+        if (value % 2 == 0) {
+            a.PopFront();
+            expected.pop_front();
+        } else {
+            a.PushFront(value);
+            expected.push_front(value);
+        }
+    }
+    a.ShrinkToFit();
+    REQUIRE(a.Size() == expected.size());
+    for (size_t i = 0; i < a.Size(); ++i) {
+        REQUIRE(a[i] == expected[i]);
+    }
+    a.Clear();
+    a.ShrinkToFit();
+    a.PushBack(1);
+    Check(a, std::vector<int>{1});
+}
+
+TEST_CASE("Indexing after sized construction") {
+    // 40 blocks do not fill a power-of-two ring, pushes below wrap around its end
+    const int size = 40 * 128 + 7;
+    Deque a(size);
+    std::deque<int> b(size);
+    for (int i = 0; i < 5000; ++i) {
+        a.PushFront(i);
+        b.push_front(i);
+        a.PushBack(-i);
+        b.push_back(-i);
+    }
+    REQUIRE(a.Size() == b.size());
+    for (size_t i = 0; i < b.size(); ++i) {
+        REQUIRE(a[i] == b[i]);
+    }
+}
+
+namespace {
+struct Counted {
+    static inline int alive = 0;
+    static inline int default_constructed = 0;
+    int value;
+
+    Counted() : value(0) {
+        ++alive;
+        ++default_constructed;
+    }
+    explicit Counted(int v) : value(v) {
+        ++alive;
+    }
+    Counted(const Counted& other) : value(other.value) {
+        ++alive;
+    }
+    ~Counted() {
+        --alive;
+    }
+};
+}  // namespace
+
+TEST_CASE("Non-trivial elements") {
+    {
+        Deque<std::string> a{"a", "b"};
+        a.PushFront(std::string(100, 'x'));
+        a.EmplaceBack(3, 'c');
+        REQUIRE(a.Size() == 4u);
+        REQUIRE(a[0] == std::string(100, 'x'));
+        REQUIRE(a[3] == "ccc");
+        Deque<std::string> b(a);
+        a.PopBack();
+        a.PopFront();
+        REQUIRE(a.Size() == 2u);
+        REQUIRE(a[0] == "a");
+        REQUIRE(b.Size() == 4u);
+        REQUIRE(b[3] == "ccc");
+    }
+    {
+        Deque<std::unique_ptr<int>> a;
+        for (int i = 0; i < 1000; ++i) {
+            a.PushBack(std::make_unique<int>(i));
+            a.EmplaceFront(new int(-i));
+        }
+        REQUIRE(*a[0] == -999);
+        REQUIRE(*a[1999] == 999);
+        Deque<std::unique_ptr<int>> b(std::move(a));
+        REQUIRE(*b[1000] == 0);
+        b.PopFront();
+        REQUIRE(*b[0] == -998);
+    }
+    {
+        Deque<Counted> a;
+        for (int i = 0; i < 1000; ++i) {
+            a.EmplaceBack(i);
+        }
+        REQUIRE(Counted::alive == 1000);
+        for (int i = 0; i < 500; ++i) {
+            a.PopFront();
+        }
+        REQUIRE(Counted::alive == 500);
+        REQUIRE(a[0].value == 500);
+        a.Clear();
+        REQUIRE(Counted::alive == 0);
+        Deque<Counted> b(300);
+        REQUIRE(Counted::alive == 300);
+        REQUIRE(Counted::default_constructed == 300);
+        Deque<Counted> c(b);
+        REQUIRE(Counted::alive == 600);
+        // A snapshot copies the elements with their blocks when the deque writes
+        {
+            auto snapshot = b.Snapshot();
+            REQUIRE(Counted::alive == 600);
+            b.ForEachSegment([](std::span<Counted>) {});
+            REQUIRE(Counted::alive == 900);
+        }
+        REQUIRE(Counted::alive == 600);
+        auto snapshot = c.Snapshot();
+        c.PopBack();
+        c.Clear();
+        REQUIRE(Counted::alive == 600);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Block size in bytes") {
+    Deque<int64_t, 64> a;
+    for (int i = 0; i < 100; ++i) {
+        a.PushBack(i);
+    }
+    for (int i = 0; i < 7; ++i) {
+        REQUIRE(&a[i] + 1 == &a[i + 1]);
+    }
+    REQUIRE(a[99] == 99);
+    Deque<std::array<char, 1000>> b;
+    b.EmplaceBack();
+    b.EmplaceBack();
+    REQUIRE(b.Size() == 2u);
+
+    // A block holds the elements and nothing else
+    REQUIRE(sizeof(Block<int, deque_settings::kBlockSize<int>>) == deque_settings::kBlockBytes);
+    REQUIRE(sizeof(Block<int64_t, 8>) == 64);
+    using Element = std::array<char, 24>;
+    REQUIRE(sizeof(Block<Element, deque_settings::kBlockSize<Element>>) == 512);
+}
+
+TEST_CASE("Emptied deque starts its last block over") {
+    Deque a;
+    a.PushFront(1);
+    a.PopFront();
+    a.PushBack(2);
+    a.PopFront();
+    a.PushBack(3);
+    a.PushBack(4);
+    Check(a, std::vector<int>{3, 4});
+    a.PopBack();
+    a.PopBack();
+    a.PushFront(5);
+    a.PushBack(6);
+    Check(a, std::vector<int>{5, 6});
+    REQUIRE(a.Stats().live_blocks == 2);
+
+    // The only block of an empty deque is filled from the end the elements come to
+    std::vector<int> values(deque_settings::kBlockSize<int>, 7);
+    for (int i = 0; i < 3; ++i) {
+        a.Clear();
+        a.PushFrontRange(values);
+        REQUIRE(a.Stats().live_blocks == 1);
+        a.PopBackN(a.Size());
+        a.PushBackRange(values);
+        REQUIRE(a.Stats().live_blocks == 1);
+        a.PopFrontN(a.Size());
+        a.PushFront(8);
+        a.PopBack();
+        a.PushBack(9);
+        REQUIRE(a.Stats().live_blocks == 1);
+        Check(a, std::vector<int>{9});
+    }
+}
+
+TEST_CASE("Bulk operations") {
+    {
+        Deque a{1, 2};
+        std::vector<int> v(1000);
+        for (int i = 0; i < 1000; ++i) {
+            v[i] = i;
+        }
+        a.PushBackRange(v);
+        a.PushFrontRange(std::vector<int>{-3, -2, -1});
+        std::deque<int> expected{-3, -2, -1, 1, 2};
+        expected.insert(expected.end(), v.begin(), v.end());
+        Check(a, std::vector<int>(expected.begin(), expected.end()));
+        // The pushed front elements got a block of their own
+        for (int i = 3; i < 130; ++i) {
+            REQUIRE(&a[i] + 1 == &a[i + 1]);
+        }
+        a.PopFrontN(500);
+        a.PopBackN(200);
+        expected.erase(expected.begin(), expected.begin() + 500);
+        expected.erase(expected.end() - 200, expected.end());
+        Check(a, std::vector<int>(expected.begin(), expected.end()));
+        a.PopBackN(a.Size());
+        Check(a, std::vector<int>());
+        a.PushFrontRange(std::views::iota(0, 300));
+        a.PushBackRange(std::views::iota(0, 10) | std::views::filter([](int x) {
+                            return x % 2 == 0;
+                        }));
+        a.PushFrontRange(std::views::iota(0, 10) | std::views::filter([](int x) {
+                             return x % 2 == 1;
+                         }));
+        REQUIRE(a.Size() == 310u);
+        REQUIRE(a[0] == 1);
+        REQUIRE(a[4] == 9);
+        REQUIRE(a[5] == 0);
+        REQUIRE(a[304] == 299);
+        REQUIRE(a[309] == 8);
+    }
+    {
+        std::list<std::string> words{"a", "b", "c"};
+        Deque<std::string> a{"x"};
+        a.PushFrontRange(words);
+        a.PushBackRange(words);
+        REQUIRE(a.Size() == 7u);
+        REQUIRE(a[0] == "a");
+        REQUIRE(a[3] == "x");
+        REQUIRE(a[6] == "c");
+        a.PopFrontN(4);
+        REQUIRE(a[0] == "a");
+    }
+    {
+        Deque a;
+        std::deque<int> b;
+        std::mt19937 gen(735675);
+        for (int i = 0; i < 2000; ++i) {
+            int code = gen() % 4;
+            size_t count = gen() % 700;
+            if (code == 0) {
+                auto range = std::views::iota(i, i + static_cast<int>(count));
+                a.PushBackRange(range);
+                b.insert(b.end(), range.begin(), range.end());
+            } else if (code == 1) {
+                auto range = std::views::iota(i, i + static_cast<int>(count));
+                a.PushFrontRange(range);
+                b.insert(b.begin(), range.begin(), range.end());
+            } else if (code == 2) {
+                count = std::min(count, b.size());
+                a.PopFrontN(count);
+                b.erase(b.begin(), b.begin() + count);
+            } else {
+                count = std::min(count, b.size());
+                a.PopBackN(count);
+                b.erase(b.end() - count, b.end());
+            }
+            REQUIRE(a.Size() == b.size());
+            if (!b.empty()) {
+                REQUIRE(a[0] == b.front());
+                REQUIRE(a[a.Size() - 1] == b.back());
+                REQUIRE(a[a.Size() / 2] == b[b.size() / 2]);
+            }
+        }
+    }
+}
+
+namespace {
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+    size_t bytes = 0;
+    // Allocating throws std::bad_alloc once allocations reaches it
+    size_t allocation_limit = SIZE_MAX;
+
+private:
+    void* do_allocate(size_t size, size_t alignment) override {
+        if (allocations == allocation_limit) {
+            throw std::bad_alloc();
+        }
+        ++allocations;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, size_t size, size_t alignment) override {
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+}  // namespace
+
+namespace {
+// Throws from the copy constructor once copies_left copies were made
+struct ThrowsOnCopy {
+    static inline int alive = 0;
+    static inline int copies_left = 0;
+    std::string value = "long enough to be allocated on the heap";
+
+    ThrowsOnCopy() {
+        ++alive;
+    }
+    ThrowsOnCopy(const ThrowsOnCopy& other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy");
+        }
+        ++alive;
+    }
+    ThrowsOnCopy& operator=(const ThrowsOnCopy&) = default;
+    ~ThrowsOnCopy() {
+        --alive;
+    }
+};
+}  // namespace
+
+TEST_CASE("Copies that throw give everything back") {
+    const size_t size = 10 * deque_settings::kBlockSize<ThrowsOnCopy> + 3;
+    CountingResource resource;
+    CountingResource other_resource;
+    for (auto storage : {BlockStorage::kSeparate, BlockStorage::kSlab}) {
+        Deque<ThrowsOnCopy> a(storage, &resource);
+        for (size_t i = 0; i < size; ++i) {
+            a.EmplaceBack();
+        }
+        size_t bytes = resource.bytes;
+        for (auto *target : {&other_resource, &resource}) {
+            ThrowsOnCopy::copies_left = static_cast<int>(size / 2);
+            REQUIRE_THROWS_AS(Deque<ThrowsOnCopy>(a, target), std::runtime_error);
+            REQUIRE(ThrowsOnCopy::alive == static_cast<int>(size));
+            REQUIRE(resource.bytes == bytes);
+            REQUIRE(other_resource.bytes == 0);
+        }
+    }
+    REQUIRE(ThrowsOnCopy::alive == 0);
+}
+
+TEST_CASE("Reserve and ShrinkToFit") {
+    const int count = 100000;
+    for (auto storage : {BlockStorage::kSeparate, BlockStorage::kSlab}) {
+        CountingResource resource;
+        Deque a(storage, &resource);
+        a.PushBack(-1);
+        a.Reserve(count);
+        a.ReserveFront(count);
+        size_t allocations = resource.allocations;
+        for (int i = 0; i < count; ++i) {
+            a.PushBack(i);
+        }
+        REQUIRE(resource.allocations == allocations);
+        a.PopBackN(count);
+
+        a.Reserve(count);
+        a.ReserveFront(count);
+        allocations = resource.allocations;
+        for (int i = 0; i < count; ++i) {
+            a.PushFront(i);
+        }
+        REQUIRE(resource.allocations == allocations);
+        REQUIRE(a[0] == count - 1);
+        REQUIRE(a[count] == -1);
+
+        size_t bytes = resource.bytes;
+        a.PopFrontN(count);
+        a.ShrinkToFit();
+        // Only the block holding -1 (or, for slabs, its chunk) and the map stay allocated.
+        REQUIRE(resource.bytes < bytes / 10);
+        Check(a, std::vector<int>{-1});
+
+        for (int i = 0; i < 1000; ++i) {
+            a.PushBack(i);
+        }
+        a.Clear();
+        a.ShrinkToFit();
+        a.PushBack(1);
+        Check(a, std::vector<int>{1});
+    }
+}
+
+namespace {
+// Constant initialized, so it is usable before any dynamic initializer runs
+constinit Deque<int> static_deque;
+}  // namespace
+
+TEST_CASE("Empty deques allocate nothing") {
+    for (auto storage : {BlockStorage::kSeparate, BlockStorage::kSlab}) {
+        CountingResource resource;
+        {
+            Deque a(storage, &resource);
+            Deque b(&resource);
+            REQUIRE(a.Size() == 0);
+            REQUIRE(a.begin() == a.end());
+            a.Clear();
+            a.ShrinkToFit();
+            Deque c(std::move(a));
+            a.Swap(b);
+            REQUIRE(resource.allocations == 0);
+
+            // Deques of up to kInlineMapSize blocks allocate their blocks only
+            const size_t block = deque_settings::kBlockSize<int>;
+            for (size_t i = 0; i < block; ++i) {
+                a.PushBack(static_cast<int>(i));
+                a.PushFront(-static_cast<int>(i));
+            }
+            REQUIRE(a.Stats().map_capacity == deque_settings::kInlineMapSize);
+            REQUIRE(a.Stats().allocated_bytes == resource.bytes);
+            if (storage == BlockStorage::kSeparate) {
+                REQUIRE(resource.allocations == 2);
+            }
+
+            // Moves and swaps carry the slots of the inline map along
+            Deque d(std::move(a));
+            REQUIRE(a.Size() == 0);
+            REQUIRE(d.Size() == 2 * block);
+            REQUIRE(d[0] == -static_cast<int>(block - 1));
+            d.Swap(a);
+            REQUIRE(d.Size() == 0);
+            REQUIRE(a[a.Size() - 1] == static_cast<int>(block - 1));
+            a.PushBack(0);
+            REQUIRE(a.Stats().map_capacity == deque_settings::kBufferInitMaxSize);
+            Deque e(a, &resource);
+            REQUIRE(std::ranges::equal(e, a));
+            a.Clear();
+            a.PushFront(1);
+            Check(a, std::vector<int>{1});
+        }
+        REQUIRE(resource.bytes == 0);
+    }
+
+    REQUIRE(static_deque.Size() == 0);
+    static_deque.PushBack(1);
+    static_deque.PushFront(0);
+    Check(static_deque, std::vector<int>{0, 1});
+    REQUIRE(static_deque.GetMemoryResource() == std::pmr::get_default_resource());
+    static_deque.Clear();
+    static_deque.ShrinkToFit();
+}
+
+TEST_CASE("Map growth") {
+    const int size = 1 << 16;
+    std::mt19937 gen(8134);
+    Deque a;
+    std::deque<int> b;
+    for (int i = 0; i < size; ++i) {
+        // Alternating ends keeps the map growing while both ends move
+        int value = gen();
+        if (gen() % 2 == 0) {
+            a.PushBack(value);
+            b.push_back(value);
+        } else {
+            a.PushFront(value);
+            b.push_front(value);
+        }
+        if (gen() % 8 == 0) {
+            a.PopBack();
+            b.pop_back();
+        }
+        if (std::has_single_bit(static_cast<unsigned>(i)) and i > 1000) {
+            // Copies and reads while the next map is being filled in
+            Deque copy(a);
+            REQUIRE(std::ranges::equal(copy, b));
+            REQUIRE(std::ranges::equal(a, b));
+            REQUIRE(a[a.Size() / 2] == b[b.size() / 2]);
+        }
+    }
+    REQUIRE(std::ranges::equal(a, b));
+
+    // Growth cut short by each operation that needs the whole map
+    for (int step = 0; step < 3; ++step) {
+        Deque c;
+        std::deque<int> d;
+        // Just past a doubling of the map, while the next one is being filled in
+        for (int i = 0; i < size / 4 + 1000; ++i) {
+            c.PushFront(i);
+            d.push_front(i);
+        }
+        if (step == 0) {
+            c.ShrinkToFit();
+        } else if (step == 1) {
+            c.Reserve(size);
+        } else {
+            c.Clear();
+            d.clear();
+        }
+        for (int i = 0; i < size / 4; ++i) {
+            c.PushBack(i);
+            d.push_back(i);
+        }
+        REQUIRE(std::ranges::equal(c, d));
+        Deque moved(std::move(c));
+        REQUIRE(std::ranges::equal(moved, d));
+    }
+}
+
+TEST_CASE("Copies are independent and snapshots share blocks") {
+    const int size = 100000;
+    CountingResource resource;
+    Deque a(&resource);
+    std::vector<int> expected(size);
+    std::iota(expected.begin(), expected.end(), 0);
+    a.PushBackRange(expected);
+
+    // References taken before a copy only change the deque they came from
+    int &first = a[0];
+    Deque b(a, &resource);
+    first = -1;
+    REQUIRE(b[0] == 0);
+    first = 0;
+    Check(b, expected);
+
+    // A snapshot copies no element
+    size_t bytes = resource.bytes;
+    auto snapshot = a.Snapshot();
+    REQUIRE(resource.bytes - bytes < size * sizeof(int) / 4);
+    REQUIRE(std::ranges::equal(snapshot, expected));
+    // Indexing does not copy the shared blocks, writing through it needs Unshare first, which
+    // ForEachSegment calls itself
+    bytes = resource.bytes;
+    REQUIRE(a[size / 2] == size / 2);
+    REQUIRE(resource.bytes == bytes);
+    a.PushFront(-2);
+    a.PushBack(-3);
+    a.ForEachSegment([](std::span<int> segment) { segment.back() *= 2; });
+    a[size / 2 + 1] = -1;
+    REQUIRE(std::ranges::equal(snapshot.Get(), expected));
+    REQUIRE(a[0] == -4);
+    REQUIRE(a[size / 2 + 1] == -1);
+
+    // Whole lent blocks are dropped without being copied, only the two cut in the middle are
+    Deque c(&resource);
+    c.PushBackRange(expected);
+    auto trimmed = c.Snapshot();
+    size_t allocations = resource.allocations;
+    c.PopFrontN(size / 2);
+    c.PopBackN(size / 4);
+    REQUIRE(resource.allocations <= allocations + 2);
+    Check(c, std::vector<int>(expected.begin() + size / 2, expected.end() - size / 4));
+    REQUIRE(std::ranges::equal(trimmed, expected));
+
+    // A snapshot of a deque that still borrows from an older one, and snapshots that outlive
+    // their deque
+    auto later = c.Snapshot();
+    c.PushBack(-5);
+    c.Clear();
+    trimmed = later;
+    later = c.Snapshot();
+    REQUIRE(later.Size() == 0u);
+    REQUIRE(std::ranges::equal(trimmed,
+                               std::vector<int>(expected.begin() + size / 2,
+                                                expected.end() - size / 4)));
+
+    // Taking a snapshot after every change holds no more than the blocks of the snapshots
+    // that are alive
+    bytes = resource.bytes;
+    for (int i = 0; i < 1000; ++i) {
+        c.PushBack(i);
+        later = c.Snapshot();
+    }
+    REQUIRE(resource.bytes - bytes < 2 * c.Stats().allocated_bytes);
+    c.Clear();
+    REQUIRE(later.Size() == 1000u);
+    REQUIRE(later[999] == 999);
+
+    // Snapshots are read on one thread while the deque is written on another
+    Deque d(&resource);
+    d.PushBackRange(expected);
+    auto e = d.Snapshot();
+    std::thread writer([&d] {
+        d.Unshare();
+        for (size_t i = 0; i < d.Size(); i += 100) {
+            d[i] = -1;
+        }
+        d.PopFrontN(d.Size() / 2);
+    });
+    REQUIRE(std::ranges::equal(e, expected));
+    writer.join();
+    REQUIRE(d[100] == -1);
+
+    // Slab blocks are copied right away
+    Deque slab(BlockStorage::kSlab, &resource);
+    slab.PushBackRange(expected);
+    auto f = slab.Snapshot();
+    slab.Clear();
+    slab.ShrinkToFit();
+    REQUIRE(std::ranges::equal(f, expected));
+
+    std::vector<std::string> strings(1000, "long enough to be allocated on the heap");
+    Deque<std::string> g;
+    g.PushBackRange(strings);
+    {
+        auto h = g.Snapshot();
+        g.Unshare();
+        g[0] = "changed";
+        REQUIRE(h[0] == strings[0]);
+    }
+    REQUIRE(std::as_const(g)[0] == "changed");
+}
+
+TEST_CASE("Assignment reuses blocks") {
+    static_assert(std::is_nothrow_move_constructible_v<Deque<int>>);
+    static_assert(std::is_nothrow_move_assignable_v<Deque<std::string>>);
+    static_assert(std::is_nothrow_swappable_v<Deque<int>>);
+
+    const int size = 10000;
+    std::vector<int> expected(size);
+    std::iota(expected.begin(), expected.end(), 0);
+    CountingResource resource;
+    Deque a(&resource);
+    a.PushBackRange(expected);
+
+    // Elements are copied into the blocks and the map b already has
+    CountingResource other_resource;
+    Deque b(&other_resource);
+    b.PushBackRange(std::views::iota(0, 2 * size));
+    size_t allocations = other_resource.allocations;
+    b = a;
+    Check(b, expected);
+    // Only the list of the blocks b keeps for reuse
+    REQUIRE(other_resource.allocations == allocations + 1);
+    REQUIRE(b.GetMemoryResource() == &other_resource);
+    b[0] = -1;
+    REQUIRE(a[0] == 0);
+    const Deque small{1, 2, 3};
+    b = small;
+    Check(b, std::vector<int>{1, 2, 3});
+    REQUIRE(b.GetMemoryResource() == &other_resource);
+
+    // Assigning a deque of the same size again allocates nothing
+    Deque c(&resource);
+    c.PushBackRange(std::views::iota(0, size));
+    c = b;
+    c = a;
+    allocations = resource.allocations;
+    c = a;
+    REQUIRE(resource.allocations == allocations);
+    c.PushFront(-1);
+    Check(a, expected);
+    REQUIRE(c[1] == 0);
+    c = c;
+    REQUIRE(c.Size() == size + 1u);
+
+    Deque slab(BlockStorage::kSlab, &other_resource);
+    slab = a;
+    REQUIRE(slab.GetStorage() == BlockStorage::kSlab);
+    Check(slab, expected);
+
+    // A copy constructor that may throw goes through a new deque, which keeps the resource
+    std::vector<std::string> strings(1000, "long enough to be allocated on the heap");
+    Deque<std::string> d(&resource);
+    d.PushBackRange(strings);
+    Deque<std::string> e(&other_resource);
+    e.PushBack("e");
+    e = d;
+    REQUIRE(e.GetMemoryResource() == &other_resource);
+    REQUIRE(std::ranges::equal(std::as_const(e), strings));
+
+    // An assignment that runs out of memory keeps the blocks the deque lent to a snapshot
+    {
+        CountingResource limited;
+        Deque g(&limited);
+        g.PushBackRange(std::views::iota(0, 10));
+        auto snapshot = g.Snapshot();
+        limited.allocation_limit = limited.allocations;
+        REQUIRE_THROWS_AS(g = a, std::bad_alloc);
+        limited.allocation_limit = SIZE_MAX;
+        REQUIRE(std::ranges::equal(std::as_const(g), std::views::iota(0, 10)));
+        REQUIRE(std::ranges::equal(snapshot, std::views::iota(0, 10)));
+    }
+
+    // Moves leave an empty deque behind, which can be assigned to again
+    Deque f(std::move(a));
+    REQUIRE(a.Size() == 0u);
+    Check(f, expected);
+    a = std::move(f);
+    REQUIRE(f.Size() == 0u);
+    f = a;
+    Check(f, expected);
+    std::vector<Deque<int>> deques;
+    for (int i = 0; i < 100; ++i) {
+        deques.emplace_back(Deque<int>{i, i + 1});
+    }
+    for (int i = 0; i < 100; ++i) {
+        Check(deques[i], std::vector<int>{i, i + 1});
+    }
+}
+
+TEST_CASE("Append, Prepend and SplitAt") {
+    const int block = deque_settings::kBlockSize<int>;
+    auto make = [](int first, int count) {
+        std::vector<int> values(count);
+        std::iota(values.begin(), values.end(), first);
+        return values;
+    };
+    {
+        // a ends with a full block and b starts a block, so the blocks of b change hands
+        Deque a;
+        a.PushBackRange(make(0, 2 * block));
+        Deque b;
+        b.PushBackRange(make(2 * block, 1000));
+        const int *moved = &std::as_const(b)[500];
+        a.Append(std::move(b));
+        REQUIRE(b.Size() == 0);
+        REQUIRE(&std::as_const(a)[2 * block + 500] == moved);
+        Check(a, make(0, 2 * block + 1000));
+
+        const int *kept = &std::as_const(a)[a.Size() - 1];
+        Deque c = a.SplitAt(300);
+        REQUIRE(&std::as_const(c)[c.Size() - 1] == kept);
+        Check(a, make(0, 300));
+        Check(c, make(300, 2 * block + 700));
+
+        // The split pieces still line up
+        a.Append(std::move(c));
+        Check(a, make(0, 2 * block + 1000));
+        c.PushBack(1);
+        Check(c, {1});
+
+        Deque d = a.SplitAt(0);
+        Check(a, {});
+        a.Prepend(std::move(d));
+        Check(a, make(0, 2 * block + 1000));
+        Deque e = a.SplitAt(block);
+        e.Prepend(std::move(a));
+        Check(e, make(0, 2 * block + 1000));
+        Check(a, {});
+    }
+    {
+        std::mt19937 gen(3141);
+        Deque a;
+        std::deque<int> expected;
+        int next = 0;
+        auto make_random = [&](std::deque<int> &values) {
+            Deque result;
+            int back = gen() % (3 * block);
+            int front = gen() % (3 * block);
+            for (int i = 0; i < back; ++i) {
+                result.PushBack(next);
+                values.push_back(next++);
+            }
+            for (int i = 0; i < front; ++i) {
+                result.PushFront(next);
+                values.push_front(next++);
+            }
+            return result;
+        };
+        for (int i = 0; i < 2000; ++i) {
+            int code = gen() % 3;
+            if (code == 0) {
+                std::deque<int> values;
+                Deque other = make_random(values);
+                a.Append(std::move(other));
+                expected.insert(expected.end(), values.begin(), values.end());
+                REQUIRE(other.Size() == 0);
+            } else if (code == 1) {
+                std::deque<int> values;
+                Deque other = make_random(values);
+                a.Prepend(std::move(other));
+                expected.insert(expected.begin(), values.begin(), values.end());
+                REQUIRE(other.Size() == 0);
+            } else {
+                size_t index = gen() % (expected.size() + 1);
+                Deque back = a.SplitAt(index);
+                REQUIRE(std::ranges::equal(std::as_const(back),
+                                           expected | std::views::drop(index)));
+                expected.resize(index);
+                if (gen() % 2 == 0) {
+                    back.Append(std::move(a));
+                    std::swap(a, back);
+                    expected.clear();
+                    std::ranges::copy(std::as_const(a), std::back_inserter(expected));
+                }
+            }
+            REQUIRE(std::ranges::equal(std::as_const(a), expected));
+            if (expected.size() > 20 * block) {
+                a.PopFrontN(expected.size() / 2);
+                expected.erase(expected.begin(), expected.begin() + expected.size() / 2);
+            }
+        }
+    }
+    {
+        // Deques that can not trade blocks
+        CountingResource resource;
+        Deque a(BlockStorage::kSlab, &resource);
+        a.PushBackRange(make(0, 1000));
+        Deque b;
+        b.PushBackRange(make(1000, 1000));
+        a.Append(std::move(b));
+        Deque c(&resource);
+        c.PushBackRange(make(-1000, 1000));
+        a.Prepend(std::move(c));
+        Check(a, make(-1000, 3000));
+        Deque d = a.SplitAt(1500);
+        REQUIRE(d.GetStorage() == BlockStorage::kSlab);
+        Check(a, make(-1000, 1500));
+        Check(d, make(500, 1500));
+    }
+    {
+        Deque<std::string> a;
+        Deque<std::string> b;
+        for (int i = 0; i < 300; ++i) {
+            a.PushBack(std::string(50, 'a' + i % 26));
+            b.PushFront(std::string(50, 'b'));
+        }
+        a.Append(std::move(b));
+        Deque<std::string> c = a.SplitAt(100);
+        c.Prepend(std::move(a));
+        REQUIRE(c.Size() == 600);
+        REQUIRE(c[27] == std::string(50, 'b'));
+        REQUIRE(c[599] == std::string(50, 'b'));
+        REQUIRE(c[299] == std::string(50, 'a' + 299 % 26));
+    }
+    {
+        // Our only block moves its elements to the tail block of other, and a snapshot that
+        // shares it keeps them
+        const size_t block = deque_settings::kBlockSize<std::string>;
+        Deque<std::string> a;
+        for (size_t i = 0; i < block / 2; ++i) {
+            a.PushBack(std::string(50, 'a' + i % 26));
+        }
+        a.PopFrontN(block / 4);
+        Deque<std::string> b;
+        for (size_t i = 0; i < block + block / 4; ++i) {
+            b.PushBack(std::string(50, 'b'));
+        }
+        auto snapshot = a.Snapshot();
+        a.Prepend(std::move(b));
+        REQUIRE(a.Size() == block + block / 2);
+        REQUIRE(std::as_const(a)[block + block / 4] == std::string(50, 'a' + block / 4 % 26));
+        REQUIRE(snapshot.Size() == block / 4);
+        for (size_t i = 0; i < snapshot.Size(); ++i) {
+            REQUIRE(snapshot[i] == std::string(50, 'a' + (block / 4 + i) % 26));
+        }
+    }
+}
+
+TEST_CASE("Insert and Erase") {
+    {
+        Deque a;
+        a.PushBackRange(std::views::iota(0, 1000));
+        a.Erase(500, 10);
+        a.Insert(500, -1);
+        a.InsertRange(0, std::vector<int>{-3, -2});
+        REQUIRE(a.Emplace(a.Size(), 1000) == 1000);
+        REQUIRE(a.Size() == 994);
+        REQUIRE(a[0] == -3);
+        REQUIRE(a[2] == 0);
+        REQUIRE(a[501] == 499);
+        REQUIRE(a[502] == -1);
+        REQUIRE(a[503] == 510);
+        REQUIRE(a[993] == 1000);
+
+        // Erasing the front half moves the few elements before it
+        const int *last = &std::as_const(a)[993];
+        a.Erase(3, 400);
+        REQUIRE(&std::as_const(a)[593] == last);
+        REQUIRE(a[2] == 0);
+        REQUIRE(a[3] == 401);
+
+        const Deque snapshot = a;
+        a.Erase(100, 100);
+        a.InsertRange(300, std::views::iota(0, 200) |
+                                   std::views::filter([](int x) { return x % 2 == 0; }));
+        REQUIRE(a.Size() == snapshot.Size());
+        REQUIRE(snapshot[100] == 498);
+        REQUIRE(a[100] == 607);
+        REQUIRE(a[300] == 0);
+    }
+    auto run = []<class D>(D deque, auto make) {
+        using Value = typename D::value_type;
+        std::deque<Value> expected;
+        std::mt19937 gen(2718);
+        for (int i = 0; i < 3000; ++i) {
+            size_t index = gen() % (expected.size() + 1);
+            int code = gen() % 5;
+            if (code == 0 and !expected.empty()) {
+                index = std::min(index, expected.size() - 1);
+                size_t count = gen() % (expected.size() - index + 1);
+                if (gen() % 4 == 0) {
+                    count = std::min<size_t>(count, 3);
+                }
+                deque.Erase(index, count);
+                expected.erase(expected.begin() + index, expected.begin() + index + count);
+            } else if (code == 1) {
+                Value value = make(i);
+                deque.Insert(index, value);
+                expected.insert(expected.begin() + index, value);
+            } else {
+                std::vector<Value> values;
+                size_t count = gen() % (code == 2 ? 8 : 300);
+                for (size_t j = 0; j < count; ++j) {
+                    values.push_back(make(i * 1000 + j));
+                }
+                deque.InsertRange(index, values);
+                // libstdc++ 12 std::deque loses an element on inserting an empty range
+                if (!values.empty()) {
+                    expected.insert(expected.begin() + index, values.begin(), values.end());
+                }
+            }
+            REQUIRE(std::ranges::equal(std::as_const(deque), expected));
+            if (expected.size() > 5000) {
+                deque.PopBackN(expected.size() - 2000);
+                expected.resize(2000);
+            }
+        }
+    };
+    run(Deque<int>(), [](int x) { return x; });
+    run(SmallBlockDeque<int>(BlockStorage::kSlab), [](int x) { return x; });
+    run(SmallBlockDeque<std::string>(),
+        [](int x) { return std::to_string(x) + std::string(20, 'x'); });
+    {
+        Deque<std::unique_ptr<int>> a;
+        for (int i = 0; i < 100; ++i) {
+            a.PushBack(std::make_unique<int>(i));
+        }
+        a.Insert(50, std::make_unique<int>(-1));
+        a.Erase(10, 5);
+        REQUIRE(*a[45] == -1);
+        REQUIRE(*a[10] == 15);
+        REQUIRE(a.Size() == 96);
+    }
+}
+
+TEST_CASE("Iterators") {
+    static_assert(std::random_access_iterator<Deque<int>::iterator>);
+    static_assert(std::random_access_iterator<Deque<int>::const_iterator>);
+    static_assert(std::ranges::random_access_range<const Deque<std::string>>);
+
+    Deque empty;
+    REQUIRE(empty.begin() == empty.end());
+    REQUIRE(std::ranges::distance(empty) == 0);
+
+    const int count = 1000;
+    Deque a;
+    std::deque<int> b;
+    for (int i = 0; i < count; ++i) {
+        a.PushBack(i);
+        a.PushFront(-i);
+        b.push_back(i);
+        b.push_front(-i);
+    }
+    REQUIRE(a.end() - a.begin() == 2 * count);
+    REQUIRE(std::ranges::equal(a, b));
+    REQUIRE(std::ranges::equal(a | std::views::reverse, b | std::views::reverse));
+
+    auto it = a.begin();
+    for (int offset : {0, 1, 127, 128, 129, 1000, 1999, 1000, 5, 130}) {
+        it = a.begin() + offset;
+        REQUIRE(*it == b[offset]);
+        REQUIRE(it[-offset] == b.front());
+        REQUIRE(a.end() - (a.end() - offset) == offset);
+    }
+    REQUIRE(std::prev(a.end()) == a.begin() + (2 * count - 1));
+    REQUIRE(*std::prev(a.end()) == b.back());
+
+    std::mt19937 gen(5124);
+    std::ranges::shuffle(a, gen);
+    std::ranges::sort(a);
+    std::ranges::sort(b);
+    REQUIRE(std::ranges::equal(a, b));
+
+    const Deque<int> &c = a;
+    Deque<int>::const_iterator cit = a.begin();
+    REQUIRE(cit == c.begin());
+    REQUIRE(std::ranges::lower_bound(c, 0) - c.begin() == count - 1);
+    for (int &value : a) {
+        value *= 2;
+    }
+    REQUIRE(*std::ranges::max_element(c) == 2 * (count - 1));
+}
+
+TEST_CASE("Segments") {
+    Deque a;
+    long long expected = 0;
+    for (int i = 0; i < 1000; ++i) {
+        a.PushFront(i);
+        a.PushBack(-2 * i);
+        expected -= i;
+    }
+    long long sum = 0;
+    size_t elements = 0;
+    const int *next = nullptr;
+    std::as_const(a).ForEachSegment([&](std::span<const int> segment) {
+        REQUIRE(!segment.empty());
+        REQUIRE(segment.size() <= 128u);
+        REQUIRE(segment.data() == &a[elements]);
+        next = segment.data() + segment.size();
+        for (int value : segment) {
+            sum += value;
+        }
+        elements += segment.size();
+    });
+    REQUIRE(sum == expected);
+    REQUIRE(elements == a.Size());
+    REQUIRE(next == &a[a.Size() - 1] + 1);
+
+    a.ForEachSegment([](std::span<int> segment) { std::ranges::fill(segment, 7); });
+    REQUIRE(std::ranges::count(a, 7) == 2000);
+
+    Deque empty;
+    empty.ForEachSegment([](std::span<int>) { FAIL(); });
+
+    size_t segment = 0;
+    for (std::span<const int> view : std::as_const(a).Segments()) {
+        REQUIRE(view.data() == a.GetSegment(segment).data());
+        REQUIRE(view.size() == a.GetSegment(segment).size());
+        ++segment;
+    }
+    REQUIRE(segment == a.GetSegmentsCount());
+    REQUIRE(std::ranges::size(a.Segments()) == a.GetSegmentsCount());
+    REQUIRE(std::ranges::empty(empty.Segments()));
+}
+
+TEST_CASE("Linearize and AsContiguous") {
+    Deque a;
+    for (int i = 0; i < 1000; ++i) {
+        a.PushFront(i);
+        a.PushBack(-i);
+    }
+    std::vector<int> buffer(a.Size() + 3, 5);
+    std::span<int> linear = a.Linearize(buffer);
+    REQUIRE(linear.data() == buffer.data());
+    REQUIRE(std::ranges::equal(linear, a));
+    REQUIRE(buffer.back() == 5);
+    std::span<const int> contiguous = a.AsContiguous(buffer);
+    REQUIRE(contiguous.data() == buffer.data());
+    REQUIRE(std::ranges::equal(contiguous, a));
+
+    // Elements in a single block are not copied
+    Deque b{1, 2, 3};
+    contiguous = b.AsContiguous(buffer);
+    REQUIRE(contiguous.data() == &b[0]);
+    REQUIRE(std::ranges::equal(contiguous, b));
+    REQUIRE(Deque().AsContiguous({}).empty());
+
+    Deque<std::string> strings;
+    for (int i = 0; i < 100; ++i) {
+        strings.PushFront(std::to_string(i));
+    }
+    std::vector<std::string> copies(100);
+    REQUIRE(std::ranges::equal(strings.Linearize(copies), strings));
+    REQUIRE(strings[0] == "99");
+}
+
+TEST_CASE("Vectored I/O") {
+    Deque<int64_t> a;
+    for (int i = 0; i < 100000; ++i) {
+        a.PushBack(i);
+        a.PushFront(-i);
+    }
+    iovec vectors[4];
+    REQUIRE(deque_io::GetIoVectors(a, vectors) == 4);
+    REQUIRE(vectors[0].iov_base == &a[0]);
+    REQUIRE(vectors[0].iov_len == a.GetSegment(0).size_bytes());
+    REQUIRE(vectors[1].iov_base == a.GetSegment(1).data());
+    size_t last = a.GetSegmentsCount() - 1;
+    REQUIRE(deque_io::GetIoVectors(a, vectors, last) == 1);
+    REQUIRE(vectors[0].iov_len == a.GetSegment(last).size_bytes());
+
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    int fd = fileno(file);
+    size_t bytes = a.Size() * sizeof(int64_t);
+    REQUIRE(deque_io::WriteTo(fd, a) == static_cast<ssize_t>(bytes));
+    std::vector<int64_t> read_back(a.Size());
+    REQUIRE(pread(fd, read_back.data(), bytes, 0) == static_cast<ssize_t>(bytes));
+    REQUIRE(std::ranges::equal(read_back, a));
+    REQUIRE(deque_io::WriteTo(fd, Deque<int64_t>()) == 0);
+    REQUIRE(deque_io::WriteTo(-1, a) == -1);
+    std::fclose(file);
+}
+
+TEST_CASE("Save and load") {
+    char path[] = "/tmp/deque_imageXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    Deque a;
+    std::deque<int> expected;
+    for (int i = 0; i < 10000; ++i) {
+        a.PushBack(i);
+        expected.push_back(i);
+        if (i % 3 == 0) {
+            a.PushFront(-i);
+            expected.push_front(-i);
+        }
+    }
+    REQUIRE(deque_io::SaveTo(path, a));
+    for (auto mode : {deque_io::LoadMode::kMap, deque_io::LoadMode::kCopy}) {
+        CountingResource resource;
+        Deque b(&resource);
+        REQUIRE(deque_io::LoadFrom(path, b, mode));
+        REQUIRE(std::ranges::equal(std::as_const(b), expected));
+        DequeStats stats = b.Stats();
+        REQUIRE(stats.live_blocks == a.GetSegmentsCount());
+        // Mapped blocks are not allocated
+#ifdef DEQUE_STATS
+        if (mode == deque_io::LoadMode::kMap) {
+            REQUIRE(stats.block_allocations == 0);
+        } else {
+            REQUIRE(stats.block_allocations == stats.live_blocks);
+        }
+#endif
+        REQUIRE(stats.allocated_bytes == resource.bytes);
+
+        // Writes go to the private mapping, a copy of b copies the mapped blocks
+        Deque c(b);
+        b[0] = 100;
+        b[5000] = 200;
+        b.PopBack();
+        b.PushFront(300);
+        b.PushBack(400);
+        REQUIRE(b[1] == 100);
+        REQUIRE(b[5001] == 200);
+        REQUIRE(b[0] == 300);
+        REQUIRE(b[b.Size() - 1] == 400);
+        b = Deque();
+        REQUIRE(std::ranges::equal(std::as_const(c), expected));
+        c.PopFrontN(5000);
+        c.ShrinkToFit();
+        REQUIRE(std::ranges::equal(std::as_const(c), expected | std::views::drop(5000)));
+    }
+    Deque reloaded;
+    REQUIRE(deque_io::LoadFrom(path, reloaded));
+    REQUIRE(std::ranges::equal(std::as_const(reloaded), expected));
+
+    // Images of other deques and broken files are refused and the deque stays as it was
+    Deque<int64_t> other{1, 2, 3};
+    REQUIRE(!deque_io::LoadFrom(path, other));
+    REQUIRE(errno == EINVAL);
+    REQUIRE(other.Size() == 3u);
+    fd = open(path, O_WRONLY);
+    REQUIRE(pwrite(fd, "garbage", 7, 0) == 7);
+    close(fd);
+    REQUIRE(!deque_io::LoadFrom(path, reloaded));
+    REQUIRE(reloaded.Size() == expected.size());
+    REQUIRE(truncate(path, 0) == 0);
+    REQUIRE(!deque_io::LoadFrom(path, reloaded));
+    REQUIRE(!deque_io::LoadFrom("/nonexistent/deque", reloaded));
+    REQUIRE(errno == ENOENT);
+
+    REQUIRE(deque_io::SaveTo(path, Deque()));
+    REQUIRE(deque_io::LoadFrom(path, reloaded));
+    REQUIRE(reloaded.Size() == 0u);
+    reloaded.PushFront(1);
+    Check(reloaded, std::vector<int>{1});
+    unlink(path);
+}
+
+TEST_CASE("Operation traces") {
+    using deque_trace::Entry;
+    using deque_trace::Op;
+
+    deque_trace::TraceWriter writer;
+    deque_trace::RecordingDeque<int> a(writer);
+    std::vector<Entry> recorded;
+    std::mt19937 gen(735675);
+    size_t peak_size = 0;
+    for (int i = 0; i < 100000; ++i) {
+        int code = gen() % 10;
+        size_t size = a.Size();
+        if (code < 3) {
+            a.PushBack(i);
+            recorded.push_back({Op::kPushBack});
+        } else if (code < 5) {
+            a.PushFront(i);
+            recorded.push_back({Op::kPushFront});
+        } else if (code < 6 and size > 0) {
+            a.PopBack();
+            recorded.push_back({Op::kPopBack});
+        } else if (code < 7 and size > 0) {
+            a.PopFront();
+            recorded.push_back({Op::kPopFront});
+        } else if (code < 8 and size > 0) {
+            size_t ind = gen() % size;
+            REQUIRE(a[ind] == a.GetDeque()[ind]);
+            recorded.push_back({Op::kIndex, ind});
+        } else if (code < 9) {
+            size_t count = gen() % 40;
+            a.PushFrontRange(std::views::iota(0, static_cast<int>(count)));
+            recorded.push_back({Op::kPushFrontRange, count});
+        } else if (size > 0) {
+            size_t count = gen() % size;
+            a.PopBackN(count);
+            recorded.push_back({Op::kPopBackN, count});
+        }
+        peak_size = std::max(peak_size, a.Size());
+    }
+    a.Clear();
+    recorded.push_back({Op::kClear});
+    REQUIRE(writer.GetEntriesCount() == recorded.size());
+
+    std::vector<std::byte> bytes(writer.GetBytes().begin(), writer.GetBytes().end());
+    Deque<Entry> entries;
+    size_t read_peak_size = 0;
+    REQUIRE(deque_trace::ReadTrace(bytes, entries, &read_peak_size));
+    REQUIRE(std::ranges::equal(entries, recorded));
+    REQUIRE(read_peak_size == peak_size);
+
+    // Pushes and pops take a byte, larger arguments follow the first byte
+    deque_trace::TraceWriter small;
+    size_t empty_bytes = small.GetBytes().Size();
+    small.Record(Op::kPushBack);
+    small.Record(Op::kPopFront);
+    small.Record(Op::kPushBackRange, 14);
+    REQUIRE(small.GetBytes().Size() == empty_bytes + 3);
+    small.Record(Op::kPushBackRange, 15);
+    REQUIRE(small.GetBytes().Size() == empty_bytes + 5);
+    small.Record(Op::kPushFrontRange, 15 + 128);
+    REQUIRE(small.GetBytes().Size() == empty_bytes + 8);
+    small.Record(Op::kPopFrontN, 15 + 128 + 14);
+    small.Record(Op::kIndex, 0);
+    bytes.assign(small.GetBytes().begin(), small.GetBytes().end());
+    entries.Clear();
+    REQUIRE(deque_trace::ReadTrace(bytes, entries));
+    REQUIRE(std::ranges::equal(entries, std::vector<Entry>{{Op::kPushBack},
+                                                           {Op::kPopFront},
+                                                           {Op::kPushBackRange, 14},
+                                                           {Op::kPushBackRange, 15},
+                                                           {Op::kPushFrontRange, 143},
+                                                           {Op::kPopFrontN, 157},
+                                                           {Op::kIndex, 0}}));
+
+    // Malformed traces and traces that a deque could not replay are refused
+    auto is_read = [](std::vector<std::byte> trace) {
+        Deque<Entry> entries;
+        return deque_trace::ReadTrace(trace, entries);
+    };
+    std::vector<std::byte> header = bytes;
+    header.resize(empty_bytes);
+    REQUIRE(is_read(header));
+    REQUIRE(!is_read({}));
+    REQUIRE(!is_read(std::vector<std::byte>(header.begin(), header.end() - 1)));
+    auto with = [&](std::initializer_list<int> codes) {
+        std::vector<std::byte> trace = header;
+        for (int code : codes) {
+            trace.push_back(static_cast<std::byte>(code));
+        }
+        return trace;
+    };
+    REQUIRE(is_read(with({0x00, 0x03})));
+    REQUIRE(!is_read(with({0x03})));
+    REQUIRE(!is_read(with({0x00, 0x14})));
+    REQUIRE(!is_read(with({0x0f})));
+    REQUIRE(!is_read(with({0xf5, 0x80})));
+    REQUIRE(!is_read(with({0x00, 0x28})));
+
+    // Counts that would take the size past kMaxSize are refused too
+    deque_trace::TraceWriter large;
+    large.Record(Op::kPushFrontRange, deque_trace::kMaxSize - 1);
+    large.Record(Op::kPushBack);
+    REQUIRE(is_read({large.GetBytes().begin(), large.GetBytes().end()}));
+    large.Record(Op::kPushBackRange, 1);
+    REQUIRE(!is_read({large.GetBytes().begin(), large.GetBytes().end()}));
+    deque_trace::TraceWriter huge;
+    huge.Record(Op::kPushBackRange, UINT64_MAX);
+    REQUIRE(!is_read({huge.GetBytes().begin(), huge.GetBytes().end()}));
+}
+
+TEST_CASE("Sliding window") {
+    std::mt19937 gen(9);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+    const int block = deque_settings::kBlockSize<int>;
+    for (size_t capacity : {1, 7, block, block + 1, 1000}) {
+        CountingResource resource;
+        BoundedDeque<int, deque_settings::kBlockBytes, WindowSum<int>, WindowMin<int>,
+                     WindowMax<int>>
+                window(capacity, &resource);
+        std::deque<int> expected;
+        size_t allocations = resource.allocations;
+        for (int i = 0; i < 20000; ++i) {
+            int value = dist(gen);
+            // Runs of equal values leave the monotone deques one by one
+            if (i % 100 < 5) {
+                value = 7;
+            }
+            window.PushBack(value);
+            expected.push_back(value);
+            if (expected.size() > capacity) {
+                expected.pop_front();
+            }
+            REQUIRE(window.Size() == expected.size());
+            REQUIRE(window.GetAggregate<WindowSum<int>>().GetValue() ==
+                    std::accumulate(expected.begin(), expected.end(), 0));
+            REQUIRE(window.GetAggregate<WindowMin<int>>().GetValue() ==
+                    *std::ranges::min_element(expected));
+            REQUIRE(window.GetAggregate<WindowMax<int>>().GetValue() ==
+                    *std::ranges::max_element(expected));
+        }
+        REQUIRE(window.IsFull());
+        REQUIRE(std::ranges::equal(window, expected));
+        // Everything was allocated by the constructor
+        REQUIRE(resource.allocations == allocations);
+#ifdef DEQUE_STATS
+        // With whole blocks left after an eviction the emptied one moves straight to the tail
+        if (capacity > 1 and capacity % block == 1) {
+            REQUIRE(window.GetElements().Stats().blocks_recycled > 0);
+        }
+#endif
+
+        window.PopFront();
+        expected.pop_front();
+        REQUIRE(window.Size() == expected.size());
+        if (!expected.empty()) {
+            REQUIRE(window.GetAggregate<WindowMin<int>>().GetValue() ==
+                    *std::ranges::min_element(expected));
+        }
+        window.Clear();
+        window.PushBack(5);
+        REQUIRE(window.GetAggregate<WindowSum<int>>().GetValue() == 5);
+        REQUIRE(window.GetAggregate<WindowMax<int>>().GetValue() == 5);
+    }
+
+    // A window lending its blocks to a snapshot leaves the snapshot as it was
+    Deque<int> a;
+    for (int i = 0; i < block; ++i) {
+        a.PushBackEvict(block, i);
+    }
+    auto snapshot = a.Snapshot();
+    for (int i = 0; i < 3 * block; ++i) {
+        a.PushBackEvict(block, block + i);
+    }
+    REQUIRE(a.Size() == block);
+    REQUIRE(a[0] == 3 * block);
+    REQUIRE(snapshot[block - 1] == block - 1);
+
+    // The pushed value may be the element that is evicted for it, with room in the last block
+    // and without
+    const size_t string_block = deque_settings::kBlockSize<std::string>;
+    for (size_t capacity : {size_t{1}, size_t{5}, string_block, string_block + 1}) {
+        Deque<std::string> strings;
+        BoundedDeque<std::string> window(capacity);
+        std::deque<std::string> expected;
+        for (size_t i = 0; i < 5 * string_block; ++i) {
+            std::string value(50, 'a' + i % 26);
+            if (i % 3 == 0 and !expected.empty()) {
+                value = expected.front();
+                strings.PushBackEvict(capacity, strings[0]);
+                window.PushBack(window[0]);
+            } else {
+                strings.PushBackEvict(capacity, value);
+                window.PushBack(value);
+            }
+            expected.push_back(value);
+            if (expected.size() > capacity) {
+                expected.pop_front();
+            }
+        }
+        REQUIRE(std::ranges::equal(std::as_const(strings), expected));
+        REQUIRE(std::ranges::equal(window, expected));
+    }
+
+    // A constructor that throws evicts nothing
+    Deque<ThrowsOnCopy> throwing;
+    for (size_t i = 0; i < 3; ++i) {
+        throwing.EmplaceBack();
+    }
+    ThrowsOnCopy::copies_left = 0;
+    REQUIRE_THROWS_AS(throwing.PushBackEvict(3, throwing[0]), std::runtime_error);
+    REQUIRE(throwing.Size() == 3u);
+    REQUIRE(ThrowsOnCopy::alive == 3);
+}
+
+TEST_CASE("Segment kernels") {
+    std::mt19937 gen(9127);
+    std::uniform_int_distribution<int> dist(-1000000, 1000000);
+    for (int front : {0, 1, 3, 8, 100, 128, 1000}) {
+        Deque a;
+        std::vector<int> b;
+        for (int i = 0; i < 3000; ++i) {
+            int value = dist(gen);
+            a.PushBack(value);
+            b.push_back(value);
+        }
+        for (int i = 0; i < front; ++i) {
+            int value = dist(gen);
+            a.PushFront(value);
+            b.insert(b.begin(), value);
+        }
+        a.PopBackN(7);
+        b.resize(b.size() - 7);
+
+        REQUIRE(deque_simd::Sum(a) == std::accumulate(b.begin(), b.end(), int64_t{0}));
+        auto [min, max] = deque_simd::MinMax(a);
+        REQUIRE(min == *std::ranges::min_element(b));
+        REQUIRE(max == *std::ranges::max_element(b));
+        for (size_t index : {size_t{0}, size_t{5}, size_t{131}, b.size() / 2, b.size() - 1}) {
+            auto it = deque_simd::Find(a, b[index]);
+            REQUIRE(it - a.begin() == std::ranges::find(b, b[index]) - b.begin());
+            REQUIRE(deque_simd::Count(a, b[index]) ==
+                    static_cast<size_t>(std::ranges::count(b, b[index])));
+        }
+        REQUIRE(deque_simd::Find(std::as_const(a), 2000000) == a.cend());
+        REQUIRE(deque_simd::Count(a, 2000000) == 0u);
+
+        deque_simd::Transform(a, [](int x) { return x / 2 + 1; });
+        REQUIRE(deque_simd::Sum(a) ==
+                std::accumulate(b.begin(), b.end(), int64_t{0},
+                                [](int64_t sum, int x) { return sum + x / 2 + 1; }));
+        deque_simd::Fill(a, 5);
+        REQUIRE(deque_simd::Count(a, 5) == a.Size());
+        REQUIRE(deque_simd::MinMax(a) == std::pair{5, 5});
+    }
+
+    Deque<double> c{1.5, -2.0, 4.0};
+    REQUIRE(deque_simd::Sum(c) == 3.5);
+    REQUIRE(deque_simd::MinMax(c) == std::pair{-2.0, 4.0});
+    REQUIRE(deque_simd::Find(c, 4.0) - c.begin() == 2);
+    Deque empty;
+    REQUIRE(deque_simd::Sum(empty) == 0);
+    REQUIRE(deque_simd::Find(empty, 1) == empty.end());
+}
+
+TEST_CASE("Parallel algorithms") {
+    auto check = [](auto policy) {
+        SmallBlockDeque<int> deque;
+        std::vector<int> expected;
+        std::mt19937 gen(1618);
+        for (int i = 0; i < 100000; ++i) {
+            int value = static_cast<int>(gen() % 1000000) - 500000;
+            if (i % 3 == 0) {
+                deque.PushFront(value);
+                expected.insert(expected.begin(), value);
+            } else {
+                deque.PushBack(value);
+                expected.push_back(value);
+            }
+        }
+        REQUIRE(deque.GetSegmentsCount() > 1000);
+        REQUIRE(deque_parallel::Reduce(policy, std::as_const(deque), int64_t{7}) ==
+                std::accumulate(expected.begin(), expected.end(), int64_t{7}));
+
+        const SmallBlockDeque<int> snapshot = deque;
+        deque_parallel::Transform(policy, deque, [](int x) { return x / 2; });
+        for (int &x : expected) {
+            x /= 2;
+        }
+        REQUIRE(std::ranges::equal(std::as_const(deque), expected));
+        REQUIRE(snapshot[0] != deque[0]);
+
+        std::atomic<int64_t> sum = 0;
+        deque_parallel::ForEach(policy, std::as_const(deque), [&sum](int x) {
+            sum.fetch_add(x, std::memory_order_relaxed);
+        });
+        REQUIRE(sum == std::accumulate(expected.begin(), expected.end(), int64_t{0}));
+        deque_parallel::ForEach(policy, deque, [](int &x) { ++x; });
+        for (int &x : expected) {
+            ++x;
+        }
+
+        deque_parallel::Sort(policy, deque);
+        std::ranges::sort(expected);
+        REQUIRE(std::ranges::equal(std::as_const(deque), expected));
+        deque_parallel::Sort(policy, deque, std::greater<>());
+        REQUIRE(std::ranges::equal(std::as_const(deque), expected | std::views::reverse));
+
+        Deque<std::string> strings;
+        for (int i = 0; i < 20000; ++i) {
+            strings.PushBack(std::to_string(gen()));
+        }
+        deque_parallel::Sort(policy, strings);
+        REQUIRE(std::ranges::is_sorted(std::as_const(strings)));
+        auto length = deque_parallel::Reduce(
+                policy, std::as_const(strings), std::string(),
+                [](const std::string &lhs, const std::string &rhs) {
+                    return std::string(lhs.size() + rhs.size(), 'x');
+                });
+        size_t expected_length = 0;
+        for (const std::string &string : std::as_const(strings)) {
+            expected_length += string.size();
+        }
+        REQUIRE(length.size() == expected_length);
+
+        Deque<int> empty;
+        deque_parallel::Sort(policy, empty);
+        deque_parallel::Transform(policy, empty, [](int x) { return x; });
+        REQUIRE(deque_parallel::Reduce(policy, std::as_const(empty), 5) == 5);
+    };
+    check(std::execution::seq);
+    check(std::execution::unseq);
+    check(std::execution::par);
+    check(std::execution::par_unseq);
+}
+
+TEST_CASE("Block storage is cache line aligned") {
+    for (auto storage : {BlockStorage::kSeparate, BlockStorage::kSlab}) {
+        Deque a(storage);
+        for (int i = 0; i < 1000; ++i) {
+            a.PushBack(i);
+        }
+        for (size_t i = 0; i < a.Size(); i += 128) {
+            REQUIRE(reinterpret_cast<uintptr_t>(&a[i]) % 64 == 0);
+        }
+    }
+}
+
+TEST_CASE("Block size presets") {
+    SmallBlockDeque<> small;
+    PageBlockDeque<int64_t> page;
+    LargeBlockDeque<char> large;
+    std::vector<int> expected;
+    for (int i = 0; i < 100000; ++i) {
+        small.PushFront(i);
+        page.PushBack(i);
+        large.PushBack(static_cast<char>(i));
+        expected.push_back(i);
+    }
+    REQUIRE(std::ranges::equal(small | std::views::reverse, expected));
+    REQUIRE(std::ranges::equal(page, expected));
+    // Elements stay contiguous up to the end of the preset block
+    for (int i = 0; i < (1 << 16) - 1; i += 1000) {
+        REQUIRE(&large[i] + 1 == &large[i + 1]);
+    }
+    REQUIRE(&page[510] + 1 == &page[511]);
+}
+
+TEST_CASE("Page placement") {
+    REQUIRE(deque_placement::GetCurrentNode() >= 0);
+    using deque_placement::PageKind;
+    for (auto pages : {PageKind::kRegular, PageKind::kTransparentHuge, PageKind::kHuge}) {
+        for (int node : {deque_placement::kAnyNode, deque_placement::kLocalNode}) {
+            deque_placement::PageResource resource({pages, node});
+            std::vector<int> expected(100000);
+            std::iota(expected.begin(), expected.end(), 0);
+            {
+                Deque a(BlockStorage::kSlab, &resource);
+                a.PushBackRange(expected);
+                Check(a, expected);
+                // Regions are whole huge pages, and the slab chunks of the deque share them
+                REQUIRE(resource.GetMappedBytes() > 0);
+                REQUIRE(resource.GetMappedBytes() % deque_placement::kHugePageBytes == 0);
+                REQUIRE(resource.GetMappedBytes() < 2 * a.Stats().allocated_bytes +
+                                                            deque_placement::kHugePageBytes);
+                REQUIRE(resource.GetHugeTlbBytes() <= resource.GetMappedBytes());
+                auto address = reinterpret_cast<uintptr_t>(&a[0]);
+                REQUIRE(address / deque_placement::kHugePageBytes ==
+                        reinterpret_cast<uintptr_t>(&a[1000]) / deque_placement::kHugePageBytes);
+
+                // Larger than a region
+                void *large = resource.allocate(3 * deque_placement::kHugePageBytes, 64);
+                std::memset(large, 1, 3 * deque_placement::kHugePageBytes);
+                resource.deallocate(large, 3 * deque_placement::kHugePageBytes, 64);
+                Deque b(a, &resource);
+                a.Clear();
+                a.ShrinkToFit();
+                Check(b, expected);
+            }
+            // Only the current region is kept
+            REQUIRE(resource.GetMappedBytes() <= deque_placement::kHugePageBytes);
+        }
+    }
+}
+
+TEST_CASE("SpscDeque") {
+    {
+        SpscDeque<std::unique_ptr<int>> a;
+        std::unique_ptr<int> value;
+        REQUIRE(a.IsEmpty());
+        REQUIRE(!a.TryPopFront(value));
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 1000; ++i) {
+                a.PushBack(std::make_unique<int>(i));
+            }
+            for (int i = 0; i < 1000; ++i) {
+                REQUIRE(!a.IsEmpty());
+                REQUIRE(a.TryPopFront(value));
+                REQUIRE(*value == i);
+            }
+            REQUIRE(a.IsEmpty());
+            REQUIRE(!a.TryPopFront(value));
+        }
+        // Elements left in the queue are destroyed with it
+        a.EmplaceBack(new int(5));
+        a.PushBack(std::make_unique<int>(6));
+    }
+    {
+        // Once the queue reaches its peak, its blocks are recycled instead of allocated
+        CountingResource resource;
+        SpscDeque<int, 64> a(&resource);
+        int value;
+        for (int i = 0; i < 100; ++i) {
+            a.PushBack(i);
+        }
+        size_t allocations = resource.allocations;
+        for (int i = 100; i < 100000; ++i) {
+            a.PushBack(i);
+            REQUIRE(a.TryPopFront(value));
+            REQUIRE(value == i - 100);
+        }
+        REQUIRE(resource.allocations <= allocations + 1);
+    }
+    {
+        const int count = 1000000;
+        SpscDeque<int> a;
+        std::thread producer([&a] {
+            for (int i = 0; i < count; ++i) {
+                a.PushBack(i);
+            }
+        });
+        int expected = 0;
+        int value;
+        while (expected < count) {
+            if (a.TryPopFront(value)) {
+                REQUIRE(value == expected);
+                ++expected;
+            }
+        }
+        producer.join();
+        REQUIRE(a.IsEmpty());
+    }
+}
+
+TEST_CASE("WorkStealingDeque") {
+    {
+        WorkStealingDeque<int, 64> a;
+        REQUIRE(!a.PopBack());
+        REQUIRE(!a.Steal());
+        for (int i = 0; i < 1000; ++i) {
+            a.PushBack(i);
+        }
+        REQUIRE(a.Size() == 1000u);
+        for (int i = 0; i < 500; ++i) {
+            REQUIRE(a.Steal() == i);
+            REQUIRE(a.PopBack() == 999 - i);
+        }
+        REQUIRE(!a.PopBack());
+        REQUIRE(!a.Steal());
+
+        // The used blocks wander around the map and the map grows while they are in the middle
+        int next_steal = 0;
+        int next_push = 0;
+        for (int round = 0; round < 100; ++round) {
+            for (int i = 0; i < 37 * round; ++i) {
+                a.PushBack(next_push++);
+            }
+            for (int i = 0; i < 30 * round; ++i) {
+                REQUIRE(a.Steal() == next_steal++);
+            }
+        }
+        REQUIRE(a.Size() == static_cast<size_t>(next_push - next_steal));
+        while (auto value = a.PopBack()) {
+            REQUIRE(*value == --next_push);
+        }
+        REQUIRE(next_push == next_steal);
+    }
+    {
+        const int count = 200000;
+        const int thieves = 3;
+        WorkStealingDeque<int> a;
+        std::vector<std::atomic<int>> taken(count);
+        std::atomic<bool> done = false;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thieves; ++i) {
+            threads.emplace_back([&] {
+                while (!done.load()) {
+                    if (auto value = a.Steal()) {
+                        taken[*value].fetch_add(1);
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < count; ++i) {
+            a.PushBack(i);
+            if (i % 3 == 0) {
+                if (auto value = a.PopBack()) {
+                    taken[*value].fetch_add(1);
+                }
+            }
+        }
+        while (auto value = a.PopBack()) {
+            taken[*value].fetch_add(1);
+        }
+        while (a.Size() > 0) {
+            std::this_thread::yield();
+        }
+        done = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        REQUIRE(std::ranges::all_of(taken, [](const std::atomic<int> &x) { return x == 1; }));
+    }
+}
+
+TEST_CASE("MpmcRing") {
+    {
+        MpmcRing<std::string, 128> a(10);
+        REQUIRE(a.Capacity() == 16u);
+        std::string value;
+        REQUIRE(!a.TryPop(value));
+        std::vector<std::string> values;
+        for (int i = 0; i < 20; ++i) {
+            values.push_back(std::to_string(i));
+        }
+        REQUIRE(a.TryPushBatch(values) == 16u);
+        REQUIRE(!a.TryPush(std::string("x")));
+        std::vector<std::string> out(5);
+        REQUIRE(a.TryPopBatch(out) == 5u);
+        REQUIRE(out == std::vector<std::string>(values.begin(), values.begin() + 5));
+        REQUIRE(a.TryPushBatch(std::span(values).subspan(16)) == 4u);
+        REQUIRE(a.TryPush(std::string("20")));
+        out.resize(20);
+        REQUIRE(a.TryPopBatch(out) == 16u);
+        REQUIRE(out[15] == "20");
+        REQUIRE(out[14] == "19");
+        REQUIRE(!a.TryPop(value));
+        // Elements left in the ring are destroyed with it
+        REQUIRE(a.TryPushBatch(values) == 16u);
+    }
+    {
+        const int producers = 3;
+        const int consumers = 3;
+        const int count = 100000;
+        MpmcRing<int> a(1024);
+        std::vector<std::atomic<int>> taken(producers * count);
+        std::atomic<int> popped = 0;
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                std::vector<int> batch;
+                int next = 0;
+                while (next < count) {
+                    batch.clear();
+                    for (int i = next; i < std::min(count, next + 1 + next % 37); ++i) {
+                        batch.push_back(p * count + i);
+                    }
+                    next += static_cast<int>(a.TryPushBatch(batch));
+                }
+            });
+        }
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&, c] {
+                std::vector<int> batch(1 + c * 20);
+                while (popped.load() < producers * count) {
+                    size_t size = a.TryPopBatch(batch);
+                    for (size_t i = 0; i < size; ++i) {
+                        taken[batch[i]].fetch_add(1);
+                    }
+                    popped.fetch_add(static_cast<int>(size));
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        REQUIRE(std::ranges::all_of(taken, [](const std::atomic<int> &x) { return x == 1; }));
+    }
+}
+
+namespace {
+// Runs right away and frees its frame when it returns
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+// Run queue of a single threaded event loop
+struct QueueScheduler {
+    std::deque<std::coroutine_handle<>> *queue;
+
+    void Schedule(std::coroutine_handle<> handle) {
+        queue->push_back(handle);
+    }
+};
+
+void RunAll(std::deque<std::coroutine_handle<>> &queue) {
+    while (!queue.empty()) {
+        std::coroutine_handle<> handle = queue.front();
+        queue.pop_front();
+        handle.resume();
+    }
+}
+
+template<class Channel>
+DetachedTask Produce(Channel &channel, int first, int count, std::atomic<int> &done,
+                     size_t *max_size = nullptr) {
+    for (int i = first; i < first + count; ++i) {
+        if (!co_await channel.Push(i)) {
+            co_return;
+        }
+        if (max_size != nullptr) {
+            *max_size = std::max(*max_size, channel.Size());
+        }
+    }
+    ++done;
+}
+
+template<class Channel, class Value>
+DetachedTask Consume(Channel &channel, std::vector<Value> &out, std::atomic<int> &done) {
+    while (std::optional<Value> value = co_await channel.Pop()) {
+        out.push_back(*value);
+    }
+    ++done;
+}
+}  // namespace
+
+TEST_CASE("AsyncDeque") {
+    std::deque<std::coroutine_handle<>> queue;
+    {
+        // Producers wait while the channel is full, consumers while it is empty
+        AsyncDeque<int, QueueScheduler> channel(4, QueueScheduler{&queue});
+        std::atomic<int> produced = 0;
+        std::atomic<int> consumed = 0;
+        std::vector<int> first;
+        std::vector<int> second;
+        size_t max_size = 0;
+        Consume(channel, first, consumed);
+        Consume(channel, second, consumed);
+        Produce(channel, 0, 1000, produced, &max_size);
+        Produce(channel, 1000, 1000, produced, &max_size);
+        RunAll(queue);
+        REQUIRE(produced == 2);
+        REQUIRE(max_size <= 4u);
+        REQUIRE(consumed == 0);
+        channel.Close();
+        RunAll(queue);
+        REQUIRE(consumed == 2);
+        for (const auto *out : {&first, &second}) {
+            for (size_t i = 1; i < out->size(); ++i) {
+                REQUIRE(((*out)[i - 1] < (*out)[i] or (*out)[i] < 1000));
+            }
+        }
+        std::vector<int> all = first;
+        all.insert(all.end(), second.begin(), second.end());
+        std::ranges::sort(all);
+        std::vector<int> expected(2000);
+        std::iota(expected.begin(), expected.end(), 0);
+        REQUIRE(all == expected);
+    }
+    {
+        // One batch push serves every suspended pop with one lock round trip
+        AsyncDeque<int, QueueScheduler> channel(AsyncDeque<int, QueueScheduler>::kUnbounded,
+                                                QueueScheduler{&queue});
+        std::atomic<int> consumed = 0;
+        std::vector<int> outs[3];
+        for (auto &out : outs) {
+            Consume(channel, out, consumed);
+        }
+        REQUIRE(queue.empty());
+        std::vector<int> values{1, 2, 3, 4, 5};
+        REQUIRE(channel.TryPushBatch(values) == 5u);
+        REQUIRE(queue.size() == 3u);
+        REQUIRE(channel.Size() == 2u);
+        RunAll(queue);
+        REQUIRE(channel.Size() == 0u);
+        channel.Close();
+        REQUIRE(!channel.TryPush(6));
+        RunAll(queue);
+        REQUIRE(consumed == 3);
+        REQUIRE(outs[0].size() + outs[1].size() + outs[2].size() == 5u);
+    }
+    {
+        // Without room every push waits for its pop, a closed channel fails the pushes
+        AsyncDeque<int> rendezvous(0);
+        std::atomic<int> produced = 0;
+        Produce(rendezvous, 0, 2, produced);
+        REQUIRE(rendezvous.Size() == 0u);
+        REQUIRE(rendezvous.TryPop() == 0);
+        REQUIRE(!rendezvous.TryPush(5));
+        int out[4];
+        REQUIRE(rendezvous.TryPopBatch(out) == 1u);
+        REQUIRE(out[0] == 1);
+        REQUIRE(produced == 1);
+        REQUIRE(!rendezvous.TryPop());
+
+        AsyncDeque<int> channel(1);
+        REQUIRE(channel.TryPush(-1));
+        Produce(channel, 0, 1, produced);
+        channel.Close();
+        REQUIRE(produced == 1);
+        REQUIRE(channel.IsClosed());
+        REQUIRE(channel.TryPop() == -1);
+        REQUIRE(!channel.TryPop());
+    }
+    {
+        // A throwing copy releases the lock and still resumes the pops it served
+        using Channel = AsyncDeque<ThrowsOnCopy, QueueScheduler>;
+        Channel channel(Channel::kUnbounded, QueueScheduler{&queue});
+        std::atomic<int> consumed = 0;
+        std::vector<ThrowsOnCopy> out;
+        Consume(channel, out, consumed);
+        std::vector<ThrowsOnCopy> values(3);
+        ThrowsOnCopy::copies_left = 2;
+        REQUIRE_THROWS_AS(channel.TryPushBatch(values), std::runtime_error);
+        REQUIRE(queue.size() == 1u);
+        REQUIRE(channel.Size() == 0u);
+        // The argument is copied, then the copy into the channel throws
+        ThrowsOnCopy::copies_left = 1;
+        REQUIRE_THROWS_AS(channel.TryPush(values[0]), std::runtime_error);
+        REQUIRE(channel.Size() == 0u);
+        ThrowsOnCopy::copies_left = 100;
+        REQUIRE(channel.TryPush(values[0]));
+        RunAll(queue);
+        REQUIRE(out.size() == 2u);
+        REQUIRE(channel.Size() == 0u);
+        channel.Close();
+        RunAll(queue);
+        REQUIRE(consumed == 1);
+    }
+    REQUIRE(ThrowsOnCopy::alive == 0);
+    {
+        // Coroutines suspended on one thread are resumed by the operations of others
+        const int producers = 4;
+        const int count = 20000;
+        AsyncDeque<int> channel(64);
+        std::atomic<int> produced = 0;
+        std::atomic<int> consumed = 0;
+        std::vector<int> outs[2];
+        for (auto &out : outs) {
+            Consume(channel, out, consumed);
+        }
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] { Produce(channel, p * count, count, produced); });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        while (produced < producers) {
+            std::this_thread::yield();
+        }
+        while (channel.Size() > 0) {
+            std::this_thread::yield();
+        }
+        channel.Close();
+        REQUIRE(consumed == 2);
+        std::vector<int> all = outs[0];
+        all.insert(all.end(), outs[1].begin(), outs[1].end());
+        std::ranges::sort(all);
+        std::vector<int> expected(producers * count);
+        std::iota(expected.begin(), expected.end(), 0);
+        REQUIRE(all == expected);
+    }
+}
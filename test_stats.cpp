@@ -0,0 +1,127 @@
+// The counters of Deque::Stats() and the scrubbing of removed elements, built with DEQUE_STATS
+// and DEQUE_SCRUB defined
+#include <catch.hpp>
+
+#include <string>
+#include <memory_resource>
+#include <algorithm>
+
+#include <deque.h>
+
+static_assert(deque_settings::kScrubRemoved, "test_stats.cpp is built with DEQUE_SCRUB");
+#ifndef DEQUE_STATS
+#error "test_stats.cpp is built with DEQUE_STATS"
+#endif
+
+namespace {
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+private:
+    void* do_allocate(size_t size, size_t alignment) override {
+        ++allocations;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, size_t size, size_t alignment) override {
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+}  // namespace
+
+TEST_CASE("Removed elements are scrubbed") {
+    auto is_zeroed = [](const void *slot, size_t size) {
+        auto bytes = static_cast<const char*>(slot);
+        return std::all_of(bytes, bytes + size, [](char byte) { return byte == 0; });
+    };
+    Deque<std::string> a;
+    for (int i = 0; i < 1000; ++i) {
+        a.PushBack("secret " + std::to_string(i));
+    }
+    const std::string *first = &a[0];
+    const std::string *last = &a[999];
+    const std::string *before_last = &a[997];
+    a.PopFront();
+    a.PopBack();
+    REQUIRE(is_zeroed(first, sizeof(std::string)));
+    REQUIRE(is_zeroed(last, sizeof(std::string)));
+    // Elements 992 to 1007 share a block, which stays
+    a.PopBackN(3);
+    REQUIRE(is_zeroed(before_last, 2 * sizeof(std::string)));
+    REQUIRE(a[a.Size() - 1] == "secret 995");
+
+    Deque<int*> pointers(1000);
+    REQUIRE(std::all_of(pointers.begin(), pointers.end(), [](int *p) { return p == nullptr; }));
+}
+
+TEST_CASE("Stats") {
+    const size_t block = deque_settings::kBlockSize<int>;
+    for (auto storage : {BlockStorage::kSeparate, BlockStorage::kSlab}) {
+        CountingResource resource;
+        Deque a(storage, &resource);
+        DequeStats stats = a.Stats();
+        REQUIRE(stats.size == 0);
+        REQUIRE(stats.live_blocks == 0);
+        REQUIRE(stats.map_capacity == deque_settings::kInlineMapSize);
+        REQUIRE(stats.head_slack == 0);
+        REQUIRE(stats.tail_slack == 0);
+        REQUIRE(stats.allocated_bytes == 0);
+        REQUIRE(resource.allocations == 0);
+
+        for (size_t i = 0; i < 100 * block + 10; ++i) {
+            a.PushBack(static_cast<int>(i));
+        }
+        stats = a.Stats();
+        REQUIRE(stats.live_blocks == 101);
+        REQUIRE(stats.tail_slack == block - 10);
+        REQUIRE(stats.head_slack == 0);
+        REQUIRE(stats.map_capacity == 128);
+        // The inline map spills into a map of kBufferInitMaxSize slots first. Every later map
+        // is filled in two slots per block added from when the one before is half used, so
+        // the map of 256 slots is on its way
+        REQUIRE(stats.map_expansions == 5);
+        REQUIRE(stats.map_bytes_moved == (2 + 16 + 32 + 64 + 2 * (101 - 64)) * sizeof(void*));
+        REQUIRE(stats.block_allocations == 101);
+        REQUIRE(stats.allocated_bytes == resource.bytes);
+
+        a.PopFrontN(50 * block + 5);
+        REQUIRE(a.Stats().head_slack == 5);
+        REQUIRE(a.Stats().allocated_bytes == resource.bytes);
+        for (size_t i = 0; i < 50 * block + 5; ++i) {
+            a.PushFront(0);
+        }
+        stats = a.Stats();
+        REQUIRE(stats.size == 100 * block + 10);
+        REQUIRE(stats.peak_size == 100 * block + 10);
+        REQUIRE(stats.pool_hits >= deque_settings::kBlockPoolMaxSize);
+        if (storage == BlockStorage::kSeparate) {
+            REQUIRE(stats.block_allocations - stats.block_frees ==
+                    stats.live_blocks + stats.pooled_blocks);
+        } else {
+            // Freed slab blocks are all kept and reused
+            REQUIRE(stats.block_allocations + stats.pool_hits - stats.block_frees ==
+                    stats.live_blocks);
+        }
+        REQUIRE(stats.allocated_bytes == resource.bytes);
+
+        a.Clear();
+        a.ShrinkToFit();
+        stats = a.Stats();
+        REQUIRE(stats.size == 0);
+        REQUIRE(stats.peak_size == 100 * block + 10);
+        REQUIRE(stats.allocated_bytes == resource.bytes);
+    }
+
+    // Deques constructed with their elements start at that size, with a resource or without
+    CountingResource resource;
+    REQUIRE(Deque<int>(1000).Stats().peak_size == 1000);
+    REQUIRE(Deque<int>(1000, &resource).Stats().peak_size == 1000);
+}
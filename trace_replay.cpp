@@ -0,0 +1,551 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <random>
+#include <ranges>
+#include <span>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <async_deque.h>
+#include <bounded_deque.h>
+#include <deque.h>
+#include <deque_io.h>
+#include <deque_trace.h>
+#include <mpmc_ring.h>
+#include <spsc_deque.h>
+#include <work_stealing_deque.h>
+
+// Replays an operation trace (see deque_trace.h) against Deque, std::deque and the other
+// containers of this repository and reports throughput, a latency histogram and peak RSS for
+// each. Every container runs in a child process of its own, so that the peak RSS is its own.
+// Throughput is measured by a pass without clocks, latencies by a second pass on a new
+// container that reads the clock around every operation, so they include the clock overhead.
+// Containers that lack an operation skip it: the queues only push back and pop front, and
+// BoundedDeque holds the peak size of the trace and evicts instead of growing.
+//
+//     trace_replay generate <trace> [operations] [seed]
+//     trace_replay <trace>
+
+namespace {
+
+using deque_trace::Entry;
+using deque_trace::Op;
+
+constexpr int kHistogramBuckets = 64;
+
+// Elements an operation pushes or pops: the argument of the counted ones, which may be zero,
+// and one for the others
+uint64_t GetCount(const Entry &entry) {
+    switch (entry.op) {
+        case Op::kPushBackRange:
+        case Op::kPushFrontRange:
+        case Op::kPopBackN:
+        case Op::kPopFrontN:
+            return entry.arg;
+        default:
+            return 1;
+    }
+}
+
+// The values a range push of count elements adds from value on. Counted in 64 bits, they wrap
+// around instead of overflowing
+auto GetValues(int value, uint64_t count) {
+    return std::views::iota(uint64_t{0}, count) | std::views::transform([value](uint64_t i) {
+               return static_cast<int>(static_cast<uint64_t>(value) + i);
+           });
+}
+
+struct ReplayResult {
+    uint64_t applied = 0;
+    uint64_t skipped = 0;
+    uint64_t elapsed_ns = 0;
+    // Bucket b counts the operations that took less than 2^b ns and at least half that
+    uint64_t histogram[kHistogramBuckets] = {};
+    // Sum of the elements read, so that the reads are not optimized out
+    uint64_t checksum = 0;
+};
+
+class DequeTarget {
+public:
+    static constexpr const char *kName = "Deque";
+
+    explicit DequeTarget(size_t) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        switch (entry.op) {
+            case Op::kPushBack:
+                deque_.PushBack(value);
+                break;
+            case Op::kPushFront:
+                deque_.PushFront(value);
+                break;
+            case Op::kPopBack:
+                deque_.PopBack();
+                break;
+            case Op::kPopFront:
+                deque_.PopFront();
+                break;
+            case Op::kIndex:
+                checksum += std::as_const(deque_)[entry.arg];
+                break;
+            case Op::kPushBackRange:
+                deque_.PushBackRange(GetValues(value, entry.arg));
+                break;
+            case Op::kPushFrontRange:
+                deque_.PushFrontRange(GetValues(value, entry.arg));
+                break;
+            case Op::kPopBackN:
+                deque_.PopBackN(entry.arg);
+                break;
+            case Op::kPopFrontN:
+                deque_.PopFrontN(entry.arg);
+                break;
+            case Op::kClear:
+                deque_.Clear();
+                break;
+        }
+        return true;
+    }
+
+private:
+    Deque<int> deque_;
+};
+
+class StdDequeTarget {
+public:
+    static constexpr const char *kName = "std::deque";
+
+    explicit StdDequeTarget(size_t) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        auto values = GetValues(value, entry.arg);
+        switch (entry.op) {
+            case Op::kPushBack:
+                deque_.push_back(value);
+                break;
+            case Op::kPushFront:
+                deque_.push_front(value);
+                break;
+            case Op::kPopBack:
+                deque_.pop_back();
+                break;
+            case Op::kPopFront:
+                deque_.pop_front();
+                break;
+            case Op::kIndex:
+                checksum += deque_[entry.arg];
+                break;
+            case Op::kPushBackRange:
+                std::ranges::copy(values, std::back_inserter(deque_));
+                break;
+            case Op::kPushFrontRange:
+                std::ranges::copy(values, std::inserter(deque_, deque_.begin()));
+                break;
+            case Op::kPopBackN:
+                deque_.erase(deque_.end() - static_cast<ptrdiff_t>(entry.arg), deque_.end());
+                break;
+            case Op::kPopFrontN:
+                deque_.erase(deque_.begin(), deque_.begin() + static_cast<ptrdiff_t>(entry.arg));
+                break;
+            case Op::kClear:
+                deque_.clear();
+                break;
+        }
+        return true;
+    }
+
+private:
+    std::deque<int> deque_;
+};
+
+class BoundedDequeTarget {
+public:
+    static constexpr const char *kName = "BoundedDeque";
+
+    explicit BoundedDequeTarget(size_t peak_size) : window_(std::max<size_t>(1, peak_size)) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        switch (entry.op) {
+            case Op::kPushBack:
+                window_.PushBack(value);
+                return true;
+            case Op::kPushBackRange:
+                for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                    window_.PushBack(value);
+                }
+                return true;
+            case Op::kPopFront:
+            case Op::kPopFrontN:
+                for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                    if (window_.Size() > 0) {
+                        window_.PopFront();
+                    }
+                }
+                return true;
+            case Op::kIndex:
+                if (entry.arg < window_.Size()) {
+                    checksum += window_[entry.arg];
+                }
+                return true;
+            case Op::kClear:
+                window_.Clear();
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    BoundedDeque<int> window_;
+};
+
+// Adapters of the containers that only push back and pop front, Queue::TryPop takes the
+// front element into value
+template<class Queue>
+bool ApplyToQueue(Queue &queue, const Entry &entry, int value, uint64_t &checksum) {
+    switch (entry.op) {
+        case Op::kPushBack:
+        case Op::kPushBackRange:
+            for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                queue.Push(value);
+            }
+            return true;
+        case Op::kPopFront:
+        case Op::kPopFrontN:
+            for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                checksum += queue.TryPop(value) ? value : 0;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+class SpscDequeTarget {
+public:
+    static constexpr const char *kName = "SpscDeque";
+
+    explicit SpscDequeTarget(size_t) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        return ApplyToQueue(*this, entry, value, checksum);
+    }
+
+    void Push(int value) {
+        deque_.PushBack(value);
+    }
+
+    bool TryPop(int &value) {
+        return deque_.TryPopFront(value);
+    }
+
+private:
+    SpscDeque<int> deque_;
+};
+
+class MpmcRingTarget {
+public:
+    static constexpr const char *kName = "MpmcRing";
+
+    explicit MpmcRingTarget(size_t peak_size) : ring_(std::max<size_t>(1, peak_size)) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        return ApplyToQueue(*this, entry, value, checksum);
+    }
+
+    // A full ring drops the element
+    void Push(int value) {
+        ring_.TryPush(value);
+    }
+
+    bool TryPop(int &value) {
+        return ring_.TryPop(value);
+    }
+
+private:
+    MpmcRing<int> ring_;
+};
+
+class AsyncDequeTarget {
+public:
+    static constexpr const char *kName = "AsyncDeque";
+
+    explicit AsyncDequeTarget(size_t) {
+    }
+
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        return ApplyToQueue(*this, entry, value, checksum);
+    }
+
+    void Push(int value) {
+        channel_.TryPush(value);
+    }
+
+    bool TryPop(int &value) {
+        std::optional<int> element = channel_.TryPop();
+        value = element.value_or(0);
+        return element.has_value();
+    }
+
+private:
+    AsyncDeque<int> channel_;
+};
+
+class WorkStealingDequeTarget {
+public:
+    static constexpr const char *kName = "WorkStealingDeque";
+
+    explicit WorkStealingDequeTarget(size_t) {
+    }
+
+    // The owner pushes and pops the back, thieves steal the front
+    bool Apply(const Entry &entry, int value, uint64_t &checksum) {
+        switch (entry.op) {
+            case Op::kPushBack:
+            case Op::kPushBackRange:
+                for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                    deque_.PushBack(value);
+                }
+                return true;
+            case Op::kPopBack:
+            case Op::kPopBackN:
+                for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                    checksum += deque_.PopBack().value_or(0);
+                }
+                return true;
+            case Op::kPopFront:
+            case Op::kPopFrontN:
+                for (uint64_t i = 0; i < GetCount(entry); ++i) {
+                    checksum += deque_.Steal().value_or(0);
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    WorkStealingDeque<int> deque_;
+};
+
+// Measures what the process needs without any container
+class NoTarget {
+public:
+    static constexpr const char *kName = "(baseline)";
+
+    explicit NoTarget(size_t) {
+    }
+
+    bool Apply(const Entry &, int, uint64_t &) {
+        return false;
+    }
+};
+
+uint64_t GetNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+template<class Target>
+ReplayResult Replay(const Deque<Entry> &entries, size_t peak_size) {
+    ReplayResult result;
+    {
+        Target target(peak_size);
+        uint64_t start = GetNanoseconds();
+        // Wraps around in long traces
+        unsigned value = 0;
+        for (const Entry &entry : entries) {
+            if (target.Apply(entry, static_cast<int>(value++), result.checksum)) {
+                ++result.applied;
+            } else {
+                ++result.skipped;
+            }
+        }
+        result.elapsed_ns = GetNanoseconds() - start;
+    }
+    Target target(peak_size);
+    unsigned value = 0;
+    uint64_t checksum = 0;
+    for (const Entry &entry : entries) {
+        uint64_t start = GetNanoseconds();
+        if (target.Apply(entry, static_cast<int>(value++), checksum)) {
+            uint64_t elapsed = GetNanoseconds() - start;
+            ++result.histogram[std::min<uint64_t>(std::bit_width(elapsed), kHistogramBuckets - 1)];
+        }
+    }
+    return result;
+}
+
+// Upper bound of the bucket holding the operation at fraction of all the timed ones
+uint64_t GetPercentile(const ReplayResult &result, double fraction) {
+    uint64_t total = 0;
+    for (uint64_t count : result.histogram) {
+        total += count;
+    }
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+        seen += result.histogram[bucket];
+        if (seen > 0 and static_cast<double>(seen) >= fraction * static_cast<double>(total)) {
+            return uint64_t{1} << bucket;
+        }
+    }
+    return 0;
+}
+
+// Replays in a child process, the result comes through a pipe. Returns the peak RSS of the
+// child in KiB, or -1 when it failed
+template<class Target>
+long ReplayInChild(const Deque<Entry> &entries, size_t peak_size, ReplayResult &result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ReplayResult child_result = Replay<Target>(entries, peak_size);
+        bool is_written = write(fds[1], &child_result, sizeof(child_result)) ==
+                          static_cast<ssize_t>(sizeof(child_result));
+        _exit(is_written ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t count = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid or !WIFEXITED(status) or
+        WEXITSTATUS(status) != 0 or count != static_cast<ssize_t>(sizeof(result))) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+template<class Target>
+void Report(const Deque<Entry> &entries, size_t peak_size, long baseline_rss) {
+    ReplayResult result;
+    long rss = ReplayInChild<Target>(entries, peak_size, result);
+    if (rss < 0) {
+        std::printf("%-18s failed\n", Target::kName);
+        return;
+    }
+    double mops = result.elapsed_ns == 0 ? 0 : 1e3 * static_cast<double>(result.applied) /
+                                                       static_cast<double>(result.elapsed_ns);
+    std::printf("%-18s %10llu %10llu %8.2f %8llu %8llu %8llu %10ld\n", Target::kName,
+                static_cast<unsigned long long>(result.applied),
+                static_cast<unsigned long long>(result.skipped), mops,
+                static_cast<unsigned long long>(GetPercentile(result, 0.5)),
+                static_cast<unsigned long long>(GetPercentile(result, 0.99)),
+                static_cast<unsigned long long>(GetPercentile(result, 0.999)),
+                std::max(0L, rss - baseline_rss));
+}
+
+// A random mix of all the operations around a slowly changing size, recorded like a
+// production deque would be
+int Generate(const char *path, size_t operations, unsigned seed) {
+    deque_trace::TraceWriter writer;
+    deque_trace::RecordingDeque<int> deque(writer);
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(0, 99);
+    for (size_t i = 0; i < operations; ++i) {
+        int code = dist(gen);
+        size_t size = deque.Size();
+        if (code < 24) {
+            deque.PushBack(static_cast<int>(i));
+        } else if (code < 48) {
+            deque.PushFront(static_cast<int>(i));
+        } else if (code < 68 and size > 0) {
+            deque.PopFront();
+        } else if (code < 88 and size > 0) {
+            deque.PopBack();
+        } else if (code < 96 and size > 0) {
+            deque[gen() % size];
+        } else if (code < 98) {
+            deque.PushBackRange(std::views::iota(0, static_cast<int>(gen() % 1000)));
+        } else if (size > 0) {
+            deque.PopFrontN(gen() % size);
+        }
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 or deque_io::WriteTo(fd, writer.GetBytes()) < 0 or close(fd) != 0) {
+        std::perror(path);
+        return 1;
+    }
+    std::printf("%zu operations, %zu bytes\n", writer.GetEntriesCount(),
+                writer.GetBytes().Size());
+    return 0;
+}
+
+int ReplayFile(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 or fstat(fd, &status) != 0 or status.st_size == 0) {
+        std::perror(path);
+        return 1;
+    }
+    size_t length = status.st_size;
+    void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        std::perror(path);
+        return 1;
+    }
+    Deque<Entry> entries;
+    size_t peak_size = 0;
+    bool is_read = deque_trace::ReadTrace(
+            std::span(static_cast<const std::byte *>(address), length), entries, &peak_size);
+    munmap(address, length);
+    if (!is_read) {
+        std::fprintf(stderr, "%s: not a valid trace\n", path);
+        return 1;
+    }
+    std::printf("%zu operations, peak size %zu\n\n", entries.Size(), peak_size);
+    std::printf("%-18s %10s %10s %8s %8s %8s %8s %10s\n", "container", "applied", "skipped",
+                "Mop/s", "p50 ns", "p99 ns", "p999 ns", "RSS KiB");
+    ReplayResult baseline;
+    long baseline_rss = ReplayInChild<NoTarget>(entries, peak_size, baseline);
+    Report<DequeTarget>(entries, peak_size, baseline_rss);
+    Report<StdDequeTarget>(entries, peak_size, baseline_rss);
+    Report<BoundedDequeTarget>(entries, peak_size, baseline_rss);
+    Report<SpscDequeTarget>(entries, peak_size, baseline_rss);
+    Report<MpmcRingTarget>(entries, peak_size, baseline_rss);
+    Report<AsyncDequeTarget>(entries, peak_size, baseline_rss);
+    Report<WorkStealingDequeTarget>(entries, peak_size, baseline_rss);
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc >= 3 and std::strcmp(argv[1], "generate") == 0) {
+        size_t operations = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 10000000;
+        unsigned seed = argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 735675;
+        return Generate(argv[2], operations, seed);
+    }
+    if (argc == 2) {
+        return ReplayFile(argv[1]);
+    }
+    std::fprintf(stderr, "usage: %s generate <trace> [operations] [seed]\n       %s <trace>\n",
+                 argv[0], argv[0]);
+    return 2;
+}
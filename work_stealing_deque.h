@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <type_traits>
+
+#include "deque.h"
+
+// Chase-Lev work-stealing deque. The owner thread calls PushBack and PopBack, any thread may
+// call Steal, which takes the oldest element. Owner operations never wait, Steal fails instead
+// of retrying when it loses a race.
+//
+// Elements are kept like in Deque: element i goes to position i % kBlockSize of the block in
+// slot (i / kBlockSize) % map size of a power-of-two block map. Once the used blocks would
+// wrap onto each other the map is doubled like CircularBuffer::ExpandBuffer does. The blocks
+// themselves are carried over, so growing copies map slots but not elements. Thieves may still
+// read through a map that has been replaced, so replaced maps and all blocks are only freed
+// with the deque.
+template<class T, size_t BlockBytes = deque_settings::kBlockBytes>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    ~WorkStealingDeque();
+
+    // Owner side
+
+    void PushBack(T value);
+
+    // The newest element, nothing if the deque is empty or a thief took the last one
+    std::optional<T> PopBack();
+
+    // Any thread
+
+    // The oldest element, nothing if the deque is empty or another thread won the race for it
+    std::optional<T> Steal();
+
+    // May be stale by the time it returns when other threads use the deque
+    size_t Size() const;
+
+    std::pmr::memory_resource *GetMemoryResource() const;
+
+private:
+    // Thieves read elements while the owner may overwrite their slots
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::has_single_bit(BlockBytes));
+
+    // Kept a power of two so that positions are shifts and masks
+    static constexpr size_t kBlockSize =
+            std::bit_floor(deque_settings::kBlockSize<T, BlockBytes>);
+    static constexpr size_t kBlockShift = std::countr_zero(kBlockSize);
+
+    struct TaskBlock {
+        alignas(deque_settings::kBlockAlignment) std::atomic<T> slots[kBlockSize];
+    };
+
+    struct BlockMap {
+        std::atomic<TaskBlock *> *slots;
+        size_t size;
+        // The map this one replaced
+        BlockMap *previous;
+
+        std::atomic<TaskBlock *> &operator[](int64_t block_index) const {
+            return slots[static_cast<size_t>(block_index) & (size - 1)];
+        }
+    };
+
+    using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+    std::pmr::memory_resource *resource_;
+    alignas(deque_settings::kCacheLineSize) std::atomic<int64_t> top_ = 0;
+    alignas(deque_settings::kCacheLineSize) std::atomic<int64_t> bottom_ = 0;
+    std::atomic<BlockMap *> map_;
+
+    BlockMap *AllocateMap(size_t size, BlockMap *previous);
+
+    // Doubles the map keeping the blocks of elements [top, bottom) where they are found
+    BlockMap *ExpandMap(BlockMap *map, int64_t top, int64_t bottom);
+};
+
+template<class T, size_t BlockBytes>
+WorkStealingDeque<T, BlockBytes>::WorkStealingDeque(std::pmr::memory_resource *resource)
+    : resource_(resource), map_(AllocateMap(deque_settings::kBufferInitMaxSize, nullptr)) {
+}
+
+template<class T, size_t BlockBytes>
+WorkStealingDeque<T, BlockBytes>::~WorkStealingDeque() {
+    BlockMap *map = map_.load(std::memory_order_relaxed);
+    // Every block ever allocated is in the newest map
+    for (size_t i = 0; i < map->size; ++i) {
+        if (TaskBlock *block = map->slots[i].load(std::memory_order_relaxed)) {
+            Allocator(resource_).delete_object(block);
+        }
+    }
+    while (map != nullptr) {
+        BlockMap *previous = map->previous;
+        Allocator(resource_).deallocate_object(map->slots, map->size);
+        Allocator(resource_).delete_object(map);
+        map = previous;
+    }
+}
+
+template<class T, size_t BlockBytes>
+typename WorkStealingDeque<T, BlockBytes>::BlockMap *WorkStealingDeque<T, BlockBytes>::AllocateMap(
+        size_t size, BlockMap *previous) {
+    auto *slots = Allocator(resource_).allocate_object<std::atomic<TaskBlock *>>(size);
+    for (size_t i = 0; i < size; ++i) {
+        std::construct_at(slots + i, nullptr);
+    }
+    return Allocator(resource_).new_object<BlockMap>(slots, size, previous);
+}
+
+template<class T, size_t BlockBytes>
+typename WorkStealingDeque<T, BlockBytes>::BlockMap *WorkStealingDeque<T, BlockBytes>::ExpandMap(
+        BlockMap *map, int64_t top, int64_t bottom) {
+    BlockMap *new_map = AllocateMap(map->size * 2, map);
+    int64_t first_block = top >> kBlockShift;
+    size_t used_blocks =
+            top < bottom ? static_cast<size_t>(((bottom - 1) >> kBlockShift) - first_block + 1) : 0;
+    auto get_offset = [first_block](size_t slot, size_t size) {
+        return (slot - static_cast<size_t>(first_block)) & (size - 1);
+    };
+    for (size_t i = 0; i < map->size; ++i) {
+        TaskBlock *block = map->slots[i].load(std::memory_order_relaxed);
+        size_t offset = get_offset(i, map->size);
+        if (block != nullptr and offset < used_blocks) {
+            (*new_map)[first_block + static_cast<int64_t>(offset)].store(
+                    block, std::memory_order_relaxed);
+        }
+    }
+    // Blocks without elements go to the free slots, thieves that lost their race may still
+    // read them through the old map
+    size_t free_slot = 0;
+    for (size_t i = 0; i < map->size; ++i) {
+        TaskBlock *block = map->slots[i].load(std::memory_order_relaxed);
+        if (block == nullptr or get_offset(i, map->size) < used_blocks) {
+            continue;
+        }
+        while (new_map->slots[free_slot].load(std::memory_order_relaxed) != nullptr) {
+            ++free_slot;
+        }
+        new_map->slots[free_slot++].store(block, std::memory_order_relaxed);
+    }
+    map_.store(new_map, std::memory_order_release);
+    return new_map;
+}
+
+template<class T, size_t BlockBytes>
+void WorkStealingDeque<T, BlockBytes>::PushBack(T value) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    BlockMap *map = map_.load(std::memory_order_relaxed);
+    int64_t block_index = bottom >> kBlockShift;
+    if (block_index - (top >> kBlockShift) >= static_cast<int64_t>(map->size)) {
+        map = ExpandMap(map, top, bottom);
+    }
+    TaskBlock *block = (*map)[block_index].load(std::memory_order_relaxed);
+    if (block == nullptr) {
+        block = Allocator(resource_).new_object<TaskBlock>();
+        (*map)[block_index].store(block, std::memory_order_release);
+    }
+    block->slots[bottom & (kBlockSize - 1)].store(value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+}
+
+template<class T, size_t BlockBytes>
+std::optional<T> WorkStealingDeque<T, BlockBytes>::PopBack() {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    BlockMap *map = map_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    TaskBlock *block = (*map)[bottom >> kBlockShift].load(std::memory_order_relaxed);
+    std::optional<T> value =
+            block->slots[bottom & (kBlockSize - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // The last element, thieves may be after it too
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            value.reset();
+        }
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return value;
+}
+
+template<class T, size_t BlockBytes>
+std::optional<T> WorkStealingDeque<T, BlockBytes>::Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return std::nullopt;
+    }
+    BlockMap *map = map_.load(std::memory_order_acquire);
+    TaskBlock *block = (*map)[top >> kBlockShift].load(std::memory_order_acquire);
+    if (block == nullptr) {
+        // Only possible when the element has already been taken
+        return std::nullopt;
+    }
+    T value = block->slots[top & (kBlockSize - 1)].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+template<class T, size_t BlockBytes>
+size_t WorkStealingDeque<T, BlockBytes>::Size() const {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+}
+
+template<class T, size_t BlockBytes>
+std::pmr::memory_resource *WorkStealingDeque<T, BlockBytes>::GetMemoryResource() const {
+    return resource_;
+}